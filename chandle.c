@@ -200,11 +200,44 @@ void cld_get_stack(const char *fname)
     sprintf(backtrace_start, "echo 'END STACK DUMP ***********' >> %s", fname);
     rs = system (backtrace_start);
 
+    // last records from binary trace ring, if used
+    cld_ring_crash_dump (fname);
+
     // skip freeing to avoid potential issues SIGKILL
     //if (dump_msg) { free(dump_msg); } 
 
 }
 
+// 
+// Write the last CLD_RING_CRASH_DUMP records of binary trace ring (if one is used) to file 'fname'.
+// Only trace site and format are written, since rendering arguments needs code outside of this module. The
+// ring file itself stays in trace directory and can be fully decoded with cldtrace.
+//
+void cld_ring_crash_dump (const char *fname)
+{
+    cld_ring *r = cld_crash_ring;
+    if (r == NULL) return;
+    int fd = open (fname, O_WRONLY | O_APPEND | O_CREAT, 0600);
+    if (fd == -1) return;
+
+    int l = snprintf (backtrace_start, sizeof (backtrace_start), "LAST TRACE RECORDS (decode all with: cldtrace <trace directory>/ring-%d) ***********\n", r->pid);
+    if (write (fd, backtrace_start, l) != l) { close (fd); return; }
+
+    unsigned long long last = r->seq;
+    unsigned long long s = (last > CLD_RING_CRASH_DUMP ? last - CLD_RING_CRASH_DUMP : 1);
+    for (; s < last; s++)
+    {
+        cld_ring_rec *rec = &(r->rec[(s - 1) % r->num_records]);
+        if (rec->seq != s) continue; // overwritten or incomplete
+        cld_ring_site *site = (rec->site < r->num_sites ? &(r->site[rec->site]) : NULL);
+        l = snprintf (backtrace_start, sizeof (backtrace_start), "%lld.%03d (%s:%d)| %s %s\n", rec->sec, rec->nsec / 1000000, 
+            site == NULL ? "?" : site->file, site == NULL ? 0 : site->line, site == NULL ? "?" : site->fun, site == NULL ? "" : site->fmt);
+        if (l >= (int)sizeof (backtrace_start)) l = sizeof (backtrace_start) - 1;
+        if (write (fd, backtrace_start, l) != l) break;
+    }
+    close (fd);
+}
+
 // 
 // Signal handler for signal sig. sig is signal number
 // This way at run time we know which signal was caught. We also core dump for 
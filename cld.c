@@ -122,6 +122,19 @@ typedef struct cld_qry_info_t
     int is_prepared; // 1 if query-prepare was used (so don't prepare again
                     // as part of run-query)
     int is_DML; // 1 if this is UPDATE INSERT or DELETE
+    int is_stream; // 1 if rows are read one at a time in run-query loop, see is_query_streamable()
+    int is_massaged; // 1 if create-empty-row or use-no-result is used before run-query
+    int cache_ttl; // seconds results are kept in process, from define-query#...cache <ttl>, or 0 if not kept
+    int is_async; // 1 if start-query doesn't wait for query to execute, from define-query#...async
+    int is_batch; // 1 if start-query leaves query to be sent by run-query-batch, from define-query#...batch
+    int bulk_rows; // number of rows inserted with one statement, from define-query#...bulk [<rows>], or 0 if not bulk
+    // from define-query#...prefetch <column>=<query>.<column>, column compared to input parameter, and outer query and its column
+    // whose values are used for it, or NULL if not prefetched
+    char *prefetch_col;
+    char *prefetch_outer;
+    char *prefetch_outer_col;
+    int is_typed; // 1 if numeric columns are obtained as numbers, from define-query#...typed
+    char *col_types; // for typed query, letter for each column, 'i' for integer, 'd' for double and 't' for text, see type_query()
     int is_insert; // 1 if insert
 
     // number of, and qry outputs 
@@ -156,9 +169,12 @@ typedef struct cld_gen_ctx_s
     // different Query IDs.
     int curr_qry_ptr;
     int global_qry_stack[CLD_MAX_QUERY_NESTED + 1];
+    int global_qry_loop[CLD_MAX_QUERY_NESTED + 1]; // 1 if query at the same place in global_qry_stack is a loop through its rows
 
     int cmd_mode; // 1 if this is command line program and not within a web server
     const char *db; // name of the file with db credentials
+    int explain_rows; // queries estimated to read more rows than this with a full scan, filesort or temporary table are reported (-explain), 0 if not checked
+    int explain_error; // 1 if such queries are errors rather than warnings (-explain-error)
 
 } cld_gen_ctx;
 // Query fragments type, name and text for each
@@ -220,11 +236,15 @@ void _cld_report_error (const char *format, ...)  __attribute__ ((format (printf
 int recog_markup (char *cinp, int pos, char *opt, char **mtext, int *msize, int isLast, const char *fname, int lnum);
 void get_col_info (cld_gen_ctx *gen_ctx, const char *tab, const char *col, char **out_max_len, char **out_numeric_precision, char **out_numeric_scale, char **out_data_type, const char *fname, int lnum);
 int find_query (cld_gen_ctx *gen_ctx, const char *query_name);
+int is_query_markup (const char *m, const char **markups, const char *query_name, int *as);
+int is_query_streamable (FILE *f, const char *query_name);
 int is_query_DML (cld_gen_ctx *gen_ctx, int qry_name, int *is_insert);
+int find_insert_values (const char *text, int *prefix_len, int *suffix_len);
 int find_before_quote (char *mtext, int msize, char *what);
 void new_query (cld_gen_ctx *gen_ctx, const char *qry, char *qry_name, int lnum, const char *cname);
 int get_num_of_cols (cld_gen_ctx *gen_ctx, int query_name, const char *fname, int lnum);
 void describe_query (cld_gen_ctx *gen_ctx, int qry_name, const char *fname, int lnum);
+void explain_query (cld_gen_ctx *gen_ctx, int qry_name, const char *fname, int lnum);
 int get_col_ID (cld_gen_ctx *gen_ctx, int qry_name, const char *column_out, const char *fname, int lnum);
 void oprintf (const char *format, ...)  __attribute__ ((format (printf, 1, 2)));
 char *find_unescaped_chars (char *start, char *chars);
@@ -232,6 +252,12 @@ void get_passed_whitespace (char **s);
 void get_until_comma (char **s);
 void get_until_whitespace (char **s);
 void cld_allocate_query (cld_gen_ctx *gen_ctx, int query_id);
+void fill_query_rows (cld_gen_ctx *gen_ctx, int query_id, const char *file_name, int lnum);
+void wait_async_query (cld_gen_ctx *gen_ctx, int query_id, const char *file_name, int lnum);
+int outer_query_loop (cld_gen_ctx *gen_ctx, int query_id);
+void check_nested_query (cld_gen_ctx *gen_ctx, int query_id, const char *file_name, int lnum);
+void prefetch_query (cld_gen_ctx *gen_ctx, int query_id, const char *stmt_text, const char *file_name, int lnum);
+void type_query (cld_gen_ctx *gen_ctx, int query_id, const char *stmt_text, const char *file_name, int lnum);
 void end_query (cld_gen_ctx *gen_ctx, int *query_id, int *open_queries, int close_block, const char *file_name, int lnum);
 void get_next_input_param (cld_gen_ctx *gen_ctx, int query_id, char **end_of_query, const char *file_name, int lnum);
 void tfprintf (FILE *f, const char *format, ...)  __attribute__ ((format (printf, 2, 3)));
@@ -922,6 +948,7 @@ void end_query (cld_gen_ctx *gen_ctx, int *query_id, int *open_queries, int clos
 
     // put invalid query ID on stack so we know there is nothing there
     gen_ctx->global_qry_stack[gen_ctx->curr_qry_ptr - 1] = -1;
+    gen_ctx->global_qry_loop[gen_ctx->curr_qry_ptr - 1] = 0;
 
     // go down one level
     gen_ctx->curr_qry_ptr --;
@@ -945,6 +972,8 @@ void end_query (cld_gen_ctx *gen_ctx, int *query_id, int *open_queries, int clos
     if (close_block == 1)
     {
         oprintf("}\n"); // end of FOR loop we started with the QRY markup beginning
+        // rows not read if loop exited early are discarded
+        if (gen_ctx->qry[leaving_id].is_stream == 1) oprintf("cld_stream_done (__stream_%s);\n", gen_ctx->qry[leaving_id].name);
     }
     BEGIN_TEXT_LINE
 
@@ -952,6 +981,183 @@ void end_query (cld_gen_ctx *gen_ctx, int *query_id, int *open_queries, int clos
 }
 
 
+//
+// Generate the C code to set up rows of query 'query_id' once its results are obtained, i.e. the array of rows (__arr),
+// or an empty row if there are no results and use-no-result is used. 'file_name' and 'lnum' are the file name and
+// line number being processed.
+//
+void fill_query_rows (cld_gen_ctx *gen_ctx, int query_id, const char *file_name, int lnum)
+{
+    oprintf("if (__nrow_%s > 0) cld_data_iterator_fill_array (__data_%s, __nrow_%s, __ncol_%s, &__arr_%s);\n",
+    gen_ctx->qry[query_id].name, gen_ctx->qry[query_id].name,gen_ctx->qry[query_id].name, gen_ctx->qry[query_id].name, 
+        gen_ctx->qry[query_id].name);
+
+    oprintf("else if (__qry_massage_%s == CLD_QRY_USE_EMPTY)\n", gen_ctx->qry[query_id].name);
+    oprintf("{\n");
+    oprintf("__nrow_%s=1;\n", gen_ctx->qry[query_id].name);
+    if (gen_ctx->qry[query_id].is_typed == 1) oprintf("__num_%s=NULL;\n", gen_ctx->qry[query_id].name);
+    oprintf("__len_%s=NULL;\n", gen_ctx->qry[query_id].name);
+    oprintf("__ncol_%s=%d;\n", gen_ctx->qry[query_id].name, 
+        get_num_of_cols (gen_ctx, query_id, file_name, lnum));
+    oprintf("cld_get_empty_row (&__arr_%s, __ncol_%s);\n",
+        gen_ctx->qry[query_id].name, gen_ctx->qry[query_id].name);
+    oprintf("}\n");
+}
+
+//
+// Generate the C code to obtain results of query 'query_id' if it was sent by start-query without waiting for it 
+// to execute (define-query#...async or batch). This is done where results are first used. 'file_name' and 'lnum' are the 
+// file name and line number being processed.
+//
+void wait_async_query (cld_gen_ctx *gen_ctx, int query_id, const char *file_name, int lnum)
+{
+    if (gen_ctx->qry[query_id].is_async == 0 && gen_ctx->qry[query_id].is_batch == 0) return;
+    oprintf("if (__async_%s != NULL)\n", gen_ctx->qry[query_id].name);
+    oprintf("{\n");
+    oprintf("cld_async_wait (__async_%s, &__nrow_%s, &__ncol_%s, &__col_names_%s, &__data_%s, &__len_%s);\n", gen_ctx->qry[query_id].name, 
+        gen_ctx->qry[query_id].name, gen_ctx->qry[query_id].name, gen_ctx->qry[query_id].name, gen_ctx->qry[query_id].name, gen_ctx->qry[query_id].name);
+    oprintf("__async_%s = NULL;\n", gen_ctx->qry[query_id].name);
+    fill_query_rows (gen_ctx, query_id, file_name, lnum);
+    oprintf("}\n");
+}
+
+//
+// Find the query whose loop through rows (run-query of SELECT, or loop-query) is the closest one around query 'query_id'
+// being processed. gen_ctx is the context.
+// Returns query ID, or -1 if there is no such loop.
+//
+int outer_query_loop (cld_gen_ctx *gen_ctx, int query_id)
+{
+    int k;
+    for (k = gen_ctx->curr_qry_ptr - 1; k >= 0; k--)
+    {
+        if (gen_ctx->global_qry_loop[k] == 1 && gen_ctx->global_qry_stack[k] != query_id) return gen_ctx->global_qry_stack[k];
+    }
+    return -1;
+}
+
+//
+// Report SELECT query 'query_id' if it executes in the loop of another query's rows, as it then executes once for each 
+// of them. It's a warning, and it isn't reported if query's results are kept in process (define-query#...cache) or
+// selected for all rows of outer query at once (define-query#...prefetch). gen_ctx is the context, file_name/lnum is 
+// the file/line of source where query executes.
+//
+void check_nested_query (cld_gen_ctx *gen_ctx, int query_id, const char *file_name, int lnum)
+{
+    if (gen_ctx->qry[query_id].is_DML == 1 || gen_ctx->qry[query_id].cache_ttl > 0 || gen_ctx->qry[query_id].prefetch_col != NULL) return;
+    int outer = outer_query_loop (gen_ctx, query_id);
+    if (outer == -1) return;
+    fprintf (stderr, "Warning: query [%s] executes once for each row of query [%s] (use define-query#%s prefetch <column>=%s.<column> to select its rows for all of them at once), reading file [%s] at line [%d]\n",
+        gen_ctx->qry[query_id].name, gen_ctx->qry[outer].name, gen_ctx->qry[query_id].name, gen_ctx->qry[outer].name, file_name, lnum);
+}
+
+//
+// Generate the C code to get rows of query 'query_id' with define-query#...prefetch <column>=<query>.<column> from rows 
+// selected for all rows of outer <query> at once. Query must be a SELECT executing in the loop of outer query's rows, 
+// with a single input parameter compared to <column> as in "<column>='<?...?>'". This comparison is replaced with
+// "<column> IN (...)" with the values of outer query's <column>, and rows are grouped by <column>, which query must select
+// too (see cld_prefetch_rows()). The generated code is an 'if' that's true if input parameter isn't one of those values, 
+// and it must be followed by the statement that selects rows as usual. 'stmt_text' is the prepared statement of query,
+// or NULL if there isn't one. gen_ctx is the context, file_name/lnum is the file/line of source where query executes.
+//
+void prefetch_query (cld_gen_ctx *gen_ctx, int query_id, const char *stmt_text, const char *file_name, int lnum)
+{
+    qry_info *q = &(gen_ctx->qry[query_id]);
+    const char *text = q->text;
+    const char *param = strstr (text, "'%s'");
+    if (q->is_DML == 1 || q->is_dynamic == 1 || stmt_text == NULL || q->qry_total_inputs != 1 || param == NULL)
+    {
+        _cld_report_error( "Query using prefetch in define-query must be a SELECT with one input parameter, as in [%s='<?...?>'], reading file [%s] at line [%d]", 
+            q->prefetch_col, file_name, lnum);
+    }
+    int outer = outer_query_loop (gen_ctx, query_id);
+    if (outer == -1 || strcmp (gen_ctx->qry[outer].name, q->prefetch_outer))
+    {
+        _cld_report_error( "Query using prefetch in define-query must execute in the loop of query [%s], reading file [%s] at line [%d]", 
+            q->prefetch_outer, file_name, lnum);
+    }
+    if (gen_ctx->qry[outer].is_DML == 1)
+    {
+        _cld_report_error( "Query [%s] used in prefetch in define-query must be a SELECT, reading file [%s] at line [%d]", q->prefetch_outer, file_name, lnum);
+    }
+
+    // input parameter must be compared to column
+    const char *p = param;
+    while (p > text && isspace (p[-1])) p--;
+    if (p > text && p[-1] == '=') p--; else p = text;
+    while (p > text && isspace (p[-1])) p--;
+    int col_len = strlen (q->prefetch_col);
+    const char *col = p - col_len;
+    if (col < text || strncasecmp (col, q->prefetch_col, col_len) || (col > text && (isalnum (col[-1]) || col[-1] == '_' || col[-1] == '.')))
+    {
+        _cld_report_error( "Query using prefetch in define-query must have its input parameter compared to column [%s], as in [%s='<?...?>'], reading file [%s] at line [%d]", 
+            q->prefetch_col, q->prefetch_col, file_name, lnum);
+    }
+
+    // column is selected by query under its name without table, and so is the one in outer query
+    const char *key = strrchr (q->prefetch_col, '.');
+    int key_col = get_col_ID (gen_ctx, query_id, key == NULL ? q->prefetch_col : key + 1, file_name, lnum);
+    int outer_col = get_col_ID (gen_ctx, outer, q->prefetch_outer_col, file_name, lnum);
+
+    oprintf("if (cld_prefetch_get (cld_prefetch_rows (&__prefetch_%s, &__site_%s_%d, \"%.*s in (\", \")%s\", __arr_%s, __nrow_%s, %d, %d), __args_%s[0], &__nrow_%s, &__ncol_%s, &__col_names_%s, &__data_%s, &__len_%s) == 0)\n",
+        gen_ctx->qry[outer].name, q->name, lnum, (int)(p - text), text, param + 4, gen_ctx->qry[outer].name, gen_ctx->qry[outer].name, 
+        outer_col, key_col, q->name, q->name, q->name, q->name, q->name, q->name);
+}
+
+//
+// Find types of columns of query 'query_id' with define-query#...typed, so that its numeric columns are obtained
+// as numbers (see cld_select_stmt()). Types come from result set of prepared statement 'stmt_text', so columns that
+// are expressions (such as count(*) or sum()) have their types too. Integer columns are 'i', decimal and floating
+// point columns are 'd', and all others are 't' (text), in the order of columns. gen_ctx is the context, 
+// file_name/lnum is the file/line of source where query executes.
+//
+void type_query (cld_gen_ctx *gen_ctx, int query_id, const char *stmt_text, const char *file_name, int lnum)
+{
+    qry_info *q = &(gen_ctx->qry[query_id]);
+    if (q->is_DML == 1 || stmt_text == NULL)
+    {
+        _cld_report_error( "Query using typed in define-query must be a SELECT with constant text and input parameters quoted as in '<?...?>', reading file [%s] at line [%d]", 
+            file_name, lnum);
+    }
+    if (q->col_types != NULL) return; // types are the same wherever query executes
+
+    MYSQL_STMT *mh = mysql_stmt_init(cld_get_db_connection(gen_ctx->db));
+    if (mh == NULL || mysql_stmt_prepare(mh, stmt_text, strlen(stmt_text)) != 0)
+    {
+        _cld_report_error( "Cannot prepare query [%s] to find types of its columns, error [%s], reading file [%s] at line [%d]", q->name, 
+            mh == NULL ? "out of memory" : mysql_stmt_error(mh), file_name, lnum);
+    }
+    MYSQL_RES *meta = mysql_stmt_result_metadata(mh);
+    if (meta == NULL)
+    {
+        _cld_report_error( "Query [%s] using typed in define-query does not return any columns, reading file [%s] at line [%d]", q->name, file_name, lnum);
+    }
+    int num_fields = mysql_num_fields(meta);
+    MYSQL_FIELD *fields = mysql_fetch_fields(meta);
+    q->col_types = (char*)cld_malloc (num_fields + 1);
+    int i;
+    for (i = 0; i < num_fields; i++)
+    {
+        switch (fields[i].type)
+        {
+            case MYSQL_TYPE_TINY:
+            case MYSQL_TYPE_SHORT:
+            case MYSQL_TYPE_LONG:
+            case MYSQL_TYPE_INT24:
+            case MYSQL_TYPE_LONGLONG:
+            case MYSQL_TYPE_YEAR: q->col_types[i] = 'i'; break;
+            case MYSQL_TYPE_DECIMAL:
+            case MYSQL_TYPE_NEWDECIMAL:
+            case MYSQL_TYPE_FLOAT:
+            case MYSQL_TYPE_DOUBLE: q->col_types[i] = 'd'; break;
+            default: q->col_types[i] = 't'; break;
+        }
+    }
+    q->col_types[num_fields] = 0;
+    mysql_free_result(meta);
+    mysql_stmt_close(mh);
+}
+
 //
 // Generate the C code to allocate a query. gen_ctx is the contect, and query_id is the query id.
 // Depending on what kind of code we generate later, some of these may not be used, and we mark them
@@ -975,6 +1181,23 @@ void cld_allocate_query (cld_gen_ctx *gen_ctx, int query_id)
     oprintf("CLD_UNUSED (__data_%s);\n", gen_ctx->qry[query_id].name);
     oprintf("char **__col_names_%s;\n", gen_ctx->qry[query_id].name);
     oprintf("CLD_UNUSED (__col_names_%s);\n", gen_ctx->qry[query_id].name);
+    // lengths of columns in __data, or NULL if not known
+    oprintf("unsigned long *__len_%s = NULL;\n", gen_ctx->qry[query_id].name);
+    oprintf("CLD_UNUSED (__len_%s);\n", gen_ctx->qry[query_id].name);
+    // for query whose rows are read one at a time, __row is the current row
+    oprintf("cld_stream *__stream_%s = NULL;\n", gen_ctx->qry[query_id].name);
+    oprintf("CLD_UNUSED (__stream_%s);\n", gen_ctx->qry[query_id].name);
+    oprintf("char **__row_%s = NULL;\n", gen_ctx->qry[query_id].name);
+    oprintf("CLD_UNUSED (__row_%s);\n", gen_ctx->qry[query_id].name);
+    // for query sent by start-query without waiting for it, until its results are obtained
+    oprintf("cld_async *__async_%s = NULL;\n", gen_ctx->qry[query_id].name);
+    oprintf("CLD_UNUSED (__async_%s);\n", gen_ctx->qry[query_id].name);
+    // rows of queries nested in the loop of this one, selected for all of its rows at once
+    oprintf("cld_prefetch *__prefetch_%s = NULL;\n", gen_ctx->qry[query_id].name);
+    oprintf("CLD_UNUSED (__prefetch_%s);\n", gen_ctx->qry[query_id].name);
+    // values of numeric columns of typed query, in the same order as __data, or NULL if there are none (such as for empty row)
+    oprintf("cld_num *__num_%s = NULL;\n", gen_ctx->qry[query_id].name);
+    oprintf("CLD_UNUSED (__num_%s);\n", gen_ctx->qry[query_id].name);
 
     // allocate SQL buffer
     oprintf("char *__sql_buf_%s = (char*)cld_malloc (%d + 1);\n", gen_ctx->qry[query_id].name, CLD_MAX_SQL_SIZE);
@@ -1219,7 +1442,7 @@ void describe_query (cld_gen_ctx *gen_ctx, int qry_name, const char *fname, int
     CLD_TRACE ("sample query [%s]", gen_ctx->qry[qry_name].text);
     char *fname_loc = cld_strdup(fname); // to overcome constness
     cld_location (&fname_loc, &lnum, 1);
-    cld_select_table (gen_ctx->qry[qry_name].text, &snrow, &sncol, &col_names, NULL);
+    cld_select_table (gen_ctx->qry[qry_name].text, &snrow, &sncol, &col_names, NULL, NULL);
 
     int column_id = 0; // current column ID, from 0 to sncol
     while (column_id < sncol)
@@ -1248,6 +1471,83 @@ void describe_query (cld_gen_ctx *gen_ctx, int qry_name, const char *fname, int
     gen_ctx->qry[qry_name].qry_total_outputs = column_id;
 }
 
+//
+// Run EXPLAIN for query, if -explain option is used, to find queries that would need an index. Input parameters are set 
+// to 1 for this. A query is reported if, for any table, it's estimated to read more rows than given in -explain, and
+// that table is read in full (full table or index scan), or its rows are sorted (filesort) or put in a temporary table.
+// It's a warning, or an error with -explain-error. Only SELECT, UPDATE and DELETE are checked, and not a dynamic query (its text 
+// isn't known). If EXPLAIN fails (for instance because input parameter set to 1 makes the query invalid), it's a warning and
+// the query isn't checked. gen_ctx is the context, qry_name is query ID of the query, fname/lnum is the file/line of source where 
+// this query takes place.
+//
+void explain_query (cld_gen_ctx *gen_ctx, int qry_name, const char *fname, int lnum)
+{
+    if (gen_ctx->explain_rows == 0) return;
+    if (gen_ctx->qry[qry_name].is_dynamic == 1) return;
+
+    // each '%s' is replaced with 1, which makes text shorter
+    const char *text = gen_ctx->qry[qry_name].text;
+    while (isspace (*text)) text++;
+    if (strncasecmp (text, "select", strlen ("select")) && strncasecmp (text, "update", strlen ("update")) && 
+        strncasecmp (text, "delete", strlen ("delete"))) return;
+    int expl_len = strlen (text) + 10;
+    char *expl = (char*)cld_malloc (expl_len);
+    snprintf (expl, expl_len, "explain %s", text);
+    cld_replace_string (expl, expl_len, "%s", "1", 1, NULL);
+    CLD_TRACE ("explain query [%s]", expl);
+
+    // executed here and not with cld_select_table(), since its error would stop generating code for a valid query
+    MYSQL *con = cld_get_db_connection (gen_ctx->db);
+    MYSQL_RES *res = NULL;
+    if (mysql_query (con, expl) != 0 || (res = mysql_store_result (con)) == NULL)
+    {
+        fprintf (stderr, "Warning: cannot explain query [%s], error [%s], reading file [%s] at line [%d]\n", 
+            gen_ctx->qry[qry_name].name, mysql_error (con), fname, lnum);
+        return;
+    }
+
+    // columns of EXPLAIN output used here
+    int tab_col = -1;
+    int type_col = -1;
+    int rows_col = -1;
+    int extra_col = -1;
+    int i;
+    int ncol = mysql_num_fields (res);
+    MYSQL_FIELD *fields = mysql_fetch_fields (res);
+    for (i = 0; i < ncol; i++)
+    {
+        if (!strcasecmp (fields[i].name, "table")) tab_col = i;
+        else if (!strcasecmp (fields[i].name, "type")) type_col = i;
+        else if (!strcasecmp (fields[i].name, "rows")) rows_col = i;
+        else if (!strcasecmp (fields[i].name, "extra")) extra_col = i;
+    }
+
+    MYSQL_ROW row;
+    while (rows_col != -1 && (row = mysql_fetch_row (res)) != NULL)
+    {
+        long long rows = (row[rows_col] == NULL ? 0 : atoll (row[rows_col]));
+        if (rows <= gen_ctx->explain_rows) continue;
+        const char *type = (type_col == -1 || row[type_col] == NULL ? "" : row[type_col]);
+        const char *extra = (extra_col == -1 || row[extra_col] == NULL ? "" : row[extra_col]);
+        const char *tab = (tab_col == -1 || row[tab_col] == NULL ? "" : row[tab_col]);
+        const char *why;
+        if (!strcasecmp (type, "ALL")) why = "full table scan";
+        else if (!strcasecmp (type, "index")) why = "full index scan";
+        else if (strcasestr (extra, "Using filesort") != NULL) why = "filesort";
+        else if (strcasestr (extra, "Using temporary") != NULL) why = "temporary table";
+        else continue;
+
+        if (gen_ctx->explain_error == 1)
+        {
+            _cld_report_error( "Query [%s] is estimated to read [%lld] rows from table [%s] with %s, reading file [%s] at line [%d]", 
+                gen_ctx->qry[qry_name].name, rows, tab, why, fname, lnum);
+        }
+        fprintf (stderr, "Warning: query [%s] is estimated to read [%lld] rows from table [%s] with %s, reading file [%s] at line [%d]\n", 
+            gen_ctx->qry[qry_name].name, rows, tab, why, fname, lnum);
+    }
+    mysql_free_result (res);
+}
+
 
 //
 // Prepare SQL (a static text of SQL) and stop there. The intent is to catch various syntax and other errors
@@ -1300,7 +1600,7 @@ int get_num_of_cols (cld_gen_ctx *gen_ctx, int query_name, const char *fname, in
     CLD_TRACE ("sample query [%s]", gen_ctx->qry[query_name].text);
     char *fname_loc = cld_strdup(fname); // to overcome constness
     cld_location (&fname_loc, &lnum, 1);
-    cld_select_table (gen_ctx->qry[query_name].text, &snrow, &sncol, &col_names, NULL);
+    cld_select_table (gen_ctx->qry[query_name].text, &snrow, &sncol, &col_names, NULL, NULL);
 
     return sncol;
 }
@@ -1691,8 +1991,173 @@ int is_query_DML (cld_gen_ctx *gen_ctx, int qry_name, int *is_insert)
     }
     return 0;
 }
+
+// 
+// Find VALUES list of INSERT 'text', such as ('%s','%s') in "insert into t (a,b) values ('%s','%s') on duplicate key update b=1".
+// Output 'prefix_len' is the length of text before the list, and 'suffix_len' of text after it.
+// Returns 1 if found, 0 if not.
+//
+int find_insert_values (const char *text, int *prefix_len, int *suffix_len)
+{
+    assert (text);
+    const char *values = NULL;
+    const char *p;
+    int in_quote = 0;
+    for (p = text; *p != 0; p++)
+    {
+        if (*p == '\'') in_quote = 1 - in_quote;
+        else if (in_quote == 0 && !strncasecmp (p, "values", 6) && (p == text || !(isalnum (*(p - 1)) || *(p - 1) == '_')))
+        {
+            const char *list = p + 6;
+            while (isspace (*list)) list++;
+            if (*list == '(')
+            {
+                values = list;
+                break;
+            }
+        }
+    }
+    if (values == NULL) return 0;
+
+    // list can have more than one row, and it ends after the last one
+    const char *end = NULL;
+    p = values;
+    while (*p == '(')
+    {
+        int depth = 0;
+        in_quote = 0;
+        for (; *p != 0; p++)
+        {
+            if (*p == '\'') in_quote = 1 - in_quote;
+            else if (in_quote == 0 && *p == '(') depth++;
+            else if (in_quote == 0 && *p == ')' && --depth == 0) break;
+        }
+        if (*p == 0) return 0;
+        end = ++p;
+        while (isspace (*p)) p++;
+        if (*p != ',') break;
+        p++;
+        while (isspace (*p)) p++;
+    }
+    *prefix_len = values - text;
+    *suffix_len = strlen (end);
+    return 1;
+}
  
 
+// 
+// Returns 1 if markup at 'm' is one of 'markups' (each ending with '#') for query 'query_name', 0 if not.
+// If 'as' isn't NULL, it's set to 1 if the markup keeps a value in a variable (has 'as' before the end of markup).
+//
+int is_query_markup (const char *m, const char **markups, const char *query_name, int *as)
+{
+    int i;
+    int name_len = strlen (query_name);
+    for (i = 0; markups[i] != NULL; i++)
+    {
+        int mlen = strlen (markups[i]);
+        if (strncmp (m, markups[i], mlen)) continue;
+        const char *n = m + mlen;
+        while (isspace (*n)) n++;
+        if (strncmp (n, query_name, name_len) || isalnum (n[name_len]) || n[name_len] == '_') continue;
+        if (as != NULL)
+        {
+            const char *end = strstr (n, "?>");
+            const char *a = strstr (n, CLD_KEYAS);
+            *as = (a != NULL && (end == NULL || a < end));
+        }
+        return 1;
+    }
+    return 0;
+}
+
+// 
+// Returns 1 if rows of query 'query_name' can be read from the database one at a time as they're used in its run-query
+// loop, rather than all at once before the loop. Markups that follow run-query are read from source file 'f' (from its 
+// current position, which is restored), up until the query is defined again or the file ends. Only markups are 
+// considered, i.e. those within code blocks, at the beginning of a line or after '<?', and not in start-comment blocks.
+// Rows aren't streamed if the number of rows is used (row-count), or rows outside of the loop (loop-query, column-data),
+// or columns are kept in variables (query-result with 'as'), which could be used after the next row is read. Nor are they 
+// if another query is prefetched for its rows (define-query#...prefetch <column>=<query>.<column>), which are all
+// needed for that. Empty rows (create-empty-row, use-no-result) are known before run-query, see is_massaged.
+// Otherwise returns 0.
+//
+int is_query_streamable (FILE *f, const char *query_name)
+{
+    const char *uses[] = {"row-count#", "loop-query#", "column-data#", NULL};
+    const char *results[] = {"query-result#", NULL};
+    const char *defines[] = {"define-query#", NULL};
+    long pos = ftell (f);
+    if (pos < 0) return 0;
+
+    char line[CLD_FILE_LINE_LEN + 1];
+    int line_len = 0;
+    int cld_mode = 1; // run-query is in a code block
+    int is_comment_block = 0;
+    int res = 1;
+    int name_len = strlen (query_name);
+    while (res == 1 && fgets (line + line_len, sizeof (line) - line_len - 1, f) != NULL)
+    {
+        int len = strlen (line);
+        cld_trim (line, &len);
+        if (cld_mode == 1 && len > 0 && line[len - 1] == '\\')
+        {
+            // continuation of the line
+            line[len - 1] = 0;
+            line_len = len - 1;
+            continue;
+        }
+        line_len = 0;
+
+        char *l = line;
+        int is_end = 0;
+        if (!strncasecmp (l, "/*" "CLD_BEGIN", strlen ("/*" "CLD_BEGIN"))) { cld_mode = 1; l += strlen ("/*" "CLD_BEGIN"); }
+        else if (!strncasecmp (l, "/*" "<", strlen ("/*" "<"))) { cld_mode = 1; l += strlen ("/*" "<"); }
+        len = strlen (l);
+        if ((len >= (int)strlen ("CLD_END" "*/") && !strcasecmp (l + len - strlen ("CLD_END" "*/"), "CLD_END" "*/"))
+            || (len >= (int)strlen (">" "*/") && !strcasecmp (l + len - strlen (">" "*/"), ">" "*/"))) is_end = 1;
+        if (cld_mode == 0) continue;
+        if (is_end == 1) cld_mode = 0; // for the next line
+
+        // markups are at the beginning of line or after <?
+        char *m = l;
+        int first_on_line = 1;
+        while (res == 1 && m != NULL)
+        {
+            if (first_on_line == 0) m += 2;
+            first_on_line = 0;
+            while (isspace (*m)) m++;
+            if (is_comment_block == 1)
+            {
+                if (!strncmp (m, "end-comment", strlen ("end-comment"))) is_comment_block = 0;
+            }
+            else if (!strncmp (m, "start-comment", strlen ("start-comment"))) is_comment_block = 1;
+            else
+            {
+                int as = 0;
+                // query defined again is a different query from here on
+                if (is_query_markup (m, defines, query_name, NULL)) break;
+                if (is_query_markup (m, uses, query_name, NULL) || (is_query_markup (m, results, query_name, &as) && as == 1)) res = 0;
+                if (!strncmp (m, "define-query#", strlen ("define-query#")))
+                {
+                    // prefetch <column>=<query>.<column> of another query needs all rows of this one
+                    char *p = strstr (m, " prefetch ");
+                    if (p != NULL)
+                    {
+                        p += strlen (" prefetch ");
+                        while (*p != 0 && !isspace (*p) && *p != '=') p++;
+                        if (*p == '=' && !strncmp (p + 1, query_name, name_len) && p[1 + name_len] == '.') res = 0;
+                    }
+                }
+            }
+            m = strstr (m, "<?");
+        }
+        if (m != NULL) break; // query defined again
+    }
+    fseek (f, pos, SEEK_SET);
+    return res;
+}
+
 // 
 // Find query ID if given name 'query_name'. gen_ctx is the context.
 // Returns query ID or -1 if none found..
@@ -1738,7 +2203,7 @@ void get_col_info (cld_gen_ctx *gen_ctx, const char *tab, const char *col, char
     
     char **col_names;
 
-    cld_select_table (check_col_query, &snrow, &sncol, &col_names, &sdata);
+    cld_select_table (check_col_query, &snrow, &sncol, &col_names, &sdata, NULL);
     if (snrow == 0)
     {
         _cld_report_error( "Column name [%s] does not exist in table [%s], reading file [%s] at line [%d]", col, tab, fname, lnum);
@@ -1817,7 +2282,7 @@ void get_until_whitespace (char **s)
 {
     assert (*s != NULL);
     int i = 0;
-    while (!isspace ((*s)[i])) i++;
+    while ((*s)[i] != 0 && !isspace ((*s)[i])) i++;
     *s = *s + i;
 }
 
@@ -1984,6 +2449,17 @@ void init_cld_gen_ctx (cld_gen_ctx *gen_ctx)
         gen_ctx->qry[j].is_dynamic = 0;
         gen_ctx->qry[j].is_prepared = 0;
         gen_ctx->qry[j].is_DML = 0;
+        gen_ctx->qry[j].is_stream = 0;
+        gen_ctx->qry[j].is_massaged = 0;
+        gen_ctx->qry[j].cache_ttl = 0;
+        gen_ctx->qry[j].is_async = 0;
+        gen_ctx->qry[j].is_batch = 0;
+        gen_ctx->qry[j].bulk_rows = 0;
+        gen_ctx->qry[j].prefetch_col = NULL;
+        gen_ctx->qry[j].prefetch_outer = NULL;
+        gen_ctx->qry[j].prefetch_outer_col = NULL;
+        gen_ctx->qry[j].is_typed = 0;
+        gen_ctx->qry[j].col_types = NULL;
         gen_ctx->qry[j].is_insert = 0;
         for (i = 0; i < CLD_MAX_QUERY_INPUTS; i++)  
         {
@@ -1997,6 +2473,7 @@ void init_cld_gen_ctx (cld_gen_ctx *gen_ctx)
     for (k = 0; k < CLD_MAX_QUERY_NESTED; k++)
     {
         gen_ctx->global_qry_stack[k] = -1;
+        gen_ctx->global_qry_loop[k] = 0;
     }
 
 
@@ -2006,6 +2483,8 @@ void init_cld_gen_ctx (cld_gen_ctx *gen_ctx)
 
     gen_ctx->total_write_string = 0;
     gen_ctx->db = "";
+    gen_ctx->explain_rows = 0;
+    gen_ctx->explain_error = 0;
 
 
 }
@@ -2671,6 +3150,8 @@ void cld_gen_c_code (cld_gen_ctx *gen_ctx, const char *file_name)
                         _cld_report_error( "Query [%s] cannot create empty row or use no result for DML queries, which always have a result row, reading file [%s] at line [%d]", qry_dis_id, file_name, lnum);
                     }
 
+                    gen_ctx->qry[k].is_massaged = 1;
+
                     END_TEXT_LINE
                     if (use_empty == 1)
                     {
@@ -2785,6 +3266,8 @@ void cld_gen_c_code (cld_gen_ctx *gen_ctx, const char *file_name)
 
                     END_TEXT_LINE
 
+                    wait_async_query (gen_ctx, k, file_name, lnum);
+
                     if (asvar != NULL)
                     {
                         // we have variable in which to put row-count
@@ -2826,6 +3309,8 @@ void cld_gen_c_code (cld_gen_ctx *gen_ctx, const char *file_name)
 
                     END_TEXT_LINE
 
+                    wait_async_query (gen_ctx, k, file_name, lnum);
+
                     if (asvar != NULL)
                     {
                         // we have variable in which to put column-names
@@ -2864,6 +3349,8 @@ void cld_gen_c_code (cld_gen_ctx *gen_ctx, const char *file_name)
 
                     END_TEXT_LINE
 
+                    wait_async_query (gen_ctx, k, file_name, lnum);
+
                     if (asvar != NULL)
                     {
                         // we have variable in which to put column-names
@@ -2877,6 +3364,69 @@ void cld_gen_c_code (cld_gen_ctx *gen_ctx, const char *file_name)
                     BEGIN_TEXT_LINE
                     continue;
                 }
+                else if (((newI=recog_markup (line, i, "query-number#", &mtext, &msize, 0, file_name, lnum)) != 0))  // this is numeric column of typed query
+                {
+                    // query-number#myquery, column as [define] var
+                    i = newI;
+                    char *comma = memchr (mtext, ',', msize);
+                    if (comma == NULL)
+                    {
+                        _cld_report_error( "query-number must have column name after comma, as in query-number#query, column as [define] var, reading file [%s] at line [%d]", file_name, lnum);
+                    }
+                    char *asvar;
+                    int is_defined;
+                    int k = get_query_id (gen_ctx, mtext, comma - mtext, file_name, lnum, &is_defined, &asvar);
+
+                    // get column name and variable
+                    char col_out[2*CLD_MAX_COLNAME_LEN + 1];
+                    int col_len = msize - (comma + 1 - mtext);
+                    if (col_len > (int)sizeof (col_out) - 1)
+                    {
+                        _cld_report_error( "Column name too long, reading file [%s] at line [%d]", file_name, lnum);
+                    }
+                    memcpy (col_out, comma + 1, col_len);
+                    col_out[col_len] = 0;
+                    char *asv = strstr (col_out, CLD_KEYAS);
+                    if (asv == NULL || asvar != NULL)
+                    {
+                        _cld_report_error( "query-number in query [%s] cannot be used without 'as [define]' variable after column name, i.e. the result must be assigned to a variable, reading file [%s] at line [%d]", gen_ctx->qry[k].name, file_name, lnum);
+                    }
+                    *asv = 0;
+                    col_len = strlen (col_out);
+                    cld_trim (col_out, &col_len);
+                    char *newV = asv + strlen (CLD_KEYAS);
+                    is_opt_defined (&newV, &is_defined, file_name, lnum);
+
+                    // like query-result, column is obtained only directly under the query
+                    if (gen_ctx->qry_active[k] != CLD_QRY_ACTIVE)
+                    {
+                        _cld_report_error( "Qry [%s] is used, but not active, reading file [%s] at line [%d]", gen_ctx->qry[k].name, file_name, lnum);
+                    }
+                    if (gen_ctx->global_qry_stack[gen_ctx->curr_qry_ptr - 1] != k)
+                    {
+                        _cld_report_error( "query-number can be only directly under the run-query or loop-query, check the name of query used, reading file [%s] at line [%d]", file_name, lnum);
+                    }
+                    if (gen_ctx->qry[k].is_typed == 0 || gen_ctx->qry[k].col_types == NULL)
+                    {
+                        _cld_report_error( "query-number cannot be used on query [%s] because it does not use typed in define-query, reading file [%s] at line [%d]", gen_ctx->qry[k].name, file_name, lnum);
+                    }
+
+                    int column_id = get_col_ID (gen_ctx, k, col_out, file_name, lnum);
+                    char type = column_id < (int)strlen (gen_ctx->qry[k].col_types) ? gen_ctx->qry[k].col_types[column_id] : 't';
+                    if (type == 't')
+                    {
+                        _cld_report_error( "Column [%s] in query [%s] is not a number, use query-result to get it, reading file [%s] at line [%d]", col_out, gen_ctx->qry[k].name, file_name, lnum);
+                    }
+
+                    END_TEXT_LINE
+
+                    // there are no numbers for empty row, which is all zeros then
+                    oprintf("%s%s = (__num_%s == NULL ? 0 : __num_%s[__iter_%s * __ncol_%s + %d].%c);\n", is_defined == 1 ? (type == 'i' ? "long long " : "double ") : "", 
+                        newV, gen_ctx->qry[k].name, gen_ctx->qry[k].name, gen_ctx->qry[k].name, gen_ctx->qry[k].name, column_id, type);
+
+                    BEGIN_TEXT_LINE
+                    continue;
+                }
                 else if (((newI=recog_markup (line, i, "row-count#", &mtext, &msize, 0, file_name, lnum)) != 0))  // this is query count
                 {
                     i = newI;
@@ -2900,6 +3450,8 @@ void cld_gen_c_code (cld_gen_ctx *gen_ctx, const char *file_name)
 
                     END_TEXT_LINE
 
+                    wait_async_query (gen_ctx, k, file_name, lnum);
+
                     if (asvar != NULL)
                     {
                         // we have variable in which to put row-count
@@ -2916,6 +3468,86 @@ void cld_gen_c_code (cld_gen_ctx *gen_ctx, const char *file_name)
                     BEGIN_TEXT_LINE
                     continue;
                 }
+                else if (((newI=recog_markup (line, i, "flush-query#", &mtext, &msize, 0, file_name, lnum)) != 0))  // insert rows of bulk INSERT
+                {
+                    i = newI;
+                    char *asvar;
+                    int is_defined;
+                    int k = get_query_id (gen_ctx, mtext, msize, file_name, lnum, &is_defined, &asvar);
+
+                    // flush-query#q [as [define] err] inserts rows added by run-query of q (with define-query#...bulk) and not yet 
+                    // inserted, so that the result of the last of them is known. err is the error number ("0" if none), and without it,
+                    // an error is reported as an error of the request.
+                    if (gen_ctx->qry[k].bulk_rows == 0)
+                    {
+                        _cld_report_error( "Query [%s] in flush-query must use bulk in define-query, reading file [%s] at line [%d]", gen_ctx->qry[k].name, file_name, lnum);
+                    }
+                    if (gen_ctx->qry_active[k] == CLD_QRY_UNUSED)
+                    {
+                        _cld_report_error( "Qry [%s] has never been used, reading file [%s] at line [%d]", gen_ctx->qry[k].name, file_name, lnum);
+                    }
+
+                    END_TEXT_LINE
+                    // query's variables may be out of scope here (such as when it's defined in a loop), so they aren't used
+                    if (asvar == NULL)
+                    {
+                        oprintf("cld_bulk_flush_query (\"%s\", \"%s\", 1);\n", file_name, gen_ctx->qry[k].name);
+                    }
+                    else
+                    {
+                        oprintf("%s%s = cld_bulk_flush_query (\"%s\", \"%s\", 0);\n", is_defined == 1 ? "char *" : "", asvar, file_name, gen_ctx->qry[k].name);
+                    }
+                    BEGIN_TEXT_LINE
+                    continue;
+                }
+                else if (((newI=recog_markup (line, i, "run-query-batch#", &mtext, &msize, 0, file_name, lnum)) != 0))  // send queries in one round-trip
+                {
+                    i = newI;
+
+                    // run-query-batch#q1,q2,... sends queries (each with define-query#...batch and started with start-query) 
+                    // to the database as a single statement, and results of each are obtained where they're first used
+                    char *batch_list = cld_strdup (mtext);
+                    char *curr_name = batch_list;
+                    int num_in_batch = 0;
+                    // each name in the list becomes ', __async_<name>'
+                    char *batch_args = cld_malloc (11 * (strlen (mtext) + 2));
+                    batch_args[0] = 0;
+                    while (1)
+                    {
+                        get_passed_whitespace (&curr_name);
+                        char *end_name = curr_name;
+                        get_until_comma (&end_name);
+                        int is_last = (*end_name == 0);
+                        *end_name = 0;
+                        char *trail = end_name;
+                        while (trail != curr_name && isspace (*(trail - 1))) *(--trail) = 0;
+                        int k = find_query (gen_ctx, curr_name);
+                        if (k == -1)
+                        {
+                            _cld_report_error( "Query [%s] in run-query-batch is not defined, reading file [%s] at line [%d]", curr_name, file_name, lnum);
+                        }
+                        if (gen_ctx->qry[k].is_batch == 0)
+                        {
+                            _cld_report_error( "Query [%s] in run-query-batch must use batch in define-query, reading file [%s] at line [%d]", curr_name, file_name, lnum);
+                        }
+                        if (gen_ctx->qry_active[k] == CLD_QRY_UNUSED)
+                        {
+                            _cld_report_error( "Query [%s] in run-query-batch must be used with start-query first, reading file [%s] at line [%d]", curr_name, file_name, lnum);
+                        }
+                        strcat (batch_args, ", __async_");
+                        strcat (batch_args, gen_ctx->qry[k].name);
+                        num_in_batch++;
+                        if (is_last) break;
+                        curr_name = end_name + 1;
+                    }
+                    cld_free (batch_list);
+
+                    END_TEXT_LINE
+                    oprintf("cld_run_batch (%d%s);\n", num_in_batch, batch_args);
+                    cld_free (batch_args);
+                    BEGIN_TEXT_LINE
+                    continue;
+                }
                 // 
                 // The following covers most of the query markups
                 // and lots of them are connected and share some of the code
@@ -2945,6 +3577,97 @@ void cld_gen_c_code (cld_gen_ctx *gen_ctx, const char *file_name)
                     int fragment = (newI10 != 0 ? 1:0);
 
 
+                    // define-query#name [cache <ttl>] [async] [batch] [bulk [<rows>]] [prefetch <column>=<query>.<column>] [typed] sets how 
+                    // query executes: 'cache' keeps its results in process for <ttl> seconds, 'async' makes start-query send it to database 
+                    // without waiting for it to execute, 'batch' makes start-query leave it to be sent together with other queries by 
+                    // run-query-batch, 'bulk' makes run-query of INSERT add a row to be inserted together with others, <rows> at a time,
+                    // 'prefetch' selects its rows for all rows of outer <query> at once (see prefetch_query()), and 'typed' obtains its 
+                    // numeric columns as numbers, for use with query-number (see type_query())
+                    int cache_ttl = 0;
+                    int is_async = 0;
+                    int is_batch = 0;
+                    int bulk_rows = 0;
+                    char *prefetch_col = NULL;
+                    char *prefetch_outer = NULL;
+                    char *prefetch_outer_col = NULL;
+                    int is_typed = 0;
+                    if (define_query == 1 && dynamic_query == 0)
+                    {
+                        char *opt = mtext;
+                        get_until_whitespace (&opt);
+                        if (*opt != 0)
+                        {
+                            *opt = 0;
+                            msize = opt - mtext;
+                            opt++;
+                            while (1)
+                            {
+                                get_passed_whitespace (&opt);
+                                if (*opt == 0) break;
+                                char *word = opt;
+                                get_until_whitespace (&opt);
+                                if (*opt != 0) *(opt++) = 0;
+                                if (!strcmp (word, "async")) is_async = 1;
+                                else if (!strcmp (word, "batch")) is_batch = 1;
+                                else if (!strcmp (word, "typed")) is_typed = 1;
+                                else if (!strcmp (word, "bulk"))
+                                {
+                                    bulk_rows = CLD_BULK_ROWS;
+                                    // number of rows is optional
+                                    char *rows = opt;
+                                    get_passed_whitespace (&rows);
+                                    if (isdigit (*rows))
+                                    {
+                                        opt = rows;
+                                        get_until_whitespace (&opt);
+                                        if (*opt != 0) *(opt++) = 0;
+                                        if (strspn (rows, "0123456789") != strlen (rows) || (bulk_rows = atoi (rows)) <= 0)
+                                        {
+                                            _cld_report_error( "Number of rows for bulk in define-query must be a positive number, found [%s], reading file [%s] at line [%d]", rows, file_name, lnum);
+                                        }
+                                    }
+                                }
+                                else if (!strcmp (word, "cache"))
+                                {
+                                    get_passed_whitespace (&opt);
+                                    char *ttl = opt;
+                                    get_until_whitespace (&opt);
+                                    if (*opt != 0) *(opt++) = 0;
+                                    if (ttl[0] == 0 || strspn (ttl, "0123456789") != strlen (ttl) || (cache_ttl = atoi (ttl)) <= 0)
+                                    {
+                                        _cld_report_error( "Cache time in define-query must be a positive number of seconds, found [%s], reading file [%s] at line [%d]", ttl, file_name, lnum);
+                                    }
+                                }
+                                else if (!strcmp (word, "prefetch"))
+                                {
+                                    get_passed_whitespace (&opt);
+                                    char *key = opt;
+                                    get_until_whitespace (&opt);
+                                    if (*opt != 0) *(opt++) = 0;
+                                    char *eq = strchr (key, '=');
+                                    char *dot = (eq == NULL ? NULL : strrchr (eq, '.'));
+                                    if (eq == NULL || eq == key || dot == NULL || dot == eq + 1 || dot[1] == 0)
+                                    {
+                                        _cld_report_error( "Prefetch in define-query must be followed by <column>=<query>.<column>, found [%s], reading file [%s] at line [%d]", key, file_name, lnum);
+                                    }
+                                    *eq = 0;
+                                    *dot = 0;
+                                    prefetch_col = key;
+                                    prefetch_outer = eq + 1;
+                                    prefetch_outer_col = dot + 1;
+                                }
+                                else
+                                {
+                                    _cld_report_error( "Unknown option in define-query, found [%s], reading file [%s] at line [%d]", word, file_name, lnum);
+                                }
+                            }
+                            if (is_async + is_batch + (cache_ttl > 0 ? 1 : 0) + (bulk_rows > 0 ? 1 : 0) + (prefetch_col != NULL ? 1 : 0) + is_typed > 1)
+                            {
+                                _cld_report_error( "Query can use only one of cache, async, batch, bulk, prefetch and typed in define-query, reading file [%s] at line [%d]", file_name, lnum);
+                            }
+                        }
+                    }
+
                     if (dynamic_query == 1) define_query=1; //define query either way for our processing
                     if (start_query == 1) run_query=1; //starting query is the same as running, minus the loop
                     if (soft_shard==1) shard=1;
@@ -3206,6 +3929,7 @@ void cld_gen_c_code (cld_gen_ctx *gen_ctx, const char *file_name)
                             // describe query, so we can get column # from name 
                             // there is no need to describe a query if it is a define-query as there is no query text yet
                             describe_query (gen_ctx, k, file_name, lnum);
+                            explain_query (gen_ctx, k, file_name, lnum);
                         }
                         else
                         {
@@ -3217,6 +3941,15 @@ void cld_gen_c_code (cld_gen_ctx *gen_ctx, const char *file_name)
                             new_query (gen_ctx, "", query_id_str, lnum, file_name);
                             k = find_query (gen_ctx, query_id_str);
                             assert (k!=-1); // must be there
+                            gen_ctx->qry[k].cache_ttl = cache_ttl;
+                            gen_ctx->qry[k].is_async = is_async;
+                            gen_ctx->qry[k].is_batch = is_batch;
+                            gen_ctx->qry[k].bulk_rows = bulk_rows;
+                            gen_ctx->qry[k].prefetch_col = (prefetch_col == NULL ? NULL : cld_strdup (prefetch_col));
+                            gen_ctx->qry[k].prefetch_outer = (prefetch_outer == NULL ? NULL : cld_strdup (prefetch_outer));
+                            gen_ctx->qry[k].prefetch_outer_col = (prefetch_outer_col == NULL ? NULL : cld_strdup (prefetch_outer_col));
+                            gen_ctx->qry[k].is_typed = is_typed;
+                            gen_ctx->qry[k].col_types = NULL;
                         }
                         END_TEXT_LINE
 
@@ -3333,6 +4066,7 @@ void cld_gen_c_code (cld_gen_ctx *gen_ctx, const char *file_name)
 
                             END_TEXT_LINE
 
+                            wait_async_query (gen_ctx, query_id, file_name, lnum);
                             oprintf("for (__iter_%s = 0; __iter_%s < __nrow_%s; __iter_%s++)\n",gen_ctx->qry[query_id].name, 
                                 gen_ctx->qry[query_id].name,gen_ctx->qry[query_id].name,gen_ctx->qry[query_id].name);
                             oprintf("{\n");
@@ -3346,6 +4080,7 @@ void cld_gen_c_code (cld_gen_ctx *gen_ctx, const char *file_name)
                                 _cld_report_error( CLD_MSG_NESTED_QRY, query_id, CLD_MAX_QUERY_NESTED, file_name, lnum);
                             }
                             gen_ctx->global_qry_stack[gen_ctx->curr_qry_ptr - 1] = query_id;
+                            gen_ctx->global_qry_loop[gen_ctx->curr_qry_ptr - 1] = 1;
 
                             // now this query ID is active. We use it to prohibit nesting queries with the same ID
                             gen_ctx->qry_active[query_id] = CLD_QRY_ACTIVE;
@@ -3393,6 +4128,9 @@ void cld_gen_c_code (cld_gen_ctx *gen_ctx, const char *file_name)
                             _cld_report_error( "Qry ID [%d] is used within itself, use the same query with different ID if needed, reading file [%s] at line [%d]", query_id, file_name, lnum);
                         }
 
+                        // query executed for each row of an outer query is reported, before it's put on the stack
+                        check_nested_query (gen_ctx, query_id, file_name, lnum);
+
                         // move the query stack pointer one up. At this location in the stack, there is
                         // nothing, i.e. this pointer always points to the next (as of yet non-existent)
                         // query ID
@@ -3405,7 +4143,9 @@ void cld_gen_c_code (cld_gen_ctx *gen_ctx, const char *file_name)
                         }
 
                         // since current valid stack is one below stack pointer, put our query ID there
+                        // run-query of a SELECT loops through its rows, while start-query leaves that to loop-query
                         gen_ctx->global_qry_stack[gen_ctx->curr_qry_ptr - 1] = query_id;
+                        gen_ctx->global_qry_loop[gen_ctx->curr_qry_ptr - 1] = (start_query == 0 && gen_ctx->qry[query_id].is_DML == 0);
 
                         // now this query ID is active. We use it to prohibit nesting queries with the same ID
                         gen_ctx->qry_active[query_id] = CLD_QRY_ACTIVE;
@@ -3439,6 +4179,9 @@ void cld_gen_c_code (cld_gen_ctx *gen_ctx, const char *file_name)
                         oprintf("char *fname_loc_%s = \"%s\";\n",gen_ctx->qry[query_id].name, file_name); // to overcome constness
                         oprintf("int lnum_%s = %d;\n",gen_ctx->qry[query_id].name,lnum); 
                         oprintf("cld_location (&fname_loc_%s, &lnum_%s, 1);\n",gen_ctx->qry[query_id].name,gen_ctx->qry[query_id].name);
+                        // statistics for this query site (executions, time, rows, bytes), see cld_query_site()
+                        oprintf("static cld_qry_site __site_%s_%d = {\"%s\", %d, \"%s\", 0, 0, 0, 0, 0, 0, 0, NULL, NULL, NULL};\n",
+                            gen_ctx->qry[query_id].name, lnum, file_name, lnum, gen_ctx->qry[query_id].name);
                         // with dynamic queries, we cannot count how many '%s' in SQL text (i.e. inputs) there are. Only with static queries
                         // can we do that (this is qry_total_inputs). For dynamic, the number of inputs is known  only by
                         // the number of actual input parameters in run-query or start-query (this is qry_found_total_inputs). Because
@@ -3446,45 +4189,145 @@ void cld_gen_c_code (cld_gen_ctx *gen_ctx, const char *file_name)
                         // and verify we are not using bad memory or missing arguments.
                         int num_run_time_params = (gen_ctx->qry[query_id].is_dynamic == 1 ?
                                                     gen_ctx->qry[query_id].qry_found_total_inputs : gen_ctx->qry[query_id].qry_total_inputs);
-                        oprintf("cld_make_SQL (__sql_buf_%s, %d, %d, %s ",
+
+                        // static query whose inputs are all quoted as '%s' is executed as a prepared statement, with '?' in place
+                        // of each '%s'. It's prepared once per db connection and input parameters are bound to it. Dynamic query
+                        // text is known only at run-time, so input parameters are substituted in it with cld_make_SQL().
+                        // start-query of query with define-query#...async sends it without waiting for it, and with define-query#...batch
+                        // leaves it to run-query-batch, which is done with SQL text
+                        int run_async = (start_query == 1 && (gen_ctx->qry[query_id].is_async == 1 || gen_ctx->qry[query_id].is_batch == 1));
+                        if (run_async == 1 && gen_ctx->qry[query_id].is_DML == 1)
+                        {
+                            _cld_report_error( "Only SELECT query can use async or batch in define-query, reading file [%s] at line [%d]", file_name, lnum);
+                        }
+                        // text of dynamic query is made by application, so it's not sent on a connection of its own, which 
+                        // may execute multiple statements
+                        if (run_async == 1 && gen_ctx->qry[query_id].is_dynamic == 1)
+                        {
+                            _cld_report_error( "Query with dynamic text cannot use async or batch in define-query, reading file [%s] at line [%d]", file_name, lnum);
+                        }
+                        // queries in a batch are put together separated by ';', so each must be a single statement with its 
+                        // input parameters quoted and escaped
+                        if (run_async == 1 && gen_ctx->qry[query_id].is_batch == 1 && (cld_count_substring (gen_ctx->qry[query_id].text, "%s") != 
+                            cld_count_substring (gen_ctx->qry[query_id].text, "'%s'") || strstr (gen_ctx->qry[query_id].text, "''%s") != NULL
+                            || strstr (gen_ctx->qry[query_id].text, "%s''") != NULL || strchr (gen_ctx->qry[query_id].text, ';') != NULL))
+                        {
+                            _cld_report_error( "Query using batch in define-query must be a single statement, with input parameters not quoted, as in [column=<?...?>], reading file [%s] at line [%d]", file_name, lnum);
+                        }
+                        // rows of INSERT with define-query#...bulk are put together in SQL text
+                        char *stmt_text = NULL;
+                        if (run_async == 0 && gen_ctx->qry[query_id].bulk_rows == 0 && gen_ctx->qry[query_id].is_dynamic == 0 && cld_count_substring (gen_ctx->qry[query_id].text, "%s") == 
+                            cld_count_substring (gen_ctx->qry[query_id].text, "'%s'") && strstr (gen_ctx->qry[query_id].text, "''%s") == NULL
+                            && strstr (gen_ctx->qry[query_id].text, "%s''") == NULL)
+                        {
+                            int stmt_size = strlen (gen_ctx->qry[query_id].text) + 1;
+                            stmt_text = cld_strdup (gen_ctx->qry[query_id].text);
+                            cld_replace_string (stmt_text, stmt_size, "'%s'", "?", 1, NULL);
+                            oprintf("const char *__args_%s[%d];\n", gen_ctx->qry[query_id].name, num_run_time_params + 1);
+                            oprintf("CLD_UNUSED (%s);\n", gen_ctx->qry[query_id].name);
+                        }
+                        else
+                        {
+                            oprintf("cld_make_SQL (__sql_buf_%s, %d, %d, %s ",
                                 gen_ctx->qry[query_id].name,CLD_MAX_SQL_SIZE, num_run_time_params,  gen_ctx->qry[query_id].name); 
+                        }
 
                         for (z = 0; z < num_run_time_params; z++)
                         {
+                            if (stmt_text != NULL)
+                            {
+                                oprintf("__args_%s[%d] = ", gen_ctx->qry[query_id].name, z);
+                            }
+                            else
+                            {
+                                oprintf(", ");
+                            }
                             if (gen_ctx->qry[query_id].qry_is_input_str[z] == 0)
                             {
-                                oprintf(", __is_input_used_%s[%d]==1 ?  (%s) : NULL ", gen_ctx->qry[query_id].name, z, gen_ctx->qry[query_id].qry_inputs[z]);
+                                oprintf("__is_input_used_%s[%d]==1 ?  (%s) : NULL ", gen_ctx->qry[query_id].name, z, gen_ctx->qry[query_id].qry_inputs[z]);
                             }
                             else
                             {
-                                oprintf(", __is_input_used_%s[%d]==1 ?  \"%s\" : NULL ", gen_ctx->qry[query_id].name, z, gen_ctx->qry[query_id].qry_inputs[z]);
+                                oprintf("__is_input_used_%s[%d]==1 ?  \"%s\" : NULL ", gen_ctx->qry[query_id].name, z, gen_ctx->qry[query_id].qry_inputs[z]);
                             }
+                            if (stmt_text != NULL) oprintf(";\n");
+                        }
+                        if (stmt_text == NULL) oprintf(");\n");
+
+                        // rows of a static SELECT in run-query can be read one at a time as the loop goes, if nothing needs them 
+                        // all at once
+                        gen_ctx->qry[query_id].is_stream = (start_query == 0 && gen_ctx->qry[query_id].is_DML == 0 && stmt_text != NULL
+                            && gen_ctx->qry[query_id].cache_ttl == 0 && gen_ctx->qry[query_id].prefetch_col == NULL && gen_ctx->qry[query_id].is_typed == 0
+                            && gen_ctx->qry[query_id].is_massaged == 0 && is_query_streamable (f, gen_ctx->qry[query_id].name));
+                        if (gen_ctx->qry[query_id].cache_ttl > 0 && gen_ctx->qry[query_id].is_DML == 1)
+                        {
+                            _cld_report_error( "Only SELECT query can use cache in define-query, reading file [%s] at line [%d]", file_name, lnum);
                         }
-                        oprintf(");\n");
 
                         // We execute the actual db query right at the beginning of the action block
                         // We use 'query ID' decorated variables, so all our results are separate
 
                         oprintf("if (__qry_executed_%s == 1) {cld_report_error(\"Query [%s] has executed the second time without calling define-query before it; if your query executes in a loop, make sure the define-query executes in that loop too prior to the query; if you want to execute the same query twice in a row without a loop, use different queries with the same query text if that is your intention. \");}\n", gen_ctx->qry[query_id].name, gen_ctx->qry[query_id].name);
                         oprintf("__qry_executed_%s = 1;\n", gen_ctx->qry[query_id].name);
+                        oprintf("cld_query_site (&__site_%s_%d);\n", gen_ctx->qry[query_id].name, lnum);
+                        // rows prefetched for all rows of the outer query are used, unless input parameter isn't one of its values,
+                        // in which case query is selected by itself as usual (the statement generated below)
+                        if (gen_ctx->qry[query_id].prefetch_col != NULL) prefetch_query (gen_ctx, query_id, stmt_text, file_name, lnum);
+                        if (gen_ctx->qry[query_id].is_typed == 1) type_query (gen_ctx, query_id, stmt_text, file_name, lnum);
                         if (gen_ctx->qry[query_id].is_DML == 0)
                         {
                             // generate select call for SELECTs
-                            oprintf("cld_select_table (__sql_buf_%s, &__nrow_%s, &__ncol_%s, &__col_names_%s, &__data_%s);\n",
-                            gen_ctx->qry[query_id].name, gen_ctx->qry[query_id].name,gen_ctx->qry[query_id].name, gen_ctx->qry[query_id].name, gen_ctx->qry[query_id].name);
-
-                            oprintf("if (__nrow_%s > 0) cld_data_iterator_fill_array (__data_%s, __nrow_%s, __ncol_%s, &__arr_%s);\n",
-                            gen_ctx->qry[query_id].name, gen_ctx->qry[query_id].name,gen_ctx->qry[query_id].name, gen_ctx->qry[query_id].name, 
+                            if (gen_ctx->qry[query_id].is_stream == 1)
+                            {
+                                oprintf("__stream_%s = cld_select_stream (&__site_%s_%d, \"%s\", %d, __args_%s, &__ncol_%s, &__col_names_%s);\n",
+                                gen_ctx->qry[query_id].name, gen_ctx->qry[query_id].name, lnum, stmt_text, num_run_time_params, gen_ctx->qry[query_id].name, 
+                                gen_ctx->qry[query_id].name, gen_ctx->qry[query_id].name);
+                            }
+                            else if (run_async == 1)
+                            {
+                                oprintf("__async_%s = cld_select_%s (&__site_%s_%d, __sql_buf_%s);\n", gen_ctx->qry[query_id].name, 
+                                    gen_ctx->qry[query_id].is_batch == 1 ? "batch" : "async", gen_ctx->qry[query_id].name, lnum, gen_ctx->qry[query_id].name);
+                            }
+                            else if (gen_ctx->qry[query_id].cache_ttl > 0)
+                            {
+                                // results are kept in process, and discarded when this process changes tables query uses
+                                char tables[CLD_QRY_CACHE_TABLES];
+                                cld_sql_tables (gen_ctx->qry[query_id].text, tables, sizeof (tables));
+                                if (stmt_text != NULL)
+                                {
+                                    oprintf("cld_select_cached (&__site_%s_%d, %d, \"%s\", \"%s\", %d, __args_%s, &__nrow_%s, &__ncol_%s, &__col_names_%s, &__data_%s, &__len_%s);\n",
+                                    gen_ctx->qry[query_id].name, lnum, gen_ctx->qry[query_id].cache_ttl, tables, stmt_text, num_run_time_params, gen_ctx->qry[query_id].name, 
+                                    gen_ctx->qry[query_id].name, gen_ctx->qry[query_id].name, gen_ctx->qry[query_id].name, gen_ctx->qry[query_id].name, gen_ctx->qry[query_id].name);
+                                }
+                                else
+                                {
+                                    oprintf("cld_select_cached (&__site_%s_%d, %d, \"%s\", __sql_buf_%s, 0, NULL, &__nrow_%s, &__ncol_%s, &__col_names_%s, &__data_%s, &__len_%s);\n",
+                                    gen_ctx->qry[query_id].name, lnum, gen_ctx->qry[query_id].cache_ttl, tables, gen_ctx->qry[query_id].name, 
+                                    gen_ctx->qry[query_id].name, gen_ctx->qry[query_id].name, gen_ctx->qry[query_id].name, gen_ctx->qry[query_id].name, gen_ctx->qry[query_id].name);
+                                }
+                            }
+                            else if (stmt_text != NULL)
+                            {
+                                oprintf("cld_select_stmt (&__site_%s_%d, \"%s\", %d, __args_%s, &__nrow_%s, &__ncol_%s, &__col_names_%s, &__data_%s, &__len_%s, ",
+                                gen_ctx->qry[query_id].name, lnum, stmt_text, num_run_time_params, gen_ctx->qry[query_id].name, gen_ctx->qry[query_id].name,
+                                gen_ctx->qry[query_id].name, gen_ctx->qry[query_id].name, gen_ctx->qry[query_id].name, gen_ctx->qry[query_id].name);
+                                if (gen_ctx->qry[query_id].is_typed == 1) oprintf("\"%s\", &__num_%s);\n", gen_ctx->qry[query_id].col_types, gen_ctx->qry[query_id].name);
+                                else oprintf("NULL, NULL);\n");
+                            }
+                            else
+                            {
+                                oprintf("cld_select_table (__sql_buf_%s, &__nrow_%s, &__ncol_%s, &__col_names_%s, &__data_%s, &__len_%s);\n",
+                                gen_ctx->qry[query_id].name, gen_ctx->qry[query_id].name,gen_ctx->qry[query_id].name, gen_ctx->qry[query_id].name, gen_ctx->qry[query_id].name,
                                 gen_ctx->qry[query_id].name);
+                            }
+                            oprintf("cld_query_site (NULL);\n");
 
-                            oprintf("else if (__qry_massage_%s == CLD_QRY_USE_EMPTY)\n", gen_ctx->qry[query_id].name);
-                            oprintf("{\n");
-                            oprintf("__nrow_%s=1;\n", gen_ctx->qry[query_id].name);
-                            oprintf("__ncol_%s=%d;\n", gen_ctx->qry[query_id].name, 
-                                get_num_of_cols (gen_ctx, query_id, file_name, lnum));
-                            oprintf("cld_get_empty_row (&__arr_%s, __ncol_%s);\n",
-                                gen_ctx->qry[query_id].name, gen_ctx->qry[query_id].name);
-                            oprintf("}\n");
+                            // streamed rows are not in __arr, and there is no empty row since use-no-result isn't used. For
+                            // query sent without waiting, this is done when its results are obtained
+                            if (gen_ctx->qry[query_id].is_stream == 0 && run_async == 0)
+                            {
+                                fill_query_rows (gen_ctx, query_id, file_name, lnum);
+                            }
                         }
                         else
                         {
@@ -3494,11 +4337,49 @@ void cld_gen_c_code (cld_gen_ctx *gen_ctx, const char *file_name)
                             {
                                 _cld_report_error( "DML statement could not be parsed, error [%s], reading file [%s] at line [%d]", dml_err==NULL?"":dml_err, file_name, lnum);
                             }
-                            oprintf("cld_execute_SQL (__sql_buf_%s, &__nrow_%s, &__err_%s, NULL);\n",
-                                gen_ctx->qry[query_id].name, gen_ctx->qry[query_id].name, gen_ctx->qry[query_id].name);
+                            if (gen_ctx->qry[query_id].bulk_rows > 0)
+                            {
+                                // row is added to INSERT, which executes once it has all the rows (and affected rows and error are for them)
+                                int prefix_len;
+                                int suffix_len;
+                                if (gen_ctx->qry[query_id].is_insert == 0 || find_insert_values (gen_ctx->qry[query_id].text, &prefix_len, &suffix_len) == 0)
+                                {
+                                    _cld_report_error( "Only INSERT query with VALUES can use bulk in define-query, reading file [%s] at line [%d]", file_name, lnum);
+                                }
+                                char *prefix = cld_strdup (gen_ctx->qry[query_id].text);
+                                prefix[prefix_len] = 0;
+                                const char *suffix = gen_ctx->qry[query_id].text + strlen (gen_ctx->qry[query_id].text) - suffix_len;
+                                // the text before and after VALUES must be the same in SQL made at run-time
+                                if (strpbrk (prefix, "%\\") != NULL || strpbrk (suffix, "%\\") != NULL)
+                                {
+                                    _cld_report_error( "Query using bulk in define-query can have input parameters only in VALUES, reading file [%s] at line [%d]", file_name, lnum);
+                                }
+                                cld_free (prefix);
+                                oprintf("cld_bulk_insert (&__site_%s_%d, __sql_buf_%s, %d, %d, %d, &__nrow_%s, &__err_%s);\n",
+                                    gen_ctx->qry[query_id].name, lnum, gen_ctx->qry[query_id].name, prefix_len, suffix_len, 
+                                    gen_ctx->qry[query_id].bulk_rows, gen_ctx->qry[query_id].name, gen_ctx->qry[query_id].name);
+                            }
+                            else if (stmt_text != NULL)
+                            {
+                                oprintf("cld_execute_stmt (&__site_%s_%d, \"%s\", %d, __args_%s, &__nrow_%s, &__err_%s, NULL);\n",
+                                    gen_ctx->qry[query_id].name, lnum, stmt_text, num_run_time_params, gen_ctx->qry[query_id].name,
+                                    gen_ctx->qry[query_id].name, gen_ctx->qry[query_id].name);
+                            }
+                            else
+                            {
+                                oprintf("cld_execute_SQL (__sql_buf_%s, &__nrow_%s, &__err_%s, NULL);\n",
+                                    gen_ctx->qry[query_id].name, gen_ctx->qry[query_id].name, gen_ctx->qry[query_id].name);
+                            }
+                            oprintf("cld_query_site (NULL);\n");
 
 
-                            if (gen_ctx->qry[query_id].is_insert == 1)
+                            if (gen_ctx->qry[query_id].bulk_rows > 0)
+                            {
+                                // this is the insert id of the first row inserted, if rows were inserted
+                                oprintf("if (__nrow_%s > 0) cld_get_insert_id (__insert_id_%s, sizeof (__insert_id_%s)); else __insert_id_%s[0] = 0;\n", 
+                                    gen_ctx->qry[query_id].name, gen_ctx->qry[query_id].name, gen_ctx->qry[query_id].name, gen_ctx->qry[query_id].name);
+                            }
+                            else if (gen_ctx->qry[query_id].is_insert == 1)
                             {
                                 oprintf("cld_get_insert_id (__insert_id_%s, sizeof (__insert_id_%s)) ;\n", gen_ctx->qry[query_id].name, 
                                     gen_ctx->qry[query_id].name);
@@ -3513,6 +4394,7 @@ void cld_gen_c_code (cld_gen_ctx *gen_ctx, const char *file_name)
                                 gen_ctx->qry[query_id].name,  gen_ctx->qry[query_id].name, gen_ctx->qry[query_id].name);
                             // __nrow_... is now always one, since we return one row always, consisting of affected rows, error and insert id.
                             oprintf("__nrow_%s=1;\n", gen_ctx->qry[query_id].name);
+                            oprintf("__len_%s=NULL;\n", gen_ctx->qry[query_id].name);
                             oprintf("__ncol_%s=3;\n", gen_ctx->qry[query_id].name);
                             
                         }
@@ -3522,6 +4404,8 @@ void cld_gen_c_code (cld_gen_ctx *gen_ctx, const char *file_name)
                             oprintf("else\n");
                             oprintf("{\n");
                             oprintf("__nrow_%s=1;\n", gen_ctx->qry[query_id].name);
+                            if (gen_ctx->qry[query_id].is_typed == 1) oprintf("__num_%s=NULL;\n", gen_ctx->qry[query_id].name);
+                            oprintf("__len_%s=NULL;\n", gen_ctx->qry[query_id].name);
                             oprintf("__ncol_%s=%d;\n", gen_ctx->qry[query_id].name, 
                                 get_num_of_cols (gen_ctx, query_id, file_name, lnum));
                             oprintf("cld_get_empty_row (&__arr_%s, __ncol_%s);\n",
@@ -3529,13 +4413,22 @@ void cld_gen_c_code (cld_gen_ctx *gen_ctx, const char *file_name)
                             oprintf("}\n");
                         }
                         oprintf("cld_free (__sql_buf_%s);\n", gen_ctx->qry[query_id].name);
+                        if (stmt_text != NULL) cld_free (stmt_text);
 
                         if (start_query == 0)
                         {
                             // at this point, we opened a FOR loop to get all the rows. As we go along, we will
                             // print both HTML code and the resulting columns 
-                            oprintf("for (__iter_%s = 0; __iter_%s < __nrow_%s; __iter_%s++)\n",gen_ctx->qry[query_id].name, gen_ctx->qry[query_id].name, 
-                                gen_ctx->qry[query_id].name, gen_ctx->qry[query_id].name);
+                            if (gen_ctx->qry[query_id].is_stream == 1)
+                            {
+                                oprintf("for (__iter_%s = 0; cld_stream_next (__stream_%s, &__row_%s) == 1; __iter_%s++)\n",gen_ctx->qry[query_id].name, 
+                                    gen_ctx->qry[query_id].name, gen_ctx->qry[query_id].name, gen_ctx->qry[query_id].name);
+                            }
+                            else
+                            {
+                                oprintf("for (__iter_%s = 0; __iter_%s < __nrow_%s; __iter_%s++)\n",gen_ctx->qry[query_id].name, gen_ctx->qry[query_id].name, 
+                                    gen_ctx->qry[query_id].name, gen_ctx->qry[query_id].name);
+                            }
                             oprintf("{\n");
                             BEGIN_TEXT_LINE
                         }
@@ -3644,9 +4537,16 @@ void cld_gen_c_code (cld_gen_ctx *gen_ctx, const char *file_name)
                         // because the get_col_ID() call above will get the very last column definition in any case
 
                         // Print out actual column from db query, at runtime
-                        if (newV == NULL)
+                        if (newV == NULL && gen_ctx->qry[query_id].is_stream == 1)
                         {
-                            oprintf("cld_printf (%s, \"%%s\", __arr_%s[__iter_%s][%d]);\n", web_encode == 1 ? "CLD_WEB" : (url_encode == 1 ? "CLD_URL":"CLD_NOENC"), gen_ctx->qry[query_id].name,gen_ctx->qry[query_id].name,column_id);
+                            oprintf("cld_printf (%s, \"%%s\", __row_%s[%d]);\n", web_encode == 1 ? "CLD_WEB" : (url_encode == 1 ? "CLD_URL":"CLD_NOENC"), gen_ctx->qry[query_id].name,column_id);
+                        }
+                        else if (newV == NULL)
+                        {
+                            // length of column is known when rows come from the database, so it's not computed again
+                            oprintf("cld_puts_len (%s, __arr_%s[__iter_%s][%d], __len_%s == NULL ? -1 : (int)__len_%s[__iter_%s * __ncol_%s + %d]);\n", 
+                                web_encode == 1 ? "CLD_WEB" : (url_encode == 1 ? "CLD_URL":"CLD_NOENC"), gen_ctx->qry[query_id].name,gen_ctx->qry[query_id].name,column_id,
+                                gen_ctx->qry[query_id].name, gen_ctx->qry[query_id].name, gen_ctx->qry[query_id].name, gen_ctx->qry[query_id].name, column_id);
                         }
 
                         if (newV != NULL)
@@ -4487,6 +5387,67 @@ void cld_gen_c_code (cld_gen_ctx *gen_ctx, const char *file_name)
 
                     continue;
                 }
+                else if ((newI=recog_markup (line, i, "request-body", &mtext, &msize, 0, file_name, lnum)) != 0)  
+                {
+                    i = newI;
+                    END_TEXT_LINE
+                    // Example:
+                    // request-body define body length define body_len
+                    // length is optional. Body is not copied, it's the POST body as read (for json and octet-stream content)
+                    char *var = NULL;
+                    CLD_STRDUP (var, mtext); // must have a copy because cld_trim could ruin further parsing, 
+                                    // since we have 'i' up above already set to point in line
+                    char *length = strstr (var, CLD_KEYLENGTH " ");
+                    int is_length_defined = 0;
+                    if (length != NULL)
+                    {
+                        *length = 0;
+                        length += strlen (CLD_KEYLENGTH " ");
+                        is_opt_defined (&length, &is_length_defined, file_name, lnum);
+                    }
+                    int is_body_defined = 0;
+                    is_opt_defined (&var, &is_body_defined, file_name, lnum);
+                    if (is_length_defined == 1)
+                    {
+                        oprintf("int %s = 0;\n", length);
+                    }
+                    oprintf("%s%s = cld_get_body (cld_get_config()->ctx.req, %s%s%s);\n", is_body_defined==1?"char *":"", var, 
+                        length == NULL ? "":"&(", length == NULL ? "NULL":length, length == NULL ? "":")"); 
+                    BEGIN_TEXT_LINE
+
+                    continue;
+                }
+                else if ((newI=recog_markup (line, i, "json-value#", &mtext, &msize, 0, file_name, lnum)) != 0)  
+                {
+                    i = newI;
+                    END_TEXT_LINE
+                    // Example:
+                    // json-value#define name path "a.b[3]" status define name_type
+                    // status is optional, it's the type of value found (CLD_JSON_...), CLD_JSON_NONE if not found
+                    // or CLD_JSON_INVALID if request body is not valid JSON
+                    char *path = strstr (mtext, CLD_KEY_PATH);
+                    char *status = strstr (mtext, CLD_KEYSTATUS);
+
+                    carve_markup (&path, "json-value", CLD_KEY_PATH, 1, 1, 0, file_name, lnum);
+                    carve_markup (&status, "json-value", CLD_KEYSTATUS, 0, 1, 0, file_name, lnum);
+
+                    int is_status_defined = 0;
+                    if (status != NULL)
+                    {
+                        is_opt_defined (&status, &is_status_defined, file_name, lnum);
+                        if (is_status_defined == 1)
+                        {
+                            oprintf("int %s = 0;\n", status);
+                        }
+                    }
+                    int is_value_defined = 0;
+                    is_opt_defined (&mtext, &is_value_defined, file_name, lnum);
+                    oprintf("%s%s = cld_json_request_value (%s, %s%s%s);\n", is_value_defined==1?"char *":"", mtext, path,
+                        status == NULL ? "":"&(", status == NULL ? "NULL":status, status == NULL ? "":")"); 
+                    BEGIN_TEXT_LINE
+
+                    continue;
+                }
                 else if (((newI=recog_markup (line, i, "subst-string", &mtext, &msize, 0, file_name, lnum)) != 0)  
                     || ((newI1=recog_markup (line, i, "subst-string-all", &mtext, &msize, 0, file_name, lnum)) != 0))
                 {
@@ -5033,6 +5994,13 @@ int main (int argc, char* argv[])
         tfprintf (stdout, "\t\t Specify the location of the mariaDB socket file, used by"
         " the database server (socket option in my.cnf).\n");
         tfprintf (stdout, "\t \n");
+        tfprintf (stdout, "\t " "%s" "-explain <rows>" "%s" "\n",RED_ON,TERMINAL_OFF);
+        tfprintf (stdout, "\t\t Run EXPLAIN for each query whose text is known (with input parameters set to 1), and warn about a query"
+        " estimated to read more than <rows> rows from a table with a full table or index scan, filesort or temporary table.\n");
+        tfprintf (stdout, "\t \n");
+        tfprintf (stdout, "\t " "%s" "-explain-error" "%s" "\n",RED_ON,TERMINAL_OFF);
+        tfprintf (stdout, "\t\t With -explain, such a query is an error instead of a warning.\n");
+        tfprintf (stdout, "\t \n");
         tfprintf (stdout, "\t " "%s" "-v" "%s" "\n",RED_ON,TERMINAL_OFF);
         tfprintf (stdout, "\t\t Print out verbose information about what is being done.\n");
         tfprintf (stdout, "\t \n");
@@ -5085,6 +6053,20 @@ int main (int argc, char* argv[])
         {
             verbose = 1;
         }
+        else if (!strcmp (argv[i], "-explain"))
+        {
+            if (i + 1 >= argc || (gen_ctx->explain_rows = atoi (argv[i+1])) <= 0)
+            {
+                fprintf(stderr, "Number of rows greater than 0 must be specified after -explain option\n");
+                exit (1);
+            }
+            i++; // skip number of rows now
+            continue;
+        }
+        else if (!strcmp (argv[i], "-explain-error"))
+        {
+            gen_ctx->explain_error = 1;
+        }
         else if (!strcmp (argv[i], "-mariasock"))
         {
             if (i + 1 >= argc)
@@ -5183,9 +6165,19 @@ int main (int argc, char* argv[])
     static MYSQL *g_con = NULL;
     static int is_begin_transaction = 0;
     static int has_connected = 0;
+    static cld_qry_stats qry_stats = {NULL, 0, 0};
+    static cld_qry_cache qry_cache = {NULL, NULL, 0, 0};
+    static MYSQL *async_con[CLD_MAX_ASYNC_CONN];
+    static cld_replica replica = {NULL, 0, -1, {0}, 0};
+    static cld_doc_ids doc_ids = {1, 0};
     CTX.db.is_begin_transaction = &is_begin_transaction;
     CTX.db.g_con = &g_con;
     CTX.db.has_connected = &has_connected;
+    CTX.db.qry_stats = &qry_stats;
+    CTX.db.qry_cache = &qry_cache;
+    CTX.db.async_con = async_con;
+    CTX.db.replica = &replica;
+    CTX.db.doc_ids = &doc_ids;
 
 
 
@@ -5228,6 +6220,64 @@ int main (int argc, char* argv[])
 
         oprintf("#include \"cld.h\"\n");
 
+        //
+        // Process-level initialization: crash handler, list of loaded libraries, curl, time zone and database
+        // socket are set up once per process and not with each request. For web server module, this is called from
+        // the child_init hook (see cld_ws_child_init() in mod_cld.c), and for both web server and command line, it is
+        // also called at the beginning of cld_main, where it does nothing if already done.
+        // If config file can't be read, nothing is done and cld_main will report the error.
+        //
+        oprintf("void cld_child_init ()\n");
+        oprintf("{\n");
+        oprintf("static int is_child_init = 0;\n");
+        oprintf("if (is_child_init == 1) return;\n");
+        oprintf("cld_memory_init();\n");
+        oprintf("umask (S_IRWXO+S_IRWXG);\n");
+        oprintf("cld_get_tz ();\n");
+        oprintf("cld_clear_config ();\n");
+        oprintf("cld_config *pc = cld_get_config ();\n");
+        // there's no request here, but error reporting may still check for transaction
+        oprintf ("static MYSQL *g_con = NULL;\n");
+        oprintf ("static int is_begin_transaction = 0;\n");
+        oprintf ("static int has_connected = 0;\n");
+        oprintf ("static cld_qry_stats qry_stats = {NULL, 0, 0};\n");
+        oprintf ("static cld_qry_cache qry_cache = {NULL, NULL, 0, 0};\n");
+        oprintf ("static MYSQL *async_con[CLD_MAX_ASYNC_CONN];\n");
+        oprintf ("static cld_replica replica = {NULL, 0, -1, {0}, 0};\n");
+        oprintf ("static cld_doc_ids doc_ids = {1, 0};\n");
+        oprintf ("CTX.db.is_begin_transaction = &is_begin_transaction;\n");
+        oprintf ("CTX.db.g_con = &g_con;\n");
+        oprintf ("CTX.db.has_connected = &has_connected;\n");
+        oprintf ("CTX.db.qry_stats = &qry_stats;\n");
+        oprintf ("CTX.db.qry_cache = &qry_cache;\n");
+        oprintf ("CTX.db.async_con = async_con;\n");
+        oprintf ("CTX.db.replica = &replica;\n");
+        oprintf ("CTX.db.doc_ids = &doc_ids;\n");
+        oprintf("pc->ctx.apa = NULL;\n");
+        oprintf ("if (cld_get_runtime_options(&(pc->app.version), &(pc->app.log_directory), &(pc->app.html_directory), &(pc->app.max_upload_size), &(pc->app.max_body_size), &(pc->app.upload_hash), &(pc->app.doc_id_block), &(pc->app.user_params),\n\
+            &(pc->app.web), &(pc->app.email), &(pc->app.file_directory), &(pc->app.tmp_directory), &(pc->app.db), &(pc->app.mariadb_socket), &(pc->app.ignore_mismatch)) != 1) return;\n");
+        oprintf("cld_get_debug_options();\n");
+        oprintf("cld_open_trace();\n");
+        //
+        // Setup crash handler. Also print out all shared libraries loaded and their start/end addresses.
+        //
+        oprintf("cld_set_crash_handler (pc->app.log_directory);\n");
+        oprintf("so_info *so;\n");
+        oprintf("int tot_so = cld_total_so (&so);\n");
+        oprintf ("int it; for (it = 0; it < tot_so; it++) {CLD_TRACE(\"Library loaded: [%%s], start [%%p], end [%%p]\", so[it].mod_name, so[it].mod_addr, so[it].mod_end);}\n");
+        //
+        // Setup mariadb socket port
+        //
+        oprintf("if (pc->app.mariadb_socket != NULL) setenv(\"MYSQL_UNIX_PORT\", pc->app.mariadb_socket, 1);\n");
+        //
+        // Initialize curl
+        //
+        oprintf("curl_global_init(CURL_GLOBAL_ALL);\n");
+        oprintf("CLD_TRACE (\"Process initialized\");\n");
+        oprintf("cld_close_trace ();\n");
+        oprintf("is_child_init = 1;\n");
+        oprintf("}\n");
+
         // 
         // code can be generated for standalone (program) version that can be executed from command line
         // or a web-server plug-in for the web
@@ -5249,6 +6299,13 @@ int main (int argc, char* argv[])
 
         }
 
+        // process-level initialization, if not done already
+        oprintf("cld_child_init();\n");
+
+        // request starts here, measure time spent in each phase (see cld_timing_done())
+        oprintf("struct timespec cld_req_start;\n");
+        oprintf("clock_gettime (CLOCK_MONOTONIC, &cld_req_start);\n");
+
         // BEFORE anything, must destroy previous request's memory and initialize memory for this request
         oprintf("cld_memory_init();\n");
 
@@ -5256,7 +6313,6 @@ int main (int argc, char* argv[])
         oprintf("cld_config *pc = NULL;\n");
         // user-only permissions
         oprintf("umask (S_IRWXO+S_IRWXG);\n");
-        oprintf("cld_get_tz ();\n");
         //
         // This order (clear config, then get config) MUST remain so - see usage of
         // static cache in cldrt.c to make getting config faster.
@@ -5275,9 +6331,19 @@ int main (int argc, char* argv[])
         oprintf ("static MYSQL *g_con = NULL;\n");
         oprintf ("static int is_begin_transaction = 0;\n");
         oprintf ("static int has_connected = 0;\n");
+        oprintf ("static cld_qry_stats qry_stats = {NULL, 0, 0};\n");
+        oprintf ("static cld_qry_cache qry_cache = {NULL, NULL, 0, 0};\n");
+        oprintf ("static MYSQL *async_con[CLD_MAX_ASYNC_CONN];\n");
+        oprintf ("static cld_replica replica = {NULL, 0, -1, {0}, 0};\n");
+        oprintf ("static cld_doc_ids doc_ids = {1, 0};\n");
         oprintf ("CTX.db.is_begin_transaction = &is_begin_transaction;\n");
         oprintf ("CTX.db.g_con = &g_con;\n");
         oprintf ("CTX.db.has_connected = &has_connected;\n");
+        oprintf ("CTX.db.qry_stats = &qry_stats;\n");
+        oprintf ("CTX.db.qry_cache = &qry_cache;\n");
+        oprintf ("CTX.db.async_con = async_con;\n");
+        oprintf ("CTX.db.replica = &replica;\n");
+        oprintf ("CTX.db.doc_ids = &doc_ids;\n");
         oprintf ("CTX.callback.file_too_large_function = &file_too_large;\n");
         oprintf ("CTX.callback.oops_function = &oops;\n");
 
@@ -5291,7 +6357,7 @@ int main (int argc, char* argv[])
 
 
         // read config file
-        oprintf ("if (cld_get_runtime_options(&(pc->app.version), &(pc->app.log_directory), &(pc->app.html_directory), &(pc->app.max_upload_size), &(pc->app.user_params),\n\
+        oprintf ("if (cld_get_runtime_options(&(pc->app.version), &(pc->app.log_directory), &(pc->app.html_directory), &(pc->app.max_upload_size), &(pc->app.max_body_size), &(pc->app.upload_hash), &(pc->app.doc_id_block), &(pc->app.user_params),\n\
             &(pc->app.web), &(pc->app.email), &(pc->app.file_directory), &(pc->app.tmp_directory), &(pc->app.db), &(pc->app.mariadb_socket), &(pc->app.ignore_mismatch)) != 1)\n");
         oprintf ("{\n");
         char *conf_message = "Cannot read 'config' configuration file. Please make sure this file exists in the application's home directory and has the appropriate privileges.<br/>";
@@ -5339,22 +6405,6 @@ int main (int argc, char* argv[])
         // trace_cld must be the very first one, or tracing won't work
         //
         oprintf("cld_open_trace();\n");
-        //
-        // Setup crash handler. Also print out all shared libraries loaded and their start/end addresses.
-        //
-        oprintf("cld_set_crash_handler (cld_get_config()->app.log_directory);\n");
-        oprintf("so_info *so;\n");
-        oprintf("int tot_so = cld_total_so (&so);\n");
-        oprintf ("int it; for (it = 0; it < tot_so; it++) {CLD_TRACE(\"Library loaded: [%%s], start [%%p], end [%%p]\", so[it].mod_name, so[it].mod_addr, so[it].mod_end);}\n");
-
-        //
-        // Setup mariadb socket port
-        //
-        oprintf("if (pc->app.mariadb_socket != NULL) setenv(\"MYSQL_UNIX_PORT\", pc->app.mariadb_socket, 1);\n");
-        //
-        // Initialize curl
-        //
-        oprintf("curl_global_init(CURL_GLOBAL_ALL);\n");
 
         oprintf("CLD_TRACE (\"max_upload_size = %%ld\", pc->app.max_upload_size);\n");
         oprintf("CLD_TRACE (\"web = %%s\", pc->app.web);\n");
@@ -5363,6 +6413,7 @@ int main (int argc, char* argv[])
         oprintf("CLD_TRACE (\"db = %%s\", pc->app.db);\n");
         oprintf("CLD_TRACE (\"mariadb_socket = %%s\", pc->app.mariadb_socket);\n");
         oprintf("reset_cld_config (pc);\n");
+        oprintf("cld_timing_begin (&cld_req_start);\n");
 
         //
         // If in web server container, initialize request handler
@@ -5393,7 +6444,9 @@ int main (int argc, char* argv[])
         // handled (such as Forbidden reply) (otherwise there would be an erorring out). If return
         // value is 0, we just go directly to cld_shut() to flush the response out.
         //
-        oprintf("if (cld_get_input(req, NULL, NULL) == 1)\n");
+        oprintf("int is_input = cld_get_input(req, NULL, NULL);\n");
+        oprintf("cld_timing_phase (CLD_PHASE_INPUT);\n");
+        oprintf("if (is_input == 1)\n");
         oprintf("{\n");
 
         // main function that handles everything - programmer must implement this
@@ -5405,6 +6458,7 @@ int main (int argc, char* argv[])
         // in cld_handle_request()).
         oprintf("cld_check_transaction (2);\n");
         oprintf("}\n");
+        oprintf("cld_timing_phase (CLD_PHASE_HANDLER);\n");
 
         //
         // cld_shut MUST ALWAYS be called at the end - no request can bypass it
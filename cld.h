@@ -53,6 +53,7 @@ You may obtain a copy of the License at
 #include <sys/wait.h>
 #include <sys/stat.h>
 #include <sys/ioctl.h>
+#include <poll.h>
 #include <unistd.h>
 #include <pwd.h>
 #include <limits.h>
@@ -104,7 +105,23 @@ extern char *CLD_EMPTY_STRING;
 #define CLD_PRINTF_MAX_LEN (128*1024) /* max length of printing to buffer before flushing, this MUST BE GREATER than CLD_PRINTF_ADD_LEN by more than 2x
                                 so we don't flush after only one buffer*/
 #define CLD_DEBUGFILE "debug" // the name of debug file in trace directory is always 'debug'
+#define CLD_CONFIG_CHECK_INTERVAL 5 // seconds between checks if config or debug file changed, they are cached in between
+#define CLD_MAX_TRACE_SIZE (64*1024*1024) // default size of trace file after which a new one is started
+#define CLD_QRY_STATS_INTERVAL 60 // seconds between writing query statistics to trace directory
+#define CLD_QRY_CACHE_ENTRIES 256 // max number of query results kept in process for define-query#...cache
+#define CLD_QRY_CACHE_SIZE (16*1024*1024) // max bytes of query results kept in process for define-query#...cache
+#define CLD_QRY_CACHE_TABLES 512 // max length of list of tables a cached query uses
+#define CLD_MAX_ASYNC_CONN 4 // max number of db connections for queries that run while request goes on (define-query#...async)
+#define CLD_BATCH_CONN (CLD_MAX_ASYNC_CONN - 1) // connection in CTX.db.async_con used for batches (run-query-batch), the only one with multiple statements
+#define CLD_BULK_ROWS 500 // default number of rows inserted with one statement (define-query#...bulk)
+#define CLD_PREFETCH_KEYS 1000 // max number of values in IN (...) of one query prefetching rows of a nested query (define-query#...prefetch)
+#define CLD_MAX_STMTS 256 // max number of statements prepared on a db connection, the rest of queries execute as SQL text
+#define CLD_MAX_REPLICAS 8 // max number of read replicas in .db file
+#define CLD_REPLICA_RETRY 30 // seconds a read replica that can't be connected to isn't used
+#define CLD_MAX_DOC_ID_BLOCK 1000000 // max number of document ids a process reserves at once (doc_id_block in config file)
+#define CLD_DOC_ID_TRIES 10 // number of times to try reserving a block of document ids if other processes reserve at the same time (or deadlock)
 #define CLD_MAX_SIZE_OF_URL 32000 /* maximum length of browser url (get) */
+#define CLD_POST_CHUNK (16*1024) /* size of chunks in which large POST bodies are read and decoded */
 #define CLD_MAX_ERR_LEN 12000 /* maximum error length in report error */
 #define CLD_MAX_FILES_PER_UPLOAD_DIR  30000 /* files per directory in file directory */
 #define CLD_ERROR_EXIT_CODE 99 // exit code of command line program when it hits any error
@@ -124,6 +141,45 @@ extern char *CLD_EMPTY_STRING;
 // maximum number of bytes needed to encode either URL or WEB encoded string
 #define CLD_MAX_ENC_BLOWUP(x) ((x)*6+1)
 #define CLD_MAX_QUERY_OUTPUTS 1000 // maximum # of output parameters for each query, per query, essentially # of result columns
+// types of JSON values (and tokens)
+#define CLD_JSON_INVALID -1
+#define CLD_JSON_NONE 0
+#define CLD_JSON_STRING 1
+#define CLD_JSON_NUMBER 2
+#define CLD_JSON_BOOL 3
+#define CLD_JSON_NULL 4
+#define CLD_JSON_OBJECT 5
+#define CLD_JSON_ARRAY 6
+#define CLD_JSON_KEY 7
+// binary trace ring (trace mode 'binary' in debug file), see cldring.c
+#define CLD_RING_MAGIC "CLDRING1"
+#define CLD_RING_REC_SIZE 256 // size of a single trace record
+#define CLD_RING_ARGS (CLD_RING_REC_SIZE - 24) // bytes available for raw arguments in a trace record
+#define CLD_RING_SITES 4096 // maximum number of distinct trace sites (CLD_TRACE calls) in a ring
+#define CLD_RING_NO_SITE 0xFFFF // site ID when there's no more room for sites
+#define CLD_RING_RECORDS 16384 // default number of records in a ring
+#define CLD_RING_TRUNCATED 0x8000 // flag in record length when arguments didn't fit
+#define CLD_RING_CRASH_DUMP 32 // number of last records written to backtrace file on crash
+// kinds of arguments for printf-like conversions
+#define CLD_FMT_NONE 0
+#define CLD_FMT_INT 1
+#define CLD_FMT_UINT 2
+#define CLD_FMT_CHR 3
+#define CLD_FMT_DBL 4
+#define CLD_FMT_STR 5
+#define CLD_FMT_PTR 6
+#define CLD_FMT_N 7
+#define CLD_FMT_PCT 8
+// length modifiers for printf-like conversions
+#define CLD_FMT_LNONE 0
+#define CLD_FMT_LHH 1
+#define CLD_FMT_LH 2
+#define CLD_FMT_LL 3
+#define CLD_FMT_LLL 4
+#define CLD_FMT_LZ 5
+#define CLD_FMT_LJ 6
+#define CLD_FMT_LT 7
+#define CLD_FMT_LLD 8
 
 
 // 
@@ -143,8 +199,15 @@ typedef struct s_debug_app
 {
     int memory_check; // if 1, perform memory check with each CLD_TRACE. Trace does NOT have to be enabled.
     int trace_level; // trace level, currently 0 (no trace) or 1 (trace)
+    long max_trace_size; // trace file is rotated once it grows over this many bytes
+    int trace_binary; // 1 if tracing into binary ring instead of text trace file
+    int trace_records; // number of records in binary trace ring
     int trace_size;  // # of stack items in stack dump after the crash (obtained at crash from backtrace())
     int lint; // to lint or not to lint XHTML dynamic output
+    int timing; // if 1, write time spent in each phase of request to timing log in trace directory
+    int query_stats; // if 1, write statistics for each query site to qstat-<pid> file in trace directory
+    int slow_query; // statements taking at least this many milliseconds to execute are written to slow query log, 0 if none
+    int log_query_string; // if 1, query string of request is written to timing and slow query logs, which may hold private data
     char *tag; // tag used for ... anything at all
     int sleep; // # of seconds to sleep on startup BEFORE getting the input parameter and processing request
 } debug_app;
@@ -179,11 +242,55 @@ typedef struct s_app_data
     const char *email; // application catch-all email
     const char *web; // web site URL for app
     long max_upload_size; // maximum upload size for any file
+    long max_body_size; // maximum size of POST body that isn't an upload (url-encoded or raw body)
+    int upload_hash; // 1 if SHA256 hash of each uploaded file is computed as it's written, 0 otherwise
+    int doc_id_block; // number of document ids a process reserves at once, 1 to get each one from database
     const char *mariadb_socket; // path to mariadb server socket file, typically /var/lib/mysql/mysql.sock
     const char *ignore_mismatch; // yes or no from config file, to ignore or not version mismatch of cld library
     cld_store_data user_params; // user parameters from XXXXXX.conf (those starting with _)
 } app_data;
 // 
+// Trace site in binary trace ring, i.e. a single CLD_TRACE call
+//
+typedef struct cld_ring_site_s
+{
+    const void *key; // file name pointer as passed to trace_cld(), valid only in the process writing the ring
+    int line; // source line
+    char file[60]; // source file (the end of it if too long)
+    char fun[60]; // function name
+    char fmt[124]; // printf-like format used to decode arguments
+} cld_ring_site;
+// 
+// Record in binary trace ring
+//
+typedef struct cld_ring_rec_s
+{
+    unsigned long long seq; // sequence number of record, starting with 1, 0 if being written
+    long long sec; // CLOCK_MONOTONIC_COARSE seconds
+    int nsec; // and nanoseconds
+    unsigned short site; // index of trace site
+    unsigned short len; // number of bytes in args, CLD_RING_TRUNCATED bit set if not all fit
+    unsigned char args[CLD_RING_ARGS]; // raw arguments, 8 bytes for numbers and pointers, 2 byte length + bytes for strings
+} cld_ring_rec;
+// 
+// Binary trace ring, a per-process memory mapped file in trace directory, with header, sites and records
+//
+typedef struct cld_ring_s
+{
+    char magic[8]; // CLD_RING_MAGIC
+    int pid; // process writing the ring
+    int num_records; // number of records
+    int num_sites; // number of sites
+    int rec_size; // size of record
+    long long wall_sec; // wall clock when ring was opened
+    long long mono_sec; // monotonic clock when ring was opened
+    int mono_nsec;
+    int reserved;
+    unsigned long long seq; // sequence number of the next record to be written
+    cld_ring_site site[CLD_RING_SITES];
+    cld_ring_rec rec[]; // num_records of records
+} cld_ring;
+// 
 // Run-time information for tracing
 //
 typedef struct s_conf_trace
@@ -191,10 +298,189 @@ typedef struct s_conf_trace
     int in_memory_check; // if 1, the caller is checking memory which originated from previous memory checking
     int in_trace; // if 1, the caller that is attempting to use tracing function which originated in tracing code
     FILE *f; // file used for tracing file, located in trace directory
+    cld_ring *ring; // binary trace ring, used instead of trace file in binary trace mode
     char fname[300]; // name of trace file
     char time[CLD_TIME_LEN + 1]; // time of last tracing
 } conf_trace;
 // 
+// Value of a numeric column of query with define-query#...typed, obtained in binary form (see cld_select_stmt())
+//
+typedef union cld_num_u
+{
+    long long i; // integer column
+    double d; // DECIMAL, FLOAT and DOUBLE column
+} cld_num;
+// 
+// Statistics for a query site, i.e. a run-query or start-query in source code. Each site is a static variable generated
+// in application code, and is added to application's list of sites (see cld_query_site()) when first executed.
+//
+typedef struct cld_qry_site_s
+{
+    const char *file; // source file (.v)
+    int line; // line number in source file
+    const char *name; // query name
+    int is_listed; // 1 if added to the list of sites
+    long long execs; // number of executions
+    long long total_us; // total time executing queries and getting results, in microseconds
+    long long max_us; // longest single execution, in microseconds
+    long long curr_us; // time of the execution in progress
+    long long rows; // rows returned for SELECT, affected rows for other statements
+    long long bytes; // bytes of results copied
+    MYSQL_STMT *stmt; // prepared statement for this site on current db connection, NULL if not prepared yet
+    MYSQL_STMT *replica_stmt; // prepared statement for this site on current read replica connection, NULL if not prepared yet
+    struct cld_qry_site_s *next; // next site in the list
+} cld_qry_site;
+// 
+// List of query sites in an application, with time it was last written to trace directory
+//
+typedef struct cld_qry_stats_s
+{
+    cld_qry_site *sites; // list of sites executed so far in this process
+    time_t written; // when statistics were last written to qstat-<pid> file
+    int num_stmts; // number of statements prepared on current db connection (see cld_run_stmt())
+} cld_qry_stats;
+// 
+// Query whose rows are read from the database one at a time as they're used in run-query loop, instead of all at once 
+// (see cld_select_stream())
+//
+typedef struct cld_stream_s
+{
+    cld_qry_site *site; // query site
+    MYSQL_STMT *stmt; // statement whose rows are being read, NULL once they are all read
+    int ncol; // number of columns
+    MYSQL_BIND *res; // result buffer for each column
+    unsigned long *lens; // length of each column in the row just read
+    my_bool *is_null; // 1 if column in the row just read is NULL
+    my_bool *is_trunc; // 1 if column in the row just read didn't fit in its result buffer
+    char **big; // buffer for each column for values that don't fit in result buffer
+    unsigned long *big_size; // size of each of those buffers
+    char **row; // current row
+    char **data; // rows read ahead because another query executed before they were used
+    int nrow; // number of rows read ahead
+    int curr; // next row read ahead to use
+} cld_stream;
+// 
+// Result of a query kept in process for define-query#...cache <ttl> (see cld_select_cached()). Entries are in a list, 
+// the most recently used first.
+//
+typedef struct cld_qry_cache_entry_s
+{
+    char *key; // SQL text, followed by input parameters for prepared statement
+    unsigned long hash; // hash of key
+    char *tables; // tables query uses as ",table1,table2,", or empty if not known
+    time_t expires; // when the entry is no longer used
+    int nrow; // number of rows
+    int ncol; // number of columns
+    char **col_names; // column names
+    char *data; // all columns of all rows, one after the other, each ending with zero
+    unsigned long *lengths; // length of each column in data
+    size_t size; // bytes of memory used by the entry
+    struct cld_qry_cache_entry_s *prev; // more recently used entry
+    struct cld_qry_cache_entry_s *next; // less recently used entry
+} cld_qry_cache_entry;
+// 
+// Query results kept in an application's process
+//
+typedef struct cld_qry_cache_s
+{
+    cld_qry_cache_entry *first; // most recently used entry
+    cld_qry_cache_entry *last; // least recently used entry
+    int count; // number of entries
+    size_t size; // bytes of memory used by all entries
+} cld_qry_cache;
+// 
+// Query sent to the database without waiting for it to execute (see cld_select_async())
+//
+typedef struct cld_async_s
+{
+    cld_qry_site *site; // query site
+    char *sql; // SQL text
+    MYSQL *con; // connection query is sent on, NULL once its results are obtained
+    int conn_id; // index of connection in CTX.db.async_con
+    int status; // what non-blocking call waits for (MYSQL_WAIT_...), 0 if query executed
+    int err; // result of executing query, 0 if okay
+    struct timespec start; // when query was sent
+    int is_done; // 1 if results are obtained
+    int is_queued; // 1 if waiting to be sent with cld_run_batch()
+    struct cld_async_s *first; // first query in a batch sent with cld_run_batch(), NULL if not in a batch
+    struct cld_async_s *next; // next query in a batch
+    int nrow; // number of rows
+    int ncol; // number of columns
+    char **col_names; // column names
+    char **data; // all columns of all rows, see cld_select_table()
+    unsigned long *lengths; // length of each column in data
+} cld_async;
+// 
+// INSERT whose rows are put together into one statement (see cld_bulk_insert())
+//
+typedef struct cld_bulk_s
+{
+    cld_qry_site *site; // query site of INSERT
+    char *sql; // INSERT with rows added so far
+    int len; // length of sql
+    int size; // allocated size of sql
+    int rows; // number of rows in sql
+    char *suffix; // text that comes after rows (such as ON DUPLICATE KEY UPDATE...), empty if none
+} cld_bulk;
+// 
+// Rows of a query executed in the loop of another query's rows, selected for all of those rows at once 
+// (see cld_prefetch_rows())
+//
+typedef struct cld_prefetch_s
+{
+    cld_qry_site *site; // query site of nested query
+    char ***outer; // rows of outer query rows are selected for
+    int nkey; // number of keys
+    char **keys; // values of outer query's column rows are selected for, sorted
+    int key_col; // column of nested query compared to keys
+    int nrow; // number of rows
+    int ncol; // number of columns
+    char **col_names; // column names
+    char **data; // all columns of all rows (see cld_select_table()), sorted by key column
+    unsigned long *lengths; // length of each column in data
+    struct cld_prefetch_s *next; // rows of another query nested in the same loop
+} cld_prefetch;
+// 
+// Read replicas listed in .db file, and connection to the one used (see cld_replica_con())
+//
+typedef struct cld_replica_s
+{
+    MYSQL *con; // connection to replica, NULL if not connected
+    int curr; // replica connected to (or last one tried), 1 for the first replica in .db file
+    int num; // number of replicas in .db file, -1 if not read yet
+    time_t down_until[CLD_MAX_REPLICAS + 1]; // replica that failed isn't used until this time
+    int num_stmts; // number of statements prepared on replica connection (see cld_replica_stmt())
+} cld_replica;
+// 
+// Document ids reserved by a process and not yet used, from next to last (see cld_get_document_id())
+//
+typedef struct cld_doc_ids_s
+{
+    long long next; // next id to give out
+    long long last; // last id reserved
+} cld_doc_ids;
+// 
+// Phases of request processing, for which time spent is measured (see cld_timing_phase())
+//
+#define CLD_PHASE_BOOT 0 // reading config and debug options, opening trace
+#define CLD_PHASE_INPUT 1 // getting input (cld_get_input())
+#define CLD_PHASE_DB 2 // executing queries and getting their results
+#define CLD_PHASE_HANDLER 3 // request handler, other than database and flushing output
+#define CLD_PHASE_FLUSH 4 // flushing output (cld_flush_printf())
+#define CLD_PHASE_SHUT 5 // shutting down request (cld_shut()), other than flushing output
+#define CLD_PHASES 6
+// 
+// Time spent in each phase of request, in microseconds. Measured with monotonic clock.
+//
+typedef struct s_cld_timing
+{
+    struct timespec start; // when request started, tv_sec is 0 if not measuring
+    struct timespec last; // end of the last phase measured with cld_timing_phase()
+    long long phase[CLD_PHASES]; // microseconds spent in each phase
+    long long nested; // microseconds added with cld_timing_add() since 'last', not to be counted twice
+    int queries; // number of queries executed
+} cld_timing;
+// 
 // The buffer for outputting. This includes string writing (such as write-string) and any web output (such as
 // outputting HTML code).
 typedef struct s_out_HTML
@@ -246,6 +532,32 @@ typedef struct s_cld_header
     const char *value[CLD_MAX_HTTP_HEADER+1];
 } cld_header;
 // 
+// JSON token. Tokens are in a flat array, in the order they appear in JSON text. Value of a token points
+// into the JSON text itself, which is unescaped and zero-terminated in place.
+//
+typedef struct s_cld_json_token
+{
+    int type; // CLD_JSON_... type
+    char *str; // value for string, number, boolean, null and key
+    int len; // length of value
+    int parent; // index of object or array this belongs to, -1 for top-level value
+    int size; // number of members of object, or elements of array
+    int end; // index of the first token past this value (including all tokens of object or array)
+} cld_json_token;
+// 
+// Parsed JSON text
+//
+typedef struct s_cld_json
+{
+    char *text; // JSON text, changed in place by parsing
+    int len; // length of text
+    cld_json_token *tokens; // array of tokens
+    int num_tokens; // # of tokens
+    int tot_tokens; // # of tokens allocated
+    const char *error; // error message if JSON is not valid
+    int error_pos; // byte position of error
+} cld_json;
+// 
 // Input request. Overarching structure that contains much information not just about
 // input request, but about current configuration, run-time state of the program.
 typedef struct input_req_s
@@ -269,7 +581,24 @@ typedef struct input_req_s
     void *data; // global data - it can be used any way you like in application code
     int is_shut; // 1 if cld_shut already called
     cld_header *header; // if NULL, do nothing (no custom headers), if not-NULL use it to set custom headers
+    char *body; // raw POST body (application/json or application/octet-stream), NULL if none
+    int body_len; // length of 'body' in bytes
+    const char *body_type; // content type of 'body'
+    cld_json *json; // parsed 'body' if JSON, NULL if not parsed yet
+    int json_status; // 0 if body not yet parsed as JSON, 1 if parsed, -1 if not JSON or invalid
 } input_req;
+//
+// State of decoding url-encoded POST body as it is read in chunks
+//
+typedef struct s_cld_url_stream
+{
+    char *dest; // decoded output, in the form of name-value-name-value... zero-delimited chunks
+    int pos; // current write position in 'dest'
+    int hex_pending; // number of hex digits still expected after '%' (0, 1 or 2)
+    int hex_val; // value of the hex-encoded byte being decoded
+    int had_equal; // 1 if current name=value had the equal sign
+    int num_of_input_params; // number of name=value pairs decoded so far
+} cld_url_stream;
 // 
 // Context of execution. Contains inut request, apache web server structure, flags
 //
@@ -282,6 +611,11 @@ typedef struct s_context
     int trim_query_input; // if 1, URL input parameters (other than uploads) are trimmed
     input_req *req; // input request (see definition)
     void *apa; // apache structure (request_req * in apapche)
+    cld_qry_site *qry_site; // query site being executed, NULL if none (see cld_query_site())
+    cld_stream *stream; // query whose rows are being read from the database, NULL if none (see cld_select_stream())
+    cld_async *async[CLD_MAX_ASYNC_CONN]; // query sent on each of connections in db.async_con, NULL if none
+    cld_bulk *bulk; // rows of INSERT not yet executed, NULL if none
+    int is_written; // 1 if request executed a statement that may change data, so its SELECTs don't go to a read replica
     int cld_report_error_is_in_report; // 1 if in progress of reporting an error 
     //
     // Handling of static variables in shared library:
@@ -322,6 +656,11 @@ typedef struct s_context
         MYSQL **g_con; // connection to db - persists in one process for many requests (no dropping/reconnection)
         int *is_begin_transaction; // are we in transaction in this process
         int *has_connected; // are we connected to db at this moment
+        cld_qry_stats *qry_stats; // statistics for query sites executed in this process
+        cld_qry_cache *qry_cache; // query results kept in this process
+        MYSQL **async_con; // CLD_MAX_ASYNC_CONN connections for queries that run while request goes on, NULL if not connected
+        cld_replica *replica; // read replicas SELECTs outside of transaction go to
+        cld_doc_ids *doc_ids; // document ids reserved from this application's database
     } db;
 
 
@@ -362,6 +701,7 @@ typedef struct s_cld_config
 
     // these change during a request
     conf_trace trace; // tracing info
+    cld_timing timing; // time spent in phases of request
     out_HTML out; // output buffers (write-string and output of HTML)
     context ctx; // context of execution, not config, but convenient to
                 // have it handy. That is why it's separate type. Changes at run-time
@@ -404,7 +744,21 @@ typedef struct s_so_info
 // Macros and function call related
 //
 #define CLD_UNUSED(x) (void)(x)
-#define  CLD_TRACE(...) trace_cld(1, __FILE__, __LINE__, __FUNCTION__,  __VA_ARGS__)
+// 
+// Tracing. Location of the last trace is always recorded (for crash handler), but trace_cld() is called (and its
+// arguments evaluated) only if process-wide cld_trace_level (set from debug file) is at least the level of trace site.
+// Trace sites with level greater than CLD_TRACE_MAX_LEVEL are compiled out altogether (build with -DCLD_TRACE_MAX_LEVEL=0
+// to remove all of them, including memory checks done with each trace).
+//
+#ifndef CLD_TRACE_MAX_LEVEL
+#define CLD_TRACE_MAX_LEVEL 1
+#endif
+#if CLD_TRACE_MAX_LEVEL >= 1
+#define  CLD_TRACE(...) do { func_name = __FILE__; func_line = __LINE__; if (cld_trace_level >= 1) trace_cld(1, __FILE__, __LINE__, __FUNCTION__,  __VA_ARGS__); } while (0)
+#else
+#define  CLD_TRACE(...) do { func_name = __FILE__; func_line = __LINE__; if (0) trace_cld(1, __FILE__, __LINE__, __FUNCTION__,  __VA_ARGS__); } while (0)
+#endif
+#define CLD_TRACE_ALL 1000 // value of cld_trace_level when every trace site must call trace_cld() (i.e. for memory check)
 #define  cld_report_error(...) {_cld_report_error(__VA_ARGS__);exit(0);}
 #define cld_report_error_no_exit(...) _cld_report_error(__VA_ARGS__)
 #define CLD_STRDUP(x, y) {const char *__temp = (y); (x) = cld_strdup (__temp == NULL ? "" : __temp); if ((x) == NULL) { cld_report_error("Out of memory");}}
@@ -429,6 +783,14 @@ typedef struct s_so_info
 void cld_init_input_req (input_req *iu);
 int cld_open_trace ();
 void cld_close_trace();
+long long cld_timing_us (const struct timespec *since, const struct timespec *now);
+void cld_timing_begin (const struct timespec *start);
+void cld_timing_phase (int phase);
+long long cld_timing_add (int phase, const struct timespec *since);
+const char *cld_log_query_string ();
+void cld_timing_done ();
+void cld_write_slow_query (const char *file, int line, const char *name, long long us, long long rows, long long bytes);
+void cld_slow_stmt_done ();
 char *cld_i2s (int i, char **s);
 void cld_make_SQL (char *dest, int destSize, int num_of_params, const char *format, ...) __attribute__ ((format (printf, 4, 5)));
 void cld_output_http_header(input_req *iu);
@@ -438,9 +800,21 @@ int cld_encode (int enc_type, const char *v, char **res);
 void cld_get_document_id (char *doc_id, int doc_id_len);
 int cld_get_input(input_req *req, const char *method, const char *input);
 char *cld_get_input_param (const input_req *iu, const char *name);
+char *cld_get_body (const input_req *req, int *len);
+int cld_is_content_type (const char *cont_type, const char *type);
+int cld_json_parse (cld_json *j, char *text, int len);
+char *cld_json_find (cld_json *j, const char *path, int *type);
+char *cld_json_request_value (const char *path, int *type);
 int cld_is_positive_int (const char *s);
 int cld_exec_program_with_input(const char *cmd, const char *argv[], int num_args, const char *inp, int inp_len, char *out_buf, int out_len);
+int cld_fmt_conv (const char *p, int *kind, int *lmod, int *stars);
+cld_ring *cld_ring_open (const char *fname, int num_records);
+void cld_ring_close (cld_ring *r);
+void cld_ring_trace (cld_ring *r, const char *from_file, int from_line, const char *from_fun, const char *format, va_list args);
+int cld_ring_render (const cld_ring *r, const cld_ring_rec *rec, char *out, int out_len);
+void cld_ring_crash_dump (const char *fname);
 void cld_get_debug_options();
+void cld_read_debug_options(const char *fname, debug_app *debug);
 int lint();
 int cld_save_HTML ();
 int cld_flush_printf(int fin);
@@ -464,6 +838,8 @@ void cld_trim (char *str, int *len);
 int cld_is_directory (const char *dir);
 size_t cld_get_file_size(const char *fn);
 void cld_memory_init ();
+size_t cld_memory_peak ();
+void cld_add_resource (void *res, void (*release)(void *));
 CLD_MEMINLINE void *__cld_malloc(size_t size);
 CLD_MEMINLINE void *__cld_calloc(size_t nmemb, size_t size);
 CLD_MEMINLINE void *__cld_realloc(void *ptr, size_t size);
@@ -478,7 +854,7 @@ int cld_commit();
 int cld_rollback();
 void cld_get_insert_id(char *val, int sizeVal);
 int cld_DML (char *s, int *rows, unsigned int *er);
-void cld_select_table (const char *s, int *nrow, int *ncol, char ***col_names, char ***data);
+void cld_select_table (const char *s, int *nrow, int *ncol, char ***col_names, char ***data, unsigned long **lengths);
 void cld_data_iterator_init (cld_iter *d, char **data, int rows, int cols);
 char *cld_data_iterator_next (cld_iter *d, int *brk);
 void cld_data_iterator_fill_array (char **data, int nrow, int ncol, char ****arr);
@@ -486,19 +862,24 @@ void cld_get_dml_row (char ****arr, int rowcount, unsigned int err, const char *
 void cld_get_empty_row (char ****arr, int ncol);
 void trace_cld(int trace_level, const char *fromFile, int fromLine, const char *fromFun, const char *format, ...)
     __attribute__((format(printf, 5, 6)));
-int cld_get_credentials(char* host, char* name, char* passwd, char* db, const char *fname);
+int cld_get_credentials(char* host, char* name, char* passwd, char* db, const char *fname, int replica);
 char *cld_sha( const char *val );
+int cld_write_sha (FILE *f, const char *data, size_t len, char *hash);
 int cld_ws_util_read (void * rp, char *content, int len);
+int cld_ws_util_read_stream (void * rp, char *chunk, int chunk_len, int (*proc)(void *, const char *, int), void *arg);
 const char *cld_ws_get_env(void * vmr, const char *n);
 void cld_ws_set_content_type(void *rp, const char *v);
 void cld_ws_set_content_length(void *rp, const char *v);
 void cld_ws_set_header (void *rp, const char *n, const char *v);
+void cld_ws_set_note (void *rp, const char *n, const char *v);
+void cld_ws_metrics (void *rp, long long total_us, int queries, size_t memory_peak);
 void cld_ws_add_header (void *rp, const char *n, const char *v);
 void cld_ws_send_header (void *rp);
 int cld_ws_write (void *r, const char *s, int nbyte);
 int cld_ws_flush (void *r);
 void cld_ws_finish (void *rp);
 int cld_main (void *r);
+void cld_child_init ();
 void cld_ws_set_status (void *rp, int st, const char *line);
 int cld_ws_printf (void *r, const char *fmt, ...) __attribute__ ((format (printf, 2, 3)));
 const char *cld_ws_get_status (void *rp, int *status);
@@ -513,6 +894,7 @@ const char *cld_web_address ();
 int cld_puts_final (const char *final_out, int final_len);
 inline char *cld_init_string(const char *s);
 int cld_puts (int enc_type, const char *s);
+int cld_puts_len (int enc_type, const char *s, int len);
 inline int cld_copy_data_at_offset (char **data, int off, const char *value);
 int cld_is_valid_param_name (const char *name);
 void cld_write_to_string (char **str);
@@ -541,7 +923,10 @@ void cld_get_input_params (input_req *req, cld_input_params *ip );
 char *cld_construct_url (cld_input_params *ip);
 inline void cld_append_string (const char *from, char **to);
 int cld_replace_input_param (cld_input_params *ip, const char *name, const char *new_value);
-int cld_get_runtime_options(const char **version, const char **log_directory, const char **html_directory, long *max_upload_size, cld_store_data *uparams, const char **web, const char **email, const char **file_directory, const char **tmp_directory, const char **db, const char **sock, const char **ignore_mismatch);
+int cld_get_runtime_options(const char **version, const char **log_directory, const char **html_directory, long *max_upload_size, long *max_body_size, int *upload_hash, int *doc_id_block, cld_store_data *uparams, const char **web, const char **email, const char **file_directory, const char **tmp_directory, const char **db, const char **sock, const char **ignore_mismatch);
+int cld_read_runtime_options(const char **version, const char **log_directory, const char **html_directory, long *max_upload_size, long *max_body_size, int *upload_hash, int *doc_id_block, cld_store_data *uparams, const char **web, const char **email, const char **file_directory, const char **tmp_directory, const char **db, const char **sock, const char **ignore_mismatch);
+void cld_copy_app_data (app_data *dest, const app_data *src);
+void cld_free_app_data (app_data *app);
 inline const char * cld_major_version();
 inline int cld_minor_version();
 inline int cld_patch_version();
@@ -567,6 +952,29 @@ int cld_check_transaction(int check_mode);
 void cld_break_down (char *value, const char *delim, cld_broken *broken);
 const char * cld_get_tz ();
 int cld_execute_SQL (const char *s,  int *rows, unsigned int *er, const char **err_message);
+void cld_query_site (cld_qry_site *site);
+int cld_execute_stmt (cld_qry_site *site, const char *s, int num_of_args, const char **args, int *rows, unsigned int *er, const char **err_message);
+void cld_select_stmt (cld_qry_site *site, const char *s, int num_of_args, const char **args, int *nrow, int *ncol, char ***col_names, char ***data, unsigned long **lengths,
+    const char *types, cld_num **nums);
+cld_stream *cld_select_stream (cld_qry_site *site, const char *s, int num_of_args, const char **args, int *ncol, char ***col_names);
+int cld_stream_next (cld_stream *st, char ***row);
+void cld_stream_done (cld_stream *st);
+void cld_write_qry_stats (int force);
+void cld_select_cached (cld_qry_site *site, int ttl, const char *tables, const char *s, int num_of_args, const char **args, int *nrow, int *ncol, 
+    char ***col_names, char ***data, unsigned long **lengths);
+void cld_invalidate_cache (const char *s);
+void cld_sql_tables (const char *s, char *tables, int tables_len);
+cld_async *cld_select_async (cld_qry_site *site, const char *s);
+cld_async *cld_select_batch (cld_qry_site *site, const char *s);
+void cld_run_batch (int num, ...);
+void cld_async_wait (cld_async *a, int *nrow, int *ncol, char ***col_names, char ***data, unsigned long **lengths);
+void cld_async_done ();
+void cld_bulk_insert (cld_qry_site *site, const char *s, int prefix_len, int suffix_len, int chunk, int *rows, unsigned int *er);
+void cld_bulk_flush (int *rows, unsigned int *er);
+char *cld_bulk_flush_query (const char *file, const char *name, int is_report);
+cld_prefetch *cld_prefetch_rows (cld_prefetch **list, cld_qry_site *site, const char *prefix, const char *suffix, char ***outer, int outer_nrow, 
+    int outer_col, int key_col);
+int cld_prefetch_get (cld_prefetch *p, const char *key, int *nrow, int *ncol, char ***col_names, char ***data, unsigned long **lengths);
 char *cld_time (const char *timezone, int year, int month, int day, int hour, int min, int sec);
 void cld_exec_program (const char *program, int num_args, const char **program_args, int *status, char **program_output, int program_output_length);
 int cld_encode_base (int enc_type, const char *v, int vLen, char **res, int allocate_new);
@@ -583,6 +991,10 @@ const char *cld_app_name ();
 
 // Application name for apache purposes 
 extern char *cld_handler_name;
+extern int cld_trace_level;
+extern cld_ring *cld_crash_ring;
+extern const char *func_name;
+extern int func_line;
 
 #endif
 
@@ -0,0 +1,410 @@
+/*
+Copyright (c) 2017 DaSoftver LLC.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+
+//
+// JSON parsing for CLD run-time. JSON text is tokenized in place: strings are
+// unescaped and zero-terminated within the text itself, and the result is a flat
+// array of tokens pointing into it, so there is no allocation per value.
+//
+
+#include "cld.h"
+
+//  functions (local)
+int cld_json_add_token (cld_json *j, int type, char *str, int len, int parent);
+int cld_json_unescape (char **r, char **w);
+int cld_json_number (const char *p);
+
+// states of tokenizer, i.e. what it expects next
+#define CLD_JSON_WANT_VALUE 0
+#define CLD_JSON_WANT_KEY 1
+#define CLD_JSON_WANT_COLON 2
+#define CLD_JSON_WANT_COMMA 3
+#define CLD_JSON_WANT_END 4
+
+// initial number of tokens allocated, doubled as needed
+#define CLD_JSON_INIT_TOKENS 64
+
+
+//
+// Add token to JSON token array. 'j' is the JSON being parsed, 'type' is the token type (CLD_JSON_...),
+// 'str' and 'len' is its value in JSON text, 'parent' is the index of the object or array it belongs to, or -1.
+// Token array grows by doubling, so allocations are few regardless of the number of values.
+// Returns index of the new token.
+//
+int cld_json_add_token (cld_json *j, int type, char *str, int len, int parent)
+{
+    CLD_TRACE("");
+    if (j->num_tokens >= j->tot_tokens)
+    {
+        j->tot_tokens = (j->tot_tokens == 0 ? CLD_JSON_INIT_TOKENS : 2 * j->tot_tokens);
+        j->tokens = (cld_json_token*)cld_realloc (j->tokens, j->tot_tokens * sizeof (cld_json_token));
+    }
+    int t = j->num_tokens++;
+    j->tokens[t].type = type;
+    j->tokens[t].str = str;
+    j->tokens[t].len = len;
+    j->tokens[t].parent = parent;
+    j->tokens[t].size = 0;
+    j->tokens[t].end = t + 1; // for object and array, this is set when it's closed
+    if (parent != -1)
+    {
+        // object counts keys (pairs), array counts elements
+        if ((j->tokens[parent].type == CLD_JSON_OBJECT && type == CLD_JSON_KEY) ||
+            (j->tokens[parent].type == CLD_JSON_ARRAY && type != CLD_JSON_KEY)) j->tokens[parent].size++;
+    }
+    return t;
+}
+
+//
+// Unescape JSON string in place. *r points to just after the opening quote, *w is where to write the
+// unescaped string (which is never longer than escaped one, so it is written over itself).
+// On return, *r points to the closing quote and *w is just past the last byte written.
+// \uXXXX (including surrogate pairs) is written as UTF-8.
+// Returns 1 if okay, 0 if string is malformed or unterminated.
+//
+int cld_json_unescape (char **r, char **w)
+{
+    CLD_TRACE("");
+    char *rd = *r;
+    char *wr = *w;
+    while (*rd != '"')
+    {
+        if (*rd == 0 || (unsigned char)*rd < 0x20)
+        {
+            *r = rd;
+            return 0; // unterminated, or control character that must be escaped
+        }
+        if (*rd != '\\')
+        {
+            *wr++ = *rd++;
+            continue;
+        }
+        rd++;
+        switch (*rd)
+        {
+            case '"': *wr++ = '"'; break;
+            case '\\': *wr++ = '\\'; break;
+            case '/': *wr++ = '/'; break;
+            case 'b': *wr++ = '\b'; break;
+            case 'f': *wr++ = '\f'; break;
+            case 'n': *wr++ = '\n'; break;
+            case 'r': *wr++ = '\r'; break;
+            case 't': *wr++ = '\t'; break;
+            case 'u':
+            {
+                unsigned long u = 0;
+                int k;
+                for (k = 1; k <= 4; k++)
+                {
+                    if (!isxdigit (rd[k])) { *r = rd; return 0; }
+                    u = u * 16 + CLD_CHAR_FROM_HEX (rd[k]);
+                }
+                rd += 4;
+                // surrogate pair makes up a single code point
+                if (u >= 0xD800 && u <= 0xDBFF && rd[1] == '\\' && rd[2] == 'u')
+                {
+                    unsigned long low = 0;
+                    for (k = 3; k <= 6; k++)
+                    {
+                        if (!isxdigit (rd[k])) { *r = rd; return 0; }
+                        low = low * 16 + CLD_CHAR_FROM_HEX (rd[k]);
+                    }
+                    if (low >= 0xDC00 && low <= 0xDFFF)
+                    {
+                        u = 0x10000 + ((u - 0xD800) << 10) + (low - 0xDC00);
+                        rd += 6;
+                    }
+                }
+                if (u < 0x80) *wr++ = (char)u;
+                else if (u < 0x800)
+                {
+                    *wr++ = (char)(0xC0 | (u >> 6));
+                    *wr++ = (char)(0x80 | (u & 0x3F));
+                }
+                else if (u < 0x10000)
+                {
+                    *wr++ = (char)(0xE0 | (u >> 12));
+                    *wr++ = (char)(0x80 | ((u >> 6) & 0x3F));
+                    *wr++ = (char)(0x80 | (u & 0x3F));
+                }
+                else
+                {
+                    *wr++ = (char)(0xF0 | (u >> 18));
+                    *wr++ = (char)(0x80 | ((u >> 12) & 0x3F));
+                    *wr++ = (char)(0x80 | ((u >> 6) & 0x3F));
+                    *wr++ = (char)(0x80 | (u & 0x3F));
+                }
+                break;
+            }
+            default: *r = rd; return 0;
+        }
+        rd++;
+    }
+    *r = rd;
+    *w = wr;
+    return 1;
+}
+
+//
+// Get length of JSON number at 'p', which is -?(0|[1-9][0-9]*)(.[0-9]+)?([eE][+-]?[0-9]+)?
+// Whatever follows the number isn't checked here.
+// Returns length of number, or 0 if it's malformed (such as a missing digit after '-', '.' or exponent).
+//
+int cld_json_number (const char *p)
+{
+    const char *n = p;
+    if (*n == '-') n++;
+    if (*n == '0') n++;
+    else if (isdigit (*n)) while (isdigit (*n)) n++;
+    else return 0;
+    if (*n == '.')
+    {
+        n++;
+        if (!isdigit (*n)) return 0;
+        while (isdigit (*n)) n++;
+    }
+    if (*n == 'e' || *n == 'E')
+    {
+        n++;
+        if (*n == '+' || *n == '-') n++;
+        if (!isdigit (*n)) return 0;
+        while (isdigit (*n)) n++;
+    }
+    return (int)(n - p);
+}
+
+//
+// Tokenize JSON 'text' of length 'len' in place. 'text' must be zero-terminated (i.e. text[len] is 0) and
+// it is changed: strings are unescaped and all values are zero-terminated where they are, so token values
+// can be used as strings directly. 'j' is the output, a flat array of tokens, where tokens of an object or array
+// follow it, and object members are key token followed by value token(s).
+// Returns 1 if JSON is valid, 0 if not, in which case j->error is the message and j->error_pos is the byte position.
+//
+int cld_json_parse (cld_json *j, char *text, int len)
+{
+    CLD_TRACE("");
+    assert (j);
+    assert (text);
+    j->text = text;
+    j->len = len;
+    j->tokens = NULL;
+    j->num_tokens = 0;
+    j->tot_tokens = 0;
+    j->error = NULL;
+    j->error_pos = 0;
+
+    int cur = -1; // currently open object or array
+    int want = CLD_JSON_WANT_VALUE;
+    int just_opened = 0; // 1 if object or array was just opened, so it can be closed right away
+    char *p = text;
+    char *past_end = text + len;
+#define CLD_JSON_ERR(m) { j->error = (m); j->error_pos = (int)(p - text); return 0; }
+
+    while (p < past_end)
+    {
+        char c = *p;
+        if (isspace (c))
+        {
+            p++;
+            continue;
+        }
+        if (want == CLD_JSON_WANT_END) CLD_JSON_ERR("Extra characters after JSON value");
+
+        if (c == '{' || c == '[')
+        {
+            if (want != CLD_JSON_WANT_VALUE) CLD_JSON_ERR("Unexpected start of object or array");
+            cur = cld_json_add_token (j, c == '{' ? CLD_JSON_OBJECT : CLD_JSON_ARRAY, p, 0, cur);
+            want = (c == '{' ? CLD_JSON_WANT_KEY : CLD_JSON_WANT_VALUE);
+            just_opened = 1;
+            p++;
+            continue;
+        }
+        if (c == '}' || c == ']')
+        {
+            int is_obj = (c == '}');
+            if (cur == -1 || j->tokens[cur].type != (is_obj ? CLD_JSON_OBJECT : CLD_JSON_ARRAY)) CLD_JSON_ERR("Mismatched end of object or array");
+            if (!(want == CLD_JSON_WANT_COMMA || (just_opened == 1 && want == (is_obj ? CLD_JSON_WANT_KEY : CLD_JSON_WANT_VALUE))))
+            {
+                CLD_JSON_ERR("Unexpected end of object or array");
+            }
+            j->tokens[cur].end = j->num_tokens;
+            cur = j->tokens[cur].parent;
+            want = (cur == -1 ? CLD_JSON_WANT_END : CLD_JSON_WANT_COMMA);
+            just_opened = 0;
+            p++;
+            continue;
+        }
+        if (c == ',')
+        {
+            if (want != CLD_JSON_WANT_COMMA) CLD_JSON_ERR("Unexpected comma");
+            want = (j->tokens[cur].type == CLD_JSON_OBJECT ? CLD_JSON_WANT_KEY : CLD_JSON_WANT_VALUE);
+            just_opened = 0;
+            p++;
+            continue;
+        }
+        if (c == ':')
+        {
+            if (want != CLD_JSON_WANT_COLON) CLD_JSON_ERR("Unexpected colon");
+            want = CLD_JSON_WANT_VALUE;
+            p++;
+            continue;
+        }
+        if (c == '"')
+        {
+            if (want != CLD_JSON_WANT_KEY && want != CLD_JSON_WANT_VALUE) CLD_JSON_ERR("Unexpected string");
+            char *r = p + 1;
+            char *w = p + 1;
+            if (cld_json_unescape (&r, &w) != 1)
+            {
+                p = r;
+                CLD_JSON_ERR("Malformed string");
+            }
+            *w = 0; // at worst this is the closing quote
+            cld_json_add_token (j, want == CLD_JSON_WANT_KEY ? CLD_JSON_KEY : CLD_JSON_STRING, p + 1, (int)(w - (p + 1)), cur);
+            want = (want == CLD_JSON_WANT_KEY ? CLD_JSON_WANT_COLON : (cur == -1 ? CLD_JSON_WANT_END : CLD_JSON_WANT_COMMA));
+            just_opened = 0;
+            p = r + 1;
+            continue;
+        }
+        // what's left are numbers and literals
+        if (want != CLD_JSON_WANT_VALUE) CLD_JSON_ERR("Unexpected value");
+        int type;
+        int vlen;
+        if (c == '-' || isdigit (c))
+        {
+            // a number is checked as it's read, since it's used as is (i.e. as a string) by the application
+            if ((vlen = cld_json_number (p)) == 0) CLD_JSON_ERR("Malformed number");
+            type = CLD_JSON_NUMBER;
+        }
+        else if (!strncmp (p, "true", 4)) { vlen = 4; type = CLD_JSON_BOOL; }
+        else if (!strncmp (p, "false", 5)) { vlen = 5; type = CLD_JSON_BOOL; }
+        else if (!strncmp (p, "null", 4)) { vlen = 4; type = CLD_JSON_NULL; }
+        else CLD_JSON_ERR("Unrecognized value");
+        if (p + vlen < past_end && strchr (",]} \t\r\n", p[vlen]) == NULL) CLD_JSON_ERR("Malformed value");
+        cld_json_add_token (j, type, p, vlen, cur);
+        want = (cur == -1 ? CLD_JSON_WANT_END : CLD_JSON_WANT_COMMA);
+        just_opened = 0;
+        p += vlen;
+    }
+    if (want != CLD_JSON_WANT_END) CLD_JSON_ERR("Unexpected end of JSON text");
+#undef CLD_JSON_ERR
+
+    // numbers and literals are zero-terminated only now, since the delimiters following them
+    // had to be seen by the tokenizer first
+    int t;
+    for (t = 0; t < j->num_tokens; t++)
+    {
+        int type = j->tokens[t].type;
+        if (type == CLD_JSON_NUMBER || type == CLD_JSON_BOOL || type == CLD_JSON_NULL) j->tokens[t].str[j->tokens[t].len] = 0;
+    }
+    return 1;
+}
+
+//
+// Find value in parsed JSON 'j' based on 'path', which is a list of keys separated by dots, with
+// array elements specified by index in brackets, for example "a.b[3]" or "[0].name". Empty path is the
+// top-level value. 'type' is the output type of value found (CLD_JSON_...), or CLD_JSON_NONE if not found. It
+// can be NULL.
+// Returns the value (for string, number, boolean and null), or "" if not found or if object or array.
+//
+char *cld_json_find (cld_json *j, const char *path, int *type)
+{
+    CLD_TRACE("");
+    assert (j);
+    assert (path);
+    if (type != NULL) *type = CLD_JSON_NONE;
+    if (j->num_tokens == 0) return CLD_EMPTY_STRING;
+
+    int t = 0; // start with top-level value
+    const char *p = path;
+    while (*p != 0)
+    {
+        if (*p == '.')
+        {
+            p++;
+            continue;
+        }
+        int end = j->tokens[t].end;
+        int i = t + 1;
+        if (*p == '[')
+        {
+            if (j->tokens[t].type != CLD_JSON_ARRAY) return CLD_EMPTY_STRING;
+            p++;
+            if (!isdigit (*p)) return CLD_EMPTY_STRING;
+            int ind = 0;
+            while (isdigit (*p)) ind = ind * 10 + (*p++ - '0');
+            if (*p++ != ']') return CLD_EMPTY_STRING;
+            // skip elements prior to the one we want, each element spans up to its 'end'
+            while (i < end && ind > 0)
+            {
+                i = j->tokens[i].end;
+                ind--;
+            }
+            if (i >= end) return CLD_EMPTY_STRING;
+            t = i;
+        }
+        else
+        {
+            if (j->tokens[t].type != CLD_JSON_OBJECT) return CLD_EMPTY_STRING;
+            int klen = (int)strcspn (p, ".[");
+            // members are key token followed by value token, and value spans up to its 'end'
+            while (i < end)
+            {
+                if (j->tokens[i].len == klen && !memcmp (j->tokens[i].str, p, klen)) break;
+                i = j->tokens[i + 1].end;
+            }
+            if (i >= end) return CLD_EMPTY_STRING;
+            t = i + 1;
+            p += klen;
+        }
+    }
+    if (type != NULL) *type = j->tokens[t].type;
+    if (j->tokens[t].type == CLD_JSON_OBJECT || j->tokens[t].type == CLD_JSON_ARRAY) return CLD_EMPTY_STRING;
+    return j->tokens[t].str;
+}
+
+//
+// Find value in JSON body of the current request (application/json POST), see cld_json_find() for 'path' and 'type'.
+// Body is parsed the first time this is called in a request. Since parsing is done in place, raw body (as obtained
+// with cld_get_body()) is not the same afterwards.
+// If there is no JSON body or it's not valid JSON, 'type' is CLD_JSON_INVALID.
+// Returns the value, or "" if not found.
+//
+char *cld_json_request_value (const char *path, int *type)
+{
+    CLD_TRACE("");
+    input_req *req = cld_get_config()->ctx.req;
+    if (req->json_status == 0)
+    {
+        req->json_status = -1;
+        if (req->body != NULL && cld_is_content_type (req->body_type, "application/json"))
+        {
+            req->json = (cld_json*)cld_malloc (sizeof (cld_json));
+            if (cld_json_parse (req->json, req->body, req->body_len) == 1) req->json_status = 1;
+            else
+            {
+                CLD_TRACE ("JSON body not valid [%s] at byte [%d]", req->json->error, req->json->error_pos);
+            }
+        }
+    }
+    if (req->json_status != 1)
+    {
+        if (type != NULL) *type = CLD_JSON_INVALID;
+        return CLD_EMPTY_STRING;
+    }
+    return cld_json_find (req->json, path, type);
+}
@@ -66,6 +66,22 @@ char *CLD_EMPTY_STRING="";
 static void **vmmem = NULL;
 static int vmmem_curr = 0;
 static int vmmem_tot = 0;
+static size_t vmmem_bytes = 0; // bytes currently allocated in this request
+static size_t vmmem_peak = 0; // most bytes allocated at any time in this request
+
+// resources not allocated here (such as a database result) that are released together with request memory,
+// each with the function that releases it (see cld_add_resource())
+typedef struct cld_resource_s
+{
+    void *res;
+    void (*release)(void *);
+} cld_resource;
+static cld_resource *vmres = NULL;
+static int vmres_curr = 0;
+static int vmres_tot = 0;
+
+// count bytes allocated or freed (if sz is negative) for peak memory usage of request
+#define CLD_MEM_COUNT(sz) do { vmmem_bytes += (sz); if (vmmem_bytes > vmmem_peak) vmmem_peak = vmmem_bytes; } while (0)
 
 // determines the size of the block allocated (and the size of consequent expansions) for the memory
 // block that keeps all pointers to allocated blocks.
@@ -85,6 +101,37 @@ void cld_memory_init ()
     vmmem = calloc (vmmem_tot = CLDMSIZE, sizeof (void*));
     if (vmmem == NULL) cld_report_error ("Out of memory");
     vmmem_curr = 0;
+    vmmem_bytes = 0;
+    vmmem_peak = 0;
+}
+
+// 
+// Returns the most memory (in bytes, including overhead) allocated at any time since the request started.
+//
+size_t cld_memory_peak ()
+{
+    return vmmem_peak;
+}
+
+// 
+// Add resource 'res' not allocated here, such as a database result, to be released with function 'release' when request
+// memory is freed (see cld_done()). This way, memory of such resource can be used directly for as long as request memory
+// can, without copying it.
+//
+void cld_add_resource (void *res, void (*release)(void *))
+{
+    if (vmres_curr >= vmres_tot)
+    {
+        vmres_tot += CLDMSIZE;
+        vmres = realloc (vmres, vmres_tot * sizeof (cld_resource));
+        if (vmres == NULL)
+        {
+            cld_report_error (cld_out_mem_mess, vmres_tot*sizeof(cld_resource));
+        }
+    }
+    vmres[vmres_curr].res = res;
+    vmres[vmres_curr].release = release;
+    vmres_curr++;
 }
 
 // 
@@ -149,6 +196,7 @@ CLD_MEMINLINE void *__cld_malloc(size_t size)
     }
     // set the byte to detect overwrites, here and elsewhere below
     ((unsigned char*)p)[t-1]=67;
+    CLD_MEM_COUNT(t);
     // add memory pointer to memory block
     int r = add_mem (p);
     // set underwrite detection bytes and index/size of the block
@@ -169,6 +217,7 @@ CLD_MEMINLINE void *__cld_calloc(size_t nmemb, size_t size)
     }
     memset (p, 0, t);
     ((unsigned char*)p)[t-1]=67;
+    CLD_MEM_COUNT(t);
     int r = add_mem (p);
     return vmset (p,r,t);
 }
@@ -281,7 +330,8 @@ CLD_MEMINLINE void *__cld_realloc(void *ptr, size_t size)
     {
         return __cld_malloc (size);
     }
-    int r = cld_check_memory(ptr, NULL);
+    int sz;
+    int r = cld_check_memory(ptr, &sz);
     vmmem[r] = NULL;
     void *p= realloc ((unsigned char*)ptr-CLDALIGN, t=size + CLDALIGN+1);
     if (p == NULL) 
@@ -289,6 +339,8 @@ CLD_MEMINLINE void *__cld_realloc(void *ptr, size_t size)
         cld_report_error (cld_out_mem_mess, size+CLDALIGN+1);
     }
     ((unsigned char*)p)[t-1]=67;
+    vmmem_bytes -= sz;
+    CLD_MEM_COUNT(t);
     r = add_mem(p);
     return vmset(p,r, t);
 }
@@ -303,8 +355,10 @@ CLD_MEMINLINE void __cld_free (void *ptr)
     // if programmer mistakenly frees up CLD_EMPTY_STRING, just ignore it
     //
     if (ptr == CLD_EMPTY_STRING || ptr == NULL) return;
-    int r = cld_check_memory(ptr, NULL);
+    int sz;
+    int r = cld_check_memory(ptr, &sz);
     vmmem[r] = NULL;
+    vmmem_bytes -= sz;
     free ((unsigned char*)ptr-CLDALIGN);
 }
 
@@ -332,6 +386,12 @@ CLD_MEMINLINE char *__cld_strdup (const char *s)
 //
 void cld_done ()
 {
+    // release resources in reverse order of adding them, in case a later one depends on an earlier one
+    while (vmres_curr > 0)
+    {
+        vmres_curr--;
+        vmres[vmres_curr].release (vmres[vmres_curr].res);
+    }
     if (vmmem != NULL)
     {
         int i;
@@ -0,0 +1,357 @@
+/*
+Copyright (c) 2017 DaSoftver LLC.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+
+//
+// Binary trace ring. Instead of formatting each trace line (time, vsnprintf, fprintf), in binary trace
+// mode a trace is a fixed size record in a per-process memory mapped file: a coarse monotonic timestamp,
+// the ID of trace site (file, line, function and format, stored once in the ring) and raw arguments. Records
+// are decoded later with cldtrace program, and the last few are written to backtrace file on crash.
+// Nothing here uses CLD memory, tracing or error reporting, so it can be linked with cldtrace as is.
+//
+
+#include "cld.h"
+#include <sys/mman.h>
+#include <stdint.h>
+
+// ring currently used in this process, for crash handler to dump the last records from
+cld_ring *cld_crash_ring = NULL;
+
+//  functions (local)
+unsigned short cld_ring_site_id (cld_ring *r, const char *from_file, int from_line, const char *from_fun, const char *format);
+
+
+//
+// Parse printf-like conversion specification that starts at 'p' (which points to '%').
+// Output 'kind' is the kind of argument it takes (CLD_FMT_*, CLD_FMT_NONE if bad), 'lmod' is
+// length modifier (CLD_FMT_L*) and 'stars' is the number of '*' (width/precision that are arguments too).
+// Returns the length of conversion specification.
+//
+int cld_fmt_conv (const char *p, int *kind, int *lmod, int *stars)
+{
+    const char *s = p + 1;
+    *kind = CLD_FMT_NONE;
+    *lmod = CLD_FMT_LNONE;
+    *stars = 0;
+
+    // flags, width, precision
+    while (*s != 0 && strchr ("-+ #0'", *s) != NULL) s++;
+    while (isdigit (*s) || *s == '*') { if (*s == '*') (*stars)++; s++; }
+    if (*s == '.')
+    {
+        s++;
+        while (isdigit (*s) || *s == '*') { if (*s == '*') (*stars)++; s++; }
+    }
+
+    // length modifier
+    if (s[0] == 'h' && s[1] == 'h') { *lmod = CLD_FMT_LHH; s += 2; }
+    else if (s[0] == 'h') { *lmod = CLD_FMT_LH; s++; }
+    else if (s[0] == 'l' && s[1] == 'l') { *lmod = CLD_FMT_LLL; s += 2; }
+    else if (s[0] == 'l') { *lmod = CLD_FMT_LL; s++; }
+    else if (s[0] == 'q') { *lmod = CLD_FMT_LLL; s++; }
+    else if (s[0] == 'z') { *lmod = CLD_FMT_LZ; s++; }
+    else if (s[0] == 'j') { *lmod = CLD_FMT_LJ; s++; }
+    else if (s[0] == 't') { *lmod = CLD_FMT_LT; s++; }
+    else if (s[0] == 'L') { *lmod = CLD_FMT_LLD; s++; }
+
+    switch (*s)
+    {
+        case 'd': case 'i': *kind = CLD_FMT_INT; break;
+        case 'u': case 'o': case 'x': case 'X': *kind = CLD_FMT_UINT; break;
+        case 'c': *kind = CLD_FMT_CHR; break;
+        case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A': *kind = CLD_FMT_DBL; break;
+        case 's': *kind = CLD_FMT_STR; break;
+        case 'p': *kind = CLD_FMT_PTR; break;
+        case 'n': *kind = CLD_FMT_N; break;
+        case '%': *kind = CLD_FMT_PCT; break;
+        default: return s - p; // bad or cut off conversion
+    }
+    return s - p + 1;
+}
+
+//
+// Open (create) binary trace ring in file 'fname' with 'num_records' records. Any previous
+// content of the file is discarded.
+// Returns the ring, or NULL if cannot create it.
+//
+cld_ring *cld_ring_open (const char *fname, int num_records)
+{
+    size_t size = sizeof (cld_ring) + (size_t)num_records * sizeof (cld_ring_rec);
+    int fd = open (fname, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (fd == -1) return NULL;
+    if (ftruncate (fd, size) != 0)
+    {
+        close (fd);
+        return NULL;
+    }
+    cld_ring *r = (cld_ring*) mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close (fd); // mapping stays
+    if (r == MAP_FAILED) return NULL;
+
+    // file is all zeros, so are all sites and records
+    memcpy (r->magic, CLD_RING_MAGIC, sizeof (r->magic));
+    r->pid = (int) getpid ();
+    r->num_records = num_records;
+    r->num_sites = CLD_RING_SITES;
+    r->rec_size = sizeof (cld_ring_rec);
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC_COARSE, &ts);
+    r->wall_sec = (long long) time (NULL);
+    r->mono_sec = (long long) ts.tv_sec;
+    r->mono_nsec = (int) ts.tv_nsec;
+    r->seq = 1;
+    return r;
+}
+
+//
+// Close binary trace ring 'r' opened with cld_ring_open(). The file stays for decoding.
+//
+void cld_ring_close (cld_ring *r)
+{
+    if (r == NULL) return;
+    if (cld_crash_ring == r) cld_crash_ring = NULL;
+    munmap (r, sizeof (cld_ring) + (size_t)r->num_records * sizeof (cld_ring_rec));
+}
+
+//
+// Find ID of trace site, i.e. its index in the sites of ring 'r'. Sites are found by hashing file name pointer
+// ('from_file', the same for all traces in a source file) and line 'from_line'. If site isn't there yet, it is added
+// with function 'from_fun' and 'format'.
+// Returns site ID, or CLD_RING_NO_SITE if there's no more room.
+//
+unsigned short cld_ring_site_id (cld_ring *r, const char *from_file, int from_line, const char *from_fun, const char *format)
+{
+    unsigned int h = ((unsigned int)((uintptr_t)from_file >> 3) ^ ((unsigned int)from_line * 2654435761U)) % CLD_RING_SITES;
+    int i;
+    for (i = 0; i < CLD_RING_SITES; i++)
+    {
+        cld_ring_site *s = &(r->site[h]);
+        if (s->key == from_file && s->line == from_line) return (unsigned short)h;
+        if (s->key == NULL)
+        {
+            // new site, keep the end of file name if too long
+            int flen = strlen (from_file);
+            const char *f = flen >= (int)sizeof (s->file) ? from_file + flen - (sizeof (s->file) - 1) : from_file;
+            snprintf (s->file, sizeof (s->file), "%s", f);
+            snprintf (s->fun, sizeof (s->fun), "%s", from_fun);
+            snprintf (s->fmt, sizeof (s->fmt), "%s", format);
+            s->line = from_line;
+            s->key = from_file;
+            return (unsigned short)h;
+        }
+        h = (h + 1) % CLD_RING_SITES;
+    }
+    return CLD_RING_NO_SITE;
+}
+
+//
+// Write trace record to ring 'r'. 'from_file', 'from_line', 'from_fun' is the trace site, 'format' and 'args' are
+// printf-like format and arguments, which are stored raw (numbers and pointers as 8 bytes, strings as 2 bytes of
+// length followed by as many bytes as fit) and not formatted.
+//
+void cld_ring_trace (cld_ring *r, const char *from_file, int from_line, const char *from_fun, const char *format, va_list args)
+{
+    unsigned long long seq = r->seq++;
+    cld_ring_rec *rec = &(r->rec[(seq - 1) % r->num_records]);
+    rec->seq = 0; // record is incomplete until seq is set at the end
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC_COARSE, &ts);
+    rec->sec = (long long) ts.tv_sec;
+    rec->nsec = (int) ts.tv_nsec;
+    rec->site = cld_ring_site_id (r, from_file, from_line, from_fun, format);
+
+    int len = 0;
+    int trunc = 0;
+    const char *p = format;
+    while ((p = strchr (p, '%')) != NULL && trunc == 0)
+    {
+        int kind, lmod, stars;
+        p += cld_fmt_conv (p, &kind, &lmod, &stars);
+        if (kind == CLD_FMT_NONE) break; // format is bad from here on, nothing can be read reliably
+        long long v = 0;
+        int is_num = 1;
+        for (; stars > 0 && trunc == 0; stars--)
+        {
+            v = (long long) va_arg (args, int);
+            if (len + 8 > CLD_RING_ARGS) trunc = 1; else { memcpy (rec->args + len, &v, 8); len += 8; }
+        }
+        if (trunc == 1) break;
+        switch (kind)
+        {
+            case CLD_FMT_INT:
+                if (lmod == CLD_FMT_LLL) v = va_arg (args, long long);
+                else if (lmod == CLD_FMT_LL || lmod == CLD_FMT_LZ || lmod == CLD_FMT_LT) v = (long long) va_arg (args, long);
+                else if (lmod == CLD_FMT_LJ) v = (long long) va_arg (args, intmax_t);
+                else if (lmod == CLD_FMT_LHH) v = (long long)(signed char) va_arg (args, int);
+                else if (lmod == CLD_FMT_LH) v = (long long)(short) va_arg (args, int);
+                else v = (long long) va_arg (args, int);
+                break;
+            case CLD_FMT_UINT:
+                if (lmod == CLD_FMT_LLL) v = (long long) va_arg (args, unsigned long long);
+                else if (lmod == CLD_FMT_LL || lmod == CLD_FMT_LZ || lmod == CLD_FMT_LT) v = (long long) va_arg (args, unsigned long);
+                else if (lmod == CLD_FMT_LJ) v = (long long) va_arg (args, uintmax_t);
+                else if (lmod == CLD_FMT_LHH) v = (long long)(unsigned char) va_arg (args, unsigned int);
+                else if (lmod == CLD_FMT_LH) v = (long long)(unsigned short) va_arg (args, unsigned int);
+                else v = (long long) va_arg (args, unsigned int);
+                break;
+            case CLD_FMT_CHR:
+                v = (long long) va_arg (args, int);
+                break;
+            case CLD_FMT_DBL:
+            {
+                double d = (lmod == CLD_FMT_LLD ? (double) va_arg (args, long double) : va_arg (args, double));
+                memcpy (&v, &d, 8);
+                break;
+            }
+            case CLD_FMT_PTR:
+                v = (long long)(uintptr_t) va_arg (args, void*);
+                break;
+            case CLD_FMT_N:
+                va_arg (args, void*); // nothing is written back
+                is_num = 0;
+                break;
+            case CLD_FMT_PCT:
+                is_num = 0;
+                break;
+            case CLD_FMT_STR:
+            {
+                const char *str = va_arg (args, const char*);
+                if (str == NULL) str = "(null)";
+                if (len + 2 > CLD_RING_ARGS) { trunc = 1; break; }
+                int slen = strlen (str);
+                if (slen > CLD_RING_ARGS - len - 2)
+                {
+                    slen = CLD_RING_ARGS - len - 2;
+                    trunc = 1;
+                }
+                unsigned short l = (unsigned short)slen;
+                memcpy (rec->args + len, &l, 2);
+                memcpy (rec->args + len + 2, str, slen);
+                len += 2 + slen;
+                is_num = 0;
+                break;
+            }
+        }
+        if (is_num == 1 && trunc == 0)
+        {
+            if (len + 8 > CLD_RING_ARGS) trunc = 1; else { memcpy (rec->args + len, &v, 8); len += 8; }
+        }
+    }
+    rec->len = (unsigned short)len | (trunc == 1 ? CLD_RING_TRUNCATED : 0);
+    rec->seq = seq;
+}
+
+//
+// Render trace record 'rec' from ring 'r' as text into 'out' of size 'out_len', by using the format of its site
+// and the raw arguments stored. If arguments were truncated, text ends with '...'.
+// Returns the length of text.
+//
+int cld_ring_render (const cld_ring *r, const cld_ring_rec *rec, char *out, int out_len)
+{
+    if (out_len <= 0) return 0;
+    out[0] = 0;
+    if (rec->site >= r->num_sites)
+    {
+        return snprintf (out, out_len, "(unknown trace site)");
+    }
+    const char *p = r->site[rec->site].fmt;
+    int len = rec->len & ~CLD_RING_TRUNCATED;
+    int apos = 0;
+    int olen = 0;
+    char spec[64];
+    char sbuf[CLD_RING_ARGS + 1];
+    int done = 0;
+
+#define CLD_RING_OUT(...) { int w = snprintf (out + olen, out_len - olen, __VA_ARGS__); if (w > 0) olen += w; if (olen >= out_len) { olen = out_len - 1; done = 1; } }
+#define CLD_RING_ARG(v) { if (apos + 8 > len) { done = 2; break; } memcpy (&(v), rec->args + apos, 8); apos += 8; }
+
+    while (*p != 0 && done == 0)
+    {
+        if (*p != '%')
+        {
+            const char *n = strchr (p, '%');
+            int l = (n == NULL ? (int)strlen (p) : n - p);
+            CLD_RING_OUT ("%.*s", l, p);
+            p += l;
+            continue;
+        }
+        int kind, lmod, stars;
+        int clen = cld_fmt_conv (p, &kind, &lmod, &stars);
+        if (kind == CLD_FMT_NONE || clen >= (int)sizeof (spec) - 24)
+        {
+            CLD_RING_OUT ("%.*s", clen, p);
+            p += clen;
+            continue;
+        }
+        // build conversion without length modifier and with '*' replaced with the values stored
+        int slen = 0;
+        int i;
+        for (i = 0; i < clen - 1 && done == 0; i++)
+        {
+            char c = p[i];
+            if (c == '*')
+            {
+                long long w;
+                CLD_RING_ARG (w);
+                slen += snprintf (spec + slen, sizeof (spec) - slen, "%d", (int)w);
+            }
+            else if (i > 0 && strchr ("hlqzjtL", c) != NULL) continue;
+            else spec[slen++] = c;
+        }
+        if (done != 0) break;
+        if (kind == CLD_FMT_INT || kind == CLD_FMT_UINT) { spec[slen++] = 'l'; spec[slen++] = 'l'; }
+        spec[slen++] = p[clen - 1];
+        spec[slen] = 0;
+        p += clen;
+
+        long long v = 0;
+        switch (kind)
+        {
+            case CLD_FMT_INT: CLD_RING_ARG (v); CLD_RING_OUT (spec, v); break;
+            case CLD_FMT_UINT: CLD_RING_ARG (v); CLD_RING_OUT (spec, (unsigned long long)v); break;
+            case CLD_FMT_CHR: CLD_RING_ARG (v); CLD_RING_OUT (spec, (int)v); break;
+            case CLD_FMT_PTR: CLD_RING_ARG (v); CLD_RING_OUT (spec, (void*)(uintptr_t)v); break;
+            case CLD_FMT_DBL:
+            {
+                double d;
+                CLD_RING_ARG (v);
+                memcpy (&d, &v, 8);
+                CLD_RING_OUT (spec, d);
+                break;
+            }
+            case CLD_FMT_STR:
+            {
+                unsigned short l;
+                if (apos + 2 > len) { done = 2; break; }
+                memcpy (&l, rec->args + apos, 2);
+                if (apos + 2 + l > len) { done = 2; break; }
+                memcpy (sbuf, rec->args + apos + 2, l);
+                sbuf[l] = 0;
+                apos += 2 + l;
+                CLD_RING_OUT (spec, sbuf);
+                // if string was cut, nothing after it was stored
+                if (apos >= len && (rec->len & CLD_RING_TRUNCATED) != 0) done = 2;
+                break;
+            }
+            case CLD_FMT_PCT: CLD_RING_OUT ("%%"); break;
+            default: break; // %n
+        }
+    }
+    if (done == 2 || (rec->len & CLD_RING_TRUNCATED) != 0) CLD_RING_OUT ("...");
+#undef CLD_RING_OUT
+#undef CLD_RING_ARG
+    return olen;
+}
@@ -27,8 +27,10 @@ You may obtain a copy of the License at
 void cld_init_url_response(cld_url_response *s);
 size_t cld_write_url_response(void *ptr, size_t size, size_t nmemb, cld_url_response *s);
 FILE * cld_create_file_path (char *doc_id, char *path, int path_len);
+void cld_reserve_document_ids (int block);
 void cld_init_output_buffer ();
 int cld_validate_output ();
+int cld_url_stream_chunk (void *arg, const char *data, int len);
 
 
 // 
@@ -60,6 +62,11 @@ void cld_init_input_req (input_req *req)
     req->url = NULL;
     req->is_shut = 0;
     req->header=NULL; // no custom headers, set to non-NULL for custom headers
+    req->body = NULL;
+    req->body_len = 0;
+    req->body_type = NULL;
+    req->json = NULL;
+    req->json_status = 0;
 }
 
 // 
@@ -143,9 +150,35 @@ void cld_write_to_string (char **str)
 
 
 
+// 
+// Process-wide cache of debug file and the trace file, one per trace directory (since more than one application
+// can run in the same process). It is allocated with malloc(), outside of request memory, so it lives for as long as the
+// process does. Trace file stays open across requests and is rotated when it grows over max_trace_size.
+//
+typedef struct cld_debug_cache_s
+{
+    char *log_directory; // trace directory where debug file is
+    time_t mtime; // modification time of debug file when it was read, 0 if there was no debug file
+    off_t size; // size of debug file when it was read
+    time_t checked; // last time we checked if debug file changed
+    debug_app debug; // debug options read from debug file
+    FILE *trace_f; // trace file open across requests, NULL if not tracing
+    int timing_fd; // timing log open across requests, -1 if not logging timing
+    int slow_fd; // slow query log open across requests, -1 if not logging slow queries
+    char trace_fname[300]; // name of trace file
+    cld_ring *ring; // binary trace ring, NULL if not tracing in binary mode
+    struct cld_debug_cache_s *next; // next application's debug options
+} cld_debug_cache;
+static cld_debug_cache *cld_debug = NULL;
+static cld_debug_cache *cld_debug_curr = NULL; // debug options for the current request
+
 // 
 // Open trace file and write begin-trace message
 // Returns 0 if opened, -1 if not
+// Trace file is opened once and stays open across requests (see cld_get_debug_options()), so this only opens
+// a new one if there isn't one yet, or if the current one grew over max_trace_size (in which case it's rotated, i.e.
+// closed and a new one with current time in its name is opened). If tracing is turned off, trace file is closed.
+// In binary trace mode, trace goes to a memory mapped ring (ring-<pid> in trace directory) instead, see cldring.c.
 // Any memory alloc here MUST be malloc since it survives apache mod requests and continues
 // over many such requests.
 //
@@ -153,50 +186,191 @@ int cld_open_trace ()
 {
     cld_config *pc = cld_get_config();
 
-    // open trace file, for Apache mod, it will not be NULL (from previous request)
-    if (pc->trace.f != NULL)
-    {
-        fclose (pc->trace.f);
-        pc->trace.f = NULL;
-    }
-
+    pc->trace.f = NULL;
+    pc->trace.ring = NULL;
 
     // get time in any case, because we use it for save_HTML()
     // this is done ONLY ONCE per request
     cld_current_time (pc->trace.time, sizeof(pc->trace.time)-1);
+
+    cld_debug_cache *c = cld_debug_curr;
+    if (c == NULL || strcmp (c->log_directory, pc->app.log_directory)) return -1; // no debug options for this application yet
+
+    if (pc->debug.trace_level > 0 && pc->debug.trace_binary == 1)
+    {
+        if (c->trace_f != NULL)
+        {
+            fclose (c->trace_f);
+            c->trace_f = NULL;
+        }
+        if (c->ring != NULL && c->ring->num_records != pc->debug.trace_records)
+        {
+            // ring size changed, start anew
+            cld_ring_close (c->ring);
+            c->ring = NULL;
+        }
+        if (c->ring == NULL)
+        {
+            char ring_name[300];
+            snprintf(ring_name, sizeof(ring_name), "%s/ring-%d", pc->app.log_directory, cld_getpid());
+            c->ring = cld_ring_open (ring_name, pc->debug.trace_records);
+            if (c->ring == NULL) return -1;
+        }
+        cld_crash_ring = c->ring;
+        pc->trace.ring = c->ring;
+        return 0;
+    }
+    if (c->ring != NULL)
+    {
+        // binary tracing was turned off
+        cld_ring_close (c->ring);
+        c->ring = NULL;
+    }
+
     if (pc->debug.trace_level > 0)
     {
-        // append if file exists, otherwise open anew
-        snprintf(pc->trace.fname, sizeof(pc->trace.fname), "%s/trace-%d-%s", pc->app.log_directory, cld_getpid(), pc->trace.time);
-        pc->trace.f = fopen (pc->trace.fname, "a+");
-        if (pc->trace.f == NULL) 
+        if (c->trace_f != NULL && ftell (c->trace_f) >= pc->debug.max_trace_size)
+        {
+            // rotate trace file
+            fclose (c->trace_f);
+            c->trace_f = NULL;
+        }
+        if (c->trace_f == NULL)
         {
-            pc->trace.f = fopen (pc->trace.fname, "w+");
-            if (pc->trace.f == NULL)
+            // append if file exists, otherwise open anew
+            snprintf(c->trace_fname, sizeof(c->trace_fname), "%s/trace-%d-%s", pc->app.log_directory, cld_getpid(), pc->trace.time);
+            c->trace_f = fopen (c->trace_fname, "a+");
+            if (c->trace_f == NULL) 
             {
-                return -1; 
+                c->trace_f = fopen (c->trace_fname, "w+");
+                if (c->trace_f == NULL)
+                {
+                    return -1; 
+                }
             }
         }
+        pc->trace.f = c->trace_f;
+        memcpy (pc->trace.fname, c->trace_fname, sizeof (pc->trace.fname));
+    }
+    else if (c->trace_f != NULL)
+    {
+        // tracing was turned off
+        fclose (c->trace_f);
+        c->trace_f = NULL;
     }
     return 0;
 }
 
 // 
-// Close trace file
+// Close trace file for this request. Trace file actually stays open for the next request (see cld_open_trace()),
+// this just flushes it.
 //
 void cld_close_trace()
 {
     cld_config *pc = cld_get_config();
 
-    // close trace file
     if (pc->trace.f != NULL)
     {
-        fclose (pc->trace.f);
+        fflush (pc->trace.f);
     }
     pc->trace.f = NULL;
     return;
 }    
 
+// 
+// Returns query string of request for timing and slow query logs, as a space followed by the quoted query string
+// (up to 800 bytes), or empty string. Query string can have passwords, tokens or personal data, so it's only 
+// logged if 'logquerystring' is 1 in debug file.
+//
+const char *cld_log_query_string ()
+{
+    cld_config *pc = cld_get_config();
+    if (pc->debug.log_query_string != 1) return "";
+    static char qs[820];
+    snprintf (qs, sizeof (qs), " \"%.800s\"", cld_ctx_getenv ("QUERY_STRING"));
+    return qs;
+}
+
+// 
+// Finish measuring time spent in phases of request. The summary is set as 'cld-timing' note in web server's request 
+// (so it can be logged with %{cld-timing}n in LogFormat), and if 'timing' is 1 in debug file, it's also written as a line 
+// in 'timing.log' in trace directory. Times are in microseconds. Timing log is opened once and stays open across requests.
+//
+void cld_timing_done ()
+{
+    cld_config *pc = cld_get_config();
+    if (pc->timing.start.tv_sec == 0) return;
+    cld_timing_phase (CLD_PHASE_SHUT);
+
+    long long total = cld_timing_us (&(pc->timing.start), &(pc->timing.last));
+    char summary[300];
+    snprintf (summary, sizeof (summary), "total=%lld boot=%lld input=%lld db=%lld queries=%d handler=%lld flush=%lld shut=%lld mem=%lu",
+        total, pc->timing.phase[CLD_PHASE_BOOT], pc->timing.phase[CLD_PHASE_INPUT],
+        pc->timing.phase[CLD_PHASE_DB], pc->timing.queries, pc->timing.phase[CLD_PHASE_HANDLER], pc->timing.phase[CLD_PHASE_FLUSH],
+        pc->timing.phase[CLD_PHASE_SHUT], (unsigned long)cld_memory_peak());
+    CLD_TRACE ("Timing: %s", summary);
+#ifdef AMOD
+    if (pc->ctx.apa != NULL) 
+    {
+        cld_ws_set_note (pc->ctx.apa, "cld-timing", summary);
+        // request rate, latency, queries and memory for metrics endpoint (see mod_cld.c)
+        cld_ws_metrics (pc->ctx.apa, total, pc->timing.queries, cld_memory_peak());
+    }
+#endif
+
+    cld_debug_cache *c = cld_debug_curr;
+    if (c == NULL || strcmp (c->log_directory, pc->app.log_directory)) return;
+    if (pc->debug.timing != 1)
+    {
+        if (c->timing_fd != -1)
+        {
+            close (c->timing_fd);
+            c->timing_fd = -1;
+        }
+        return;
+    }
+    if (c->timing_fd == -1)
+    {
+        char timing_file[300];
+        snprintf (timing_file, sizeof (timing_file), "%s/timing.log", pc->app.log_directory);
+        c->timing_fd = open (timing_file, O_WRONLY | O_CREAT | O_APPEND, S_IRUSR | S_IWUSR);
+        if (c->timing_fd == -1) return;
+    }
+
+    // one write() per line, so lines from different processes appending to the same file don't mix
+    char line[1200];
+    int len = snprintf (line, sizeof (line), "%s %d %s%s %s\n", pc->trace.time, cld_getpid(), cld_ctx_getenv ("REQUEST_METHOD"),
+        cld_log_query_string (), summary);
+    if (len >= (int)sizeof (line)) len = sizeof (line) - 1;
+    if (write (c->timing_fd, line, len) != len) CLD_TRACE ("Cannot write timing log, error [%s]", strerror (errno));
+}
+
+// 
+// Write statement that took 'us' microseconds to execute to 'slowquery.log' in trace directory (see cld_slow_stmt_done()). 
+// The line has the source 'file' and 'line' of the query, its 'name', the time, 'rows' and 'bytes' it returned (or affected rows),
+// and the request method and path. Slow query log is opened once and stays open across requests.
+//
+void cld_write_slow_query (const char *file, int line, const char *name, long long us, long long rows, long long bytes)
+{
+    cld_config *pc = cld_get_config();
+    cld_debug_cache *c = cld_debug_curr;
+    if (c == NULL || strcmp (c->log_directory, pc->app.log_directory)) return;
+    if (c->slow_fd == -1)
+    {
+        char slow_file[300];
+        snprintf (slow_file, sizeof (slow_file), "%s/slowquery.log", pc->app.log_directory);
+        c->slow_fd = open (slow_file, O_WRONLY | O_CREAT | O_APPEND, S_IRUSR | S_IWUSR);
+        if (c->slow_fd == -1) return;
+    }
+
+    // one write() per line, same as timing log
+    char text[1500];
+    int len = snprintf (text, sizeof (text), "%s %d %s:%d %s us=%lld rows=%lld bytes=%lld %s %.300s%s\n", pc->trace.time, cld_getpid(), 
+        file, line, name, us, rows, bytes, cld_ctx_getenv ("REQUEST_METHOD"), cld_ctx_getenv ("SCRIPT_NAME"), cld_log_query_string ());
+    if (len >= (int)sizeof (text)) len = sizeof (text) - 1;
+    if (write (c->slow_fd, text, len) != len) CLD_TRACE ("Cannot write slow query log, error [%s]", strerror (errno));
+}
+
 
 
 // 
@@ -254,7 +428,7 @@ void cld_make_SQL (char *dest, int destSize, int num_of_args, const char *format
 
     memcpy (dest, format, flen + 1);
 
-    char curr_sql_arg[CLD_MAX_SIZE_OF_URL + 1];
+    char *curr_sql_arg;
 
     // All %s must be quoted, otherwise in select ... where id=%s, it could be made to be
     // select ... where id=2;drop table x; if input parameters is id=2;drop table x;
@@ -288,17 +462,22 @@ void cld_make_SQL (char *dest, int destSize, int num_of_args, const char *format
         {
             cld_report_error ("Too many non-NULL input parameters in input parameter list for SQL statement [%s], expected [%d] non-NULL run-time arguments", format, count_percents);
         }
-        strncpy (curr_sql_arg, curr_input, sizeof (curr_sql_arg) - 1);
+        // argument is copied into memory sized for the worst case, where each byte is a quote or a backslash 
+        // and is doubled when escaped, so there is no fixed limit on the size of an argument other than that of SQL text
+        int arg_len = strlen (curr_input);
+        int arg_size = 2 * arg_len + 1;
+        curr_sql_arg = (char*)cld_malloc (arg_size + 1);
+        memcpy (curr_sql_arg, curr_input, arg_len + 1);
         // Escape: single quote and escape backslash in an single quote string
         // Some parameters might not be quoted, and we will catch that as an erro
         // (in db numbers can be quoted)
 
-        if (cld_replace_string (curr_sql_arg, sizeof (curr_sql_arg) - 1, "\\", "\\\\", 1, NULL) == -1)
+        if (cld_replace_string (curr_sql_arg, arg_size, "\\", "\\\\", 1, NULL) == -1)
         {
             va_end (vl);
             cld_report_error ("Argument #%d too large for SQL format [%s], argument [%.100s]", i, format, curr_sql_arg);
         }
-        if (cld_replace_string (curr_sql_arg, sizeof (curr_sql_arg) - 1, "'", "''", 1, NULL) == -1)
+        if (cld_replace_string (curr_sql_arg, arg_size, "'", "''", 1, NULL) == -1)
         {
             va_end (vl);
             cld_report_error ("Argument #%d too large for SQL format [%s], argument [%.100s]", i, format, curr_sql_arg);
@@ -329,6 +508,7 @@ void cld_make_SQL (char *dest, int destSize, int num_of_args, const char *format
             va_end (vl);
             cld_report_error ("SQL too large, format [%s], argument [%.100s]", format, curr_sql_arg);
         }
+        cld_free (curr_sql_arg);
     }
 
     // make sure number of non-NULL input params isn't lesser than what's expected at run-time
@@ -1082,14 +1262,70 @@ FILE *cld_create_file_path (char *doc_id, char *path, int path_len)
     return f;
 }
 
+// 
+// Reserve 'block' document ids for this process with a single statement. The row inserted into cldDocumentIDGenerator 
+// has the last id in the block, and the ids before it (down to the previous largest id) belong to this process. 
+// Auto increment of the table moves past it, so ids obtained one by one (see cld_get_document_id()) are always
+// different. If another process inserts the same row at the same time, or reserving deadlocks with it, the next 
+// block is tried. Reserved ids are in CTX.db.doc_ids, which belongs to the application, since each may use a different
+// database.
+//
+void cld_reserve_document_ids (int block)
+{
+    CLD_TRACE("");
+    int nrow;
+    unsigned int er = 0;
+    const char *errm="";
+
+    char reserve[300];
+    snprintf (reserve, sizeof (reserve), "insert into cldDocumentIDGenerator (id) select last_insert_id(coalesce(max(id),0)+%d) from cldDocumentIDGenerator", block);
+    int i;
+    for (i = 0; i < CLD_DOC_ID_TRIES; i++)
+    {
+        if (cld_execute_SQL (reserve, &nrow, &er, &errm) == 1) break;
+        if (er != ER_DUP_ENTRY && er != ER_LOCK_DEADLOCK)
+        {
+            cld_report_error ("Cannot reserve document ids, error [%d], error message [%s]", er, errm);
+        }
+    }
+    if (i == CLD_DOC_ID_TRIES)
+    {
+        cld_report_error ("Cannot reserve document ids after [%d] tries, error [%d], error message [%s]", i, er, errm);
+    }
+
+    char last[30];
+    cld_get_insert_id (last, sizeof (last));
+    cld_doc_ids *ids = CTX.db.doc_ids;
+    ids->last = atoll (last);
+    ids->next = ids->last - block + 1;
+    CLD_TRACE ("Reserved document ids [%lld] to [%lld]", ids->next, ids->last);
+}
+
 // 
 // Get new document id from a table cldDocumentIDGenerator (which must be created prior 
 // to using here). doc_id is the output buffer for document id, and the length of this
-// buffer is doc_id_len.
+// buffer is doc_id_len. If doc_id_block in config file is greater than 1, ids are reserved
+// that many at a time (see cld_reserve_document_ids()) and given out by this process without
+// going to database. 
 //
 void cld_get_document_id (char *doc_id, int doc_id_len)
 {
     CLD_TRACE("");
+    // a block isn't reserved in a transaction, since if it's rolled back, another process could reserve the same ids
+    int block = cld_get_config ()->app.doc_id_block;
+    cld_doc_ids *ids = CTX.db.doc_ids;
+    if (ids != NULL && block > 1 && ids->next > ids->last && *(CTX.db.is_begin_transaction) == 0) cld_reserve_document_ids (block);
+    if (ids != NULL && ids->next <= ids->last)
+    {
+        int sz = snprintf (doc_id, doc_id_len - 1, "%lld", ids->next);
+        if (sz >= doc_id_len - 1)
+        {
+            cld_report_error("Buffer too small for document id [%d]", sz);
+        }
+        ids->next++;
+        return;
+    }
+
     int nrow;
     unsigned int er;
     const char *errm="";
@@ -1247,6 +1483,7 @@ int cld_get_input(input_req *req, const char *method, const char *input)
     int text_len = 0; // length just for text inputs
 
     int is_multipart = 0;
+    int is_decoded = 0; // 1 if input was url-decoded while being read
 
     CLD_TRACE ("Request Method: %s", req_method);
     if (!strcasecmp(req_method, "GET"))
@@ -1290,8 +1527,11 @@ int cld_get_input(input_req *req, const char *method, const char *input)
                 is_multipart = 1;
             }
         }
-        if (cont_type != NULL && (!strcasecmp (cont_type, 
-            "application/x-www-form-urlencoded") || is_multipart == 1))
+        // url-encoded body is parsed for input parameters, while json and octet-stream bodies are made available 
+        // as they are (see cld_get_body()), with input parameters taken from the query string
+        int is_urlencoded = cld_is_content_type (cont_type, "application/x-www-form-urlencoded");
+        int is_raw = cld_is_content_type (cont_type, "application/json") || cld_is_content_type (cont_type, "application/octet-stream");
+        if (cont_type != NULL && (is_urlencoded == 1 || is_multipart == 1 || is_raw == 1))
         {
             // size of input data
             cont_len = cld_ctx_getenv ("CONTENT_LENGTH");
@@ -1314,15 +1554,37 @@ int cld_get_input(input_req *req, const char *method, const char *input)
             }
             else
             {
-                if (post_len >= CLD_MAX_SIZE_OF_URL)
+                if (post_len >= pc->app.max_body_size)
                 {
-                    cld_report_error ("Web input larger than the limit of [%d] bytes (1)", CLD_MAX_SIZE_OF_URL);
+                    cld_report_error ("Web input larger than the limit of [%ld] bytes (1)", pc->app.max_body_size);
                 }
             }
             content = (char*)cld_malloc (text_len = (post_len + 2));
             // get input data
 #ifdef AMOD
-            if (cld_ws_util_read (pc->ctx.apa, content, post_len) != 1)
+            if (is_urlencoded == 1 && post_len >= CLD_MAX_SIZE_OF_URL)
+            {
+                // large url-encoded body is decoded as it's read, so it isn't read and then copied and decoded again.
+                // Decoded data is never longer than encoded, so 'content' (sized from content length) holds it,
+                // which means memory used is still about the size of the body, only the raw copy is avoided
+                cld_url_stream us;
+                us.dest = content;
+                us.pos = 0;
+                us.hex_pending = 0;
+                us.hex_val = 0;
+                us.had_equal = 0;
+                us.num_of_input_params = 0;
+                char *chunk = (char*)cld_malloc (CLD_POST_CHUNK);
+                if (cld_ws_util_read_stream (pc->ctx.apa, chunk, CLD_POST_CHUNK, cld_url_stream_chunk, &us) != 1)
+                {
+                    cld_report_error ("Error reading input data from POST");
+                }
+                cld_free (chunk);
+                req->ip.num_of_input_params = us.num_of_input_params;
+                post_len = us.pos;
+                is_decoded = 1;
+            }
+            else if (cld_ws_util_read (pc->ctx.apa, content, post_len) != 1)
             {
                 cld_report_error ("Error reading input data from POST");
             }
@@ -1338,6 +1600,23 @@ int cld_get_input(input_req *req, const char *method, const char *input)
 #endif
             content [post_len] = content[post_len+1] = 0;
 
+            if (is_raw == 1)
+            {
+                // raw body is kept as read, and input parameters come from the query string, same as with GET
+                req->body = content;
+                req->body_len = post_len;
+                req->body_type = cont_type;
+                qry = cld_ctx_getenv ("QUERY_STRING");
+                if (qry == NULL)
+                {
+                    content = (char*)cld_calloc (text_len = 2, sizeof(char));
+                }
+                else
+                {
+                    content = (char*)cld_calloc (text_len = (strlen (qry) + 2), sizeof (char));
+                    strcpy (content, qry);
+                }
+            }
         }
         else
         {
@@ -1353,7 +1632,8 @@ int cld_get_input(input_req *req, const char *method, const char *input)
 
     if (is_multipart == 1)
     {
-        char *new_cont = (char*)cld_malloc (CLD_MAX_SIZE_OF_URL + 1);
+        int max_cont = (int)pc->app.max_body_size;
+        char *new_cont = (char*)cld_malloc (max_cont + 1);
         int new_cont_ptr = 0;
 
         // Based on RVM2045 (MIME types) and RVM1867 (file upload in html form)
@@ -1507,11 +1787,11 @@ int cld_get_input(input_req *req, const char *method, const char *input)
             enc = NULL;
             // name of attachment input parameter
             cld_encode (CLD_URL, name_val, &enc);
-            int would_write = snprintf (new_cont + new_cont_ptr, avail = CLD_MAX_SIZE_OF_URL - new_cont_ptr - 2, "%s=%s&", name, enc);
+            int would_write = snprintf (new_cont + new_cont_ptr, avail = max_cont - new_cont_ptr - 2, "%s=%s&", name, enc);
             cld_free (enc);
             if (would_write >= avail)
             {
-                cld_report_error ("Web input larger than the limit of [%d] bytes (2)", CLD_MAX_SIZE_OF_URL);
+                cld_report_error ("Web input larger than the limit of [%d] bytes (2)", max_cont);
             }
             new_cont_ptr += would_write;
             if (file_name[0] != 0)
@@ -1519,11 +1799,11 @@ int cld_get_input(input_req *req, const char *method, const char *input)
                 // provide original (client) file name
                 enc = NULL;
                 cld_encode (CLD_URL, file_name, &enc);
-                int would_write = snprintf (new_cont + new_cont_ptr, avail = CLD_MAX_SIZE_OF_URL - new_cont_ptr - 2, "%s_filename=%s&", name, enc);
+                int would_write = snprintf (new_cont + new_cont_ptr, avail = max_cont - new_cont_ptr - 2, "%s_filename=%s&", name, enc);
                 cld_free (enc);
                 if (would_write  >= avail)
                 {
-                    cld_report_error ("Web input larger than the limit of [%d] bytes (3)", CLD_MAX_SIZE_OF_URL);
+                    cld_report_error ("Web input larger than the limit of [%d] bytes (3)", max_cont);
                 }
                 new_cont_ptr += would_write;
             }
@@ -1558,8 +1838,17 @@ int cld_get_input(input_req *req, const char *method, const char *input)
                     char write_dir[1024 + 1];
                     FILE *f = cld_make_document (&doc_id, write_dir, sizeof (write_dir)-1);
 
-                    // write the actual uploaded file contents to local file
-                    if (fwrite(cont_type, cont_type_len, 1, f) != 1)
+                    // write the actual uploaded file contents to local file, hashing it on the way if asked for
+                    char sha[2*SHA256_DIGEST_LENGTH + 1];
+                    sha[0] = 0;
+                    if (pc->app.upload_hash == 1)
+                    {
+                        if (cld_write_sha (f, cont_type, cont_type_len, sha) != 1)
+                        {
+                            cld_report_error ("Cannot write file [%s], error [%s]", write_dir, strerror (errno));
+                        }
+                    }
+                    else if (fwrite(cont_type, cont_type_len, 1, f) != 1)
                     {
                         cld_report_error ("Cannot write file [%s], error [%s]", write_dir, strerror (errno));
                     }
@@ -1568,47 +1857,58 @@ int cld_get_input(input_req *req, const char *method, const char *input)
                     // provide location where file is actually stored on server
                     enc = NULL;
                     cld_encode (CLD_URL, write_dir, &enc);
-                    int would_write = snprintf (new_cont + new_cont_ptr, avail = CLD_MAX_SIZE_OF_URL - new_cont_ptr - 2, "%s_location=%s&", name, enc);
+                    int would_write = snprintf (new_cont + new_cont_ptr, avail = max_cont - new_cont_ptr - 2, "%s_location=%s&", name, enc);
                     cld_free (enc);
                     if (would_write  >= avail)
                     {
-                        cld_report_error ("Web input larger than the limit of [%d] bytes (4)", CLD_MAX_SIZE_OF_URL);
+                        cld_report_error ("Web input larger than the limit of [%d] bytes (4)", max_cont);
                     }
                     new_cont_ptr += would_write;
 
                     // provide extension of the file
-                    would_write = snprintf (new_cont + new_cont_ptr, avail = CLD_MAX_SIZE_OF_URL - new_cont_ptr - 2, "%s_ext=%s&", name, ext);
+                    would_write = snprintf (new_cont + new_cont_ptr, avail = max_cont - new_cont_ptr - 2, "%s_ext=%s&", name, ext);
                     if (would_write  >= avail)
                     {
-                        cld_report_error ("Web input larger than the limit of [%d] bytes (5)", CLD_MAX_SIZE_OF_URL);
+                        cld_report_error ("Web input larger than the limit of [%d] bytes (5)", max_cont);
                     }
                     new_cont_ptr += would_write;
 
                     // provide size in bytes of the file
-                    would_write = snprintf (new_cont + new_cont_ptr, avail = CLD_MAX_SIZE_OF_URL - new_cont_ptr - 2, "%s_size=%d&", name, cont_type_len);
+                    would_write = snprintf (new_cont + new_cont_ptr, avail = max_cont - new_cont_ptr - 2, "%s_size=%d&", name, cont_type_len);
                     if (would_write  >= avail)
                     {
-                        cld_report_error ("Web input larger than the limit of [%d] bytes (6)", CLD_MAX_SIZE_OF_URL);
+                        cld_report_error ("Web input larger than the limit of [%d] bytes (6)", max_cont);
                     }
                     new_cont_ptr += would_write;
 
                     // provide id of file
-                    would_write = snprintf (new_cont + new_cont_ptr, avail = CLD_MAX_SIZE_OF_URL - new_cont_ptr - 2, "%s_id=%s&", name, doc_id);
+                    would_write = snprintf (new_cont + new_cont_ptr, avail = max_cont - new_cont_ptr - 2, "%s_id=%s&", name, doc_id);
                     if (would_write  >= avail)
                     {
-                        cld_report_error ("Web input larger than the limit of [%d] bytes (7)", CLD_MAX_SIZE_OF_URL);
+                        cld_report_error ("Web input larger than the limit of [%d] bytes (7)", max_cont);
                     }
                     new_cont_ptr += would_write;
 
+                    // provide SHA256 hash of file, computed while writing it
+                    if (pc->app.upload_hash == 1)
+                    {
+                        would_write = snprintf (new_cont + new_cont_ptr, avail = max_cont - new_cont_ptr - 2, "%s_sha=%s&", name, sha);
+                        if (would_write  >= avail)
+                        {
+                            cld_report_error ("Web input larger than the limit of [%d] bytes (7a)", max_cont);
+                        }
+                        new_cont_ptr += would_write;
+                    }
+
 
                 }
                 else
                 {
                     // no file uploaded, just empty filename as an indicator
-                    int would_write = snprintf (new_cont + new_cont_ptr, avail = CLD_MAX_SIZE_OF_URL - new_cont_ptr - 2, "%s_filename=&", name);
+                    int would_write = snprintf (new_cont + new_cont_ptr, avail = max_cont - new_cont_ptr - 2, "%s_filename=&", name);
                     if (would_write >= avail)
                     {
-                        cld_report_error ("Web input larger than the limit of [%d] bytes (8)", CLD_MAX_SIZE_OF_URL);
+                        cld_report_error ("Web input larger than the limit of [%d] bytes (8)", max_cont);
                     }
                     new_cont_ptr += would_write;
                 }
@@ -1620,46 +1920,55 @@ int cld_get_input(input_req *req, const char *method, const char *input)
         content = new_cont; // have URL (built) and pass it along as if it were a regular URL POST
     }
 
-    orig_content = cld_strdup (content);
-
-
-    // Convert URL format to a number of zero-delimited chunks
-    // in form of name-value-name-value...
     int j;
     int i;
-    int had_equal = 0;
-    for (j = i = 0; content[i]; i++)
+    if (is_decoded == 1)
     {
-        content[i] = (content[i] == '+' ? ' ' : content[i]);
-        if (content[i] == '%')
-        {
-            content[j++] = CLD_CHAR_FROM_HEX (content[i+1])*16+
-                CLD_CHAR_FROM_HEX (content[i+2]);
-            i += 2;
-        }
-        else
+        // raw input is gone, and could be very large anyway, so only describe it
+        orig_content = (char*)cld_malloc (100);
+        snprintf (orig_content, 100, "[url-encoded POST body of %d bytes decoded]", post_len);
+    }
+    else
+    {
+        orig_content = cld_strdup (content);
+
+
+        // Convert URL format to a number of zero-delimited chunks
+        // in form of name-value-name-value...
+        int had_equal = 0;
+        for (j = i = 0; content[i]; i++)
         {
-            if (content[i] == '&')
+            content[i] = (content[i] == '+' ? ' ' : content[i]);
+            if (content[i] == '%')
             {
-                if (had_equal == 0)
-                {
-                    cld_report_error ("Malformed URL request [%s], encountered ampersand without prior name=value", orig_content);
-                }
-                content[j++] = 0;
-                had_equal = 0;
+                content[j++] = CLD_CHAR_FROM_HEX (content[i+1])*16+
+                    CLD_CHAR_FROM_HEX (content[i+2]);
+                i += 2;
             }
-            else if (content[i] == '=')
+            else
             {
-                had_equal = 1;
-                (req->ip.num_of_input_params)++;
-                content[j++] = 0;
+                if (content[i] == '&')
+                {
+                    if (had_equal == 0)
+                    {
+                        cld_report_error ("Malformed URL request [%s], encountered ampersand without prior name=value", orig_content);
+                    }
+                    content[j++] = 0;
+                    had_equal = 0;
+                }
+                else if (content[i] == '=')
+                {
+                    had_equal = 1;
+                    (req->ip.num_of_input_params)++;
+                    content[j++] = 0;
+                }
+                else
+                    content[j++] = content[i];
             }
-            else
-                content[j++] = content[i];
         }
+        content[j++] = 0;
+        content[j] = 0;
     }
-    content[j++] = 0;
-    content[j] = 0;
 
 
     req->ip.names = (const char**)cld_calloc (req->ip.num_of_input_params, sizeof (char*));
@@ -1735,6 +2044,92 @@ char *cld_get_input_param (const input_req *req, const char *name)
     return cld_calloc (1, sizeof(char)); // i.e. dynamic ""
 }
 
+// 
+// Get raw body of POST request, which is available for application/json and application/octet-stream
+// content types. req is input request, 'len' is the output length of body (if not NULL).
+// Body is not copied, the data returned is the actual buffer it was read into, and it is zero-terminated.
+// Returns body, or "" if there isn't one.
+//
+char *cld_get_body (const input_req *req, int *len)
+{
+    CLD_TRACE("");
+    assert (req);
+    if (req->body == NULL)
+    {
+        if (len != NULL) *len = 0;
+        return CLD_EMPTY_STRING;
+    }
+    if (len != NULL) *len = req->body_len;
+    return req->body;
+}
+
+// 
+// Decode a piece of url-encoded POST body, as it is read from the client. 'arg' is the decoding
+// state (cld_url_stream), 'data' is the piece read and 'len' is its length. Hex-encoded bytes
+// can be split between pieces, which is why the state is kept between calls.
+// Decoded data is written in the form of name-value-name-value... zero-delimited chunks.
+// Returns 1.
+//
+int cld_url_stream_chunk (void *arg, const char *data, int len)
+{
+    cld_url_stream *us = (cld_url_stream*)arg;
+    int i;
+    for (i = 0; i < len; i++)
+    {
+        char c = data[i];
+        if (us->hex_pending > 0)
+        {
+            us->hex_val = us->hex_val*16 + CLD_CHAR_FROM_HEX (c);
+            us->hex_pending--;
+            if (us->hex_pending == 0) us->dest[us->pos++] = (char)us->hex_val;
+        }
+        else if (c == '%')
+        {
+            us->hex_pending = 2;
+            us->hex_val = 0;
+        }
+        else if (c == '+')
+        {
+            us->dest[us->pos++] = ' ';
+        }
+        else if (c == '&')
+        {
+            if (us->had_equal == 0)
+            {
+                cld_report_error ("Malformed URL request, encountered ampersand without prior name=value, at byte [%d]", us->pos);
+            }
+            us->dest[us->pos++] = 0;
+            us->had_equal = 0;
+        }
+        else if (c == '=')
+        {
+            us->had_equal = 1;
+            us->num_of_input_params++;
+            us->dest[us->pos++] = 0;
+        }
+        else
+        {
+            us->dest[us->pos++] = c;
+        }
+    }
+    return 1;
+}
+
+// 
+// Check if content type 'cont_type' (such as from CONTENT_TYPE header) is of type 'type'.
+// Parameters that may follow type (such as ;charset=utf-8) are ignored.
+// Returns 1 if it is, 0 if not (or if cont_type is NULL).
+//
+int cld_is_content_type (const char *cont_type, const char *type)
+{
+    CLD_TRACE("");
+    if (cont_type == NULL) return 0;
+    int tlen = strlen (type);
+    if (strncasecmp (cont_type, type, tlen)) return 0;
+    if (cont_type[tlen] == 0 || cont_type[tlen] == ';' || isspace (cont_type[tlen])) return 1;
+    return 0;
+}
+
 // 
 // Append string 'from' to string 'to'.
 // 'to' will be a new pointer to allocated data that contains to+from
@@ -2016,11 +2411,125 @@ int cld_exec_program_with_input(const char *cmd, const char *argv[], int num_arg
 
 }
 
+// 
+// Read debugging options from debug file 'fname' into 'debug'. Options that are not in the file
+// get default values. Tag is allocated with malloc().
+//
+void cld_read_debug_options(const char *fname, debug_app *debug)
+{
+    FILE *f;
+
+    debug->sleep = -1;
+    debug->lint = 0;
+    debug->timing = 0;
+    debug->query_stats = 0;
+    debug->slow_query = 0;
+    debug->log_query_string = 0;
+    debug->trace_level = 0;
+    debug->memory_check = 0;
+    debug->max_trace_size = CLD_MAX_TRACE_SIZE;
+    debug->trace_binary = 0;
+    debug->trace_records = CLD_RING_RECORDS;
+    debug->tag = NULL;
+
+    f = fopen (fname, "r");
+    if (f != NULL) // if cannot open, may have privileges incorrect,
+                    // we just silently ignore it and use default options
+    {
+        char line[200];
+        while (1)
+        {
+            if (fgets (line, sizeof (line) - 1, f) != NULL)
+            {
+                int len = strlen (line);
+                cld_trim (line, &len);
+                if (line[0] == '/' && line[1] == '/') continue; //comment line
+
+                char *eq = strchr (line, '=');
+                if (eq == NULL) continue; // bad line or empty line
+
+                // divide line into name, value
+                *eq = 0;
+                len = strlen (line);
+                cld_trim (line, &len); // name
+
+                len = strlen (eq + 1);
+                cld_trim (eq + 1, &len); // value
+                
+                // now line is the option, eq+1 is the value
+                if (!strcasecmp (line, "LINT"))
+                {
+                    if (!strcasecmp (eq + 1, "1"))
+                    {
+                        debug->lint  = 1;
+                    }
+                }
+                else if (!strcasecmp (line, "TIMING"))
+                {
+                    debug->timing = atoi(eq+1);
+                }
+                else if (!strcasecmp (line, "QUERYSTATS"))
+                {
+                    debug->query_stats = atoi(eq+1);
+                }
+                else if (!strcasecmp (line, "SLOWQUERY"))
+                {
+                    debug->slow_query = atoi(eq+1);
+                    if (debug->slow_query < 0) debug->slow_query = 0;
+                }
+                else if (!strcasecmp (line, "LOGQUERYSTRING"))
+                {
+                    debug->log_query_string = atoi(eq+1);
+                }
+                else if (!strcasecmp (line, "SLEEP"))
+                {
+                    debug->sleep = atoi(eq+1);
+                }
+                else if (!strcasecmp (line, "TRACE"))
+                {
+                    debug->trace_level = atoi(eq+1);
+                }
+                else if (!strcasecmp (line, "MEMORYCHECK"))
+                {
+                    debug->memory_check = atoi(eq+1);
+                }
+                else if (!strcasecmp (line, "MAXTRACESIZE"))
+                {
+                    debug->max_trace_size = atol(eq+1);
+                    if (debug->max_trace_size <= 0) debug->max_trace_size = CLD_MAX_TRACE_SIZE;
+                }
+                else if (!strcasecmp (line, "TRACEMODE"))
+                {
+                    debug->trace_binary = (!strcasecmp (eq + 1, "binary") ? 1 : 0);
+                }
+                else if (!strcasecmp (line, "TRACERECORDS"))
+                {
+                    debug->trace_records = atoi(eq+1);
+                    if (debug->trace_records <= 0) debug->trace_records = CLD_RING_RECORDS;
+                }
+                else if (!strcasecmp (line, "TAG"))
+                {
+                    free (debug->tag);
+                    debug->tag = strdup (eq+1); // already trimmed
+                }
+            }
+            else break; // either eof or error, either way
+                    // we won't handle or report, because there is no 
+                    // venue yet to report it in, we're opening those now
+        }
+        fclose (f);
+    }
+    if (debug->tag == NULL) debug->tag = strdup ("");
+    if (debug->tag == NULL) CLD_FATAL_HANDLER ("Cannot allocate debug options");
+}
+
 // 
 // Get debugging options, such as tracing and linting
 // These options are stored in a 'debug' file in 'trace' directory
-// These options are obtained for each request.
 // Double slash is a comment in debug file
+// Debug file is read once per process and kept in memory. It is checked for changes (with stat()) at most once
+// per CLD_CONFIG_CHECK_INTERVAL seconds, and read again only if changed, so when tracing is off (as it is in
+// production), there is no file opened with each request.
 //
 void cld_get_debug_options()
 {
@@ -2028,72 +2537,71 @@ void cld_get_debug_options()
                 // only the calls after will. Tracing calls debugOptions, and debugOptions
                 // calls tracing, leading to recursion, except that we check for this
 
-    FILE *f;
     char trace_file[200];
     cld_config *pc = cld_get_config();
 
-    snprintf (trace_file, sizeof (trace_file), "%s/%s", pc->app.log_directory, CLD_DEBUGFILE);
-    CLD_TRACE("Checking debug file [%s]", trace_file);
-
-    f = fopen (trace_file, "r");
-    if (f == NULL) return; // cannot open, may have privileges incorrect,
-                    // we just silently ignore it and use default options
+    cld_debug_cache *c = cld_debug;
+    while (c != NULL && strcmp (c->log_directory, pc->app.log_directory)) c = c->next;
 
-    char line[200];
-    while (1)
+    time_t now = time (NULL);
+    if (c == NULL || now - c->checked >= CLD_CONFIG_CHECK_INTERVAL)
     {
-        if (fgets (line, sizeof (line) - 1, f) != NULL)
-        {
-            int len = strlen (line);
-            cld_trim (line, &len);
-            if (line[0] == '/' && line[1] == '/') continue; //comment line
+        snprintf (trace_file, sizeof (trace_file), "%s/%s", pc->app.log_directory, CLD_DEBUGFILE);
+        CLD_TRACE("Checking debug file [%s]", trace_file);
 
-            char *eq = strchr (line, '=');
-            if (eq == NULL) continue; // bad line or empty line
-
-            // divide line into name, value
-            *eq = 0;
-            len = strlen (line);
-            cld_trim (line, &len); // name
-
-            len = strlen (eq + 1);
-            cld_trim (eq + 1, &len); // value
-            
-            // now line is the option, eq+1 is the value
-            if (!strcasecmp (line, "LINT"))
-            {
-                if (!strcasecmp (eq + 1, "1"))
-                {
-                    pc->debug.lint  = 1;
-                }
-            }
-            else if (!strcasecmp (line, "SLEEP"))
-            {
-                pc->debug.sleep = atoi(eq+1);
-            }
-            else if (!strcasecmp (line, "TRACE"))
-            {
-                pc->debug.trace_level = atoi(eq+1);
-            }
-            else if (!strcasecmp (line, "MEMORYCHECK"))
-            {
-                pc->debug.memory_check = atoi(eq+1);
-            }
-            else if (!strcasecmp (line, "TAG"))
+        struct stat st;
+        if (stat (trace_file, &st) != 0)
+        {
+            // no debug file, default options
+            st.st_mtime = 0;
+            st.st_size = 0;
+        }
+        if (c == NULL)
+        {
+            c = (cld_debug_cache*) calloc (1, sizeof (cld_debug_cache));
+            if (c == NULL || (c->log_directory = strdup (pc->app.log_directory)) == NULL)
             {
-                pc->debug.tag = cld_strdup (eq+1);
-                int tag_len = strlen (pc->debug.tag);
-                cld_trim (pc->debug.tag, &tag_len);
+                CLD_FATAL_HANDLER ("Cannot allocate debug options");
             }
+            c->timing_fd = -1;
+            c->slow_fd = -1;
+            c->next = cld_debug;
+            cld_debug = c;
+            cld_read_debug_options (trace_file, &(c->debug));
         }
-        else break; // either eof or error, either way
-                // we won't handle or report, because there is no 
-                // venue yet to report it in, we're opening those now
-    }
+        else if (st.st_mtime != c->mtime || st.st_size != c->size)
+        {
+            free (c->debug.tag);
+            cld_read_debug_options (trace_file, &(c->debug));
+        }
+        c->mtime = st.st_mtime;
+        c->size = st.st_size;
+        c->checked = now;
+    }
+    cld_debug_curr = c;
+
+    pc->debug.sleep = c->debug.sleep;
+    pc->debug.lint = c->debug.lint;
+    pc->debug.timing = c->debug.timing;
+    pc->debug.query_stats = c->debug.query_stats;
+    pc->debug.slow_query = c->debug.slow_query;
+    pc->debug.log_query_string = c->debug.log_query_string;
+    if (pc->debug.slow_query == 0 && c->slow_fd != -1)
+    {
+        // slow query log was turned off
+        close (c->slow_fd);
+        c->slow_fd = -1;
+    }
+    pc->debug.trace_level = c->debug.trace_level;
+    pc->debug.memory_check = c->debug.memory_check;
+    pc->debug.max_trace_size = c->debug.max_trace_size;
+    pc->debug.trace_binary = c->debug.trace_binary;
+    pc->debug.trace_records = c->debug.trace_records;
+    pc->debug.tag = c->debug.tag;
+    cld_trace_level = (pc->debug.memory_check == 1 ? CLD_TRACE_ALL : pc->debug.trace_level);
 
     CLD_TRACE("Debug: lint:[%d], tracing:[%d], sleep [%d]", pc->debug.lint, pc->debug.trace_level, pc->debug.sleep);
         
-    fclose (f);
     return;
 }
 
@@ -2448,11 +2956,14 @@ int cld_flush_printf(int fin)
             // there is no ELSE AMOD because for batch mode, HTML OUTPUT IS DISABLED!
             if (pc->ctx.req->sent_header == 0 && pc->ctx.cld_report_error_is_in_report == 0) cld_report_error ("No header sent prior to html data");
 #ifdef AMOD
+            struct timespec flush_start;
+            clock_gettime (CLOCK_MONOTONIC, &flush_start);
             res = cld_ws_write (pc->ctx.apa, pc->out.buf, to_write);
             if (res < 0) CLD_TRACE ("Error in writing, error [%s]", strerror(errno));
             else CLD_TRACE("Wrote [%d] bytes", res);
             int flush_res = cld_ws_flush (pc->ctx.apa);
             CLD_TRACE("Flushed to web [%d]", flush_res);
+            cld_timing_add (CLD_PHASE_FLUSH, &flush_start);
 
 #endif
         }
@@ -2487,12 +2998,21 @@ void cld_printf_close()
 // For example, if within write-string construct, it's to the string, 
 // otherwise to the web (unless HTML output is disabled).
 //
-// There are only 2 output functions: cld_puts and cld_printf, and they both
+// There are only 2 output functions: cld_puts (with cld_puts_len) and cld_printf, and they 
 // call cld_puts_final(). NO OTHER way of output should be present and NOTHING
 // else should call cld_puts_final.
 //
 //
 int cld_puts (int enc_type, const char *s)
+{
+    return cld_puts_len (enc_type, s, -1);
+}
+
+//
+// Same as cld_puts(), except that 'len' is the length of 's' if already known (for instance
+// for query results), or -1 if it should be computed.
+//
+int cld_puts_len (int enc_type, const char *s, int len)
 {
     assert(s);
     CLD_TRACE ("");
@@ -2503,7 +3023,7 @@ int cld_puts (int enc_type, const char *s)
 
 
     int buf_pos_start = pc->out.buf_pos;
-    int vLen = strlen(s);
+    int vLen = (len < 0 ? (int)strlen(s) : len);
     int res = 0;
     if (enc_type==CLD_NOENC)
     {
@@ -2717,8 +3237,6 @@ void cld_shut(input_req *giu)
     // it should not be called twice
     if (giu != NULL && giu->is_shut ==1) return;
 
-    if (giu != NULL) giu->is_shut = 1;
-
     CLD_TRACE("Shutting down");
     if (giu == NULL)
     {
@@ -2730,6 +3248,21 @@ void cld_shut(input_req *giu)
         CLD_FATAL_HANDLER ("config is NULL");
     }
 
+    // rows of a query not all used (such as if request ended in its run-query loop) are discarded so db connection can be used again,
+    // and the same goes for queries still executing. This is done before anything that can fail, since error would shut down request.
+    cld_stream_done (pc->ctx.stream);
+    cld_async_done ();
+
+    // rows of INSERT not inserted yet are inserted, so an error can still be reported, in which case cld_report_error() shuts down
+    // request and it's done here. If request failed, they are discarded.
+    if (pc->ctx.cld_report_error_is_in_report == 1) pc->ctx.bulk = NULL;
+    else cld_bulk_flush (NULL, NULL);
+    // slow statement's result is complete by now
+    cld_slow_stmt_done ();
+    if (giu->is_shut == 1) return;
+
+    giu->is_shut = 1;
+
     // print out first, so that web client can get information sent out so far
     // because the following code CAN fail, in which case cld_report_error (if already
     // called) may be called again, and in that case, it will just exit
@@ -2738,6 +3271,13 @@ void cld_shut(input_req *giu)
 
     int ec = giu->exit_code;
 
+    // command line program exits at the end of request, so always write query statistics
+#ifdef AMOD
+    cld_write_qry_stats (0);
+#else
+    cld_write_qry_stats (1);
+#endif
+
     // we NEVER close connection for web-server module
 #ifndef AMOD
     cld_close_db_conn ();
@@ -2748,6 +3288,11 @@ void cld_shut(input_req *giu)
         cld_cant_find_file("Could not find server file (unknown)");
     }
 
+#ifndef AMOD
+    // command line program exits here
+    cld_timing_done ();
+#endif
+
 // trace for apache module is opened once for request, and it closes when it ends here
     cld_close_trace ();
 
@@ -2769,6 +3314,7 @@ void cld_shut(input_req *giu)
     {
         cld_ws_finish (pc->ctx.apa);
     }
+    cld_timing_done ();
 #endif
 
 
@@ -3593,6 +4139,9 @@ int cld_subst (char **src, const char *search, const char *subst_with, int all)
 // . log_directory (tracing), 
 // . html_directory (where html static files are), 
 // . max_upload size (maximum upload size for binary documents), 
+// . max_body_size (maximum size of POST body that is not an upload), 
+// . upload_hash (1 if hash of uploaded files is computed), 
+// . doc_id_block (number of document ids reserved at once, see cld_get_document_id()), 
 // . uparams (any parameters starting with underscore _), 
 // . web (web address of the server up to and excluding question mark ?), 
 // . email (emaill address used to send emails), 
@@ -3602,13 +4151,16 @@ int cld_subst (char **src, const char *search, const char *subst_with, int all)
 // . sock (location of database server connection file). 
 // . ignore_mismatch - if yes, then ignore the mismatch of libraries (cld installed vs application built with)
 // Out of these file, the ones that are not coded in config (i.e. they are fixed) are html_directory (always html), file_directory (always file), tmp_directory (always tmp),
-// log_directory (always trace), db file (always .db). Out of config parameters (those actually in config file), sock, ignore_mismatch, and  max_upload_size have default value and can be omitted.
+// log_directory (always trace), db file (always .db). Out of config parameters (those actually in config file), sock, ignore_mismatch, max_upload_size, max_body_size, upload_hash and doc_id_block have default value and can be omitted.
 // version MUST be specified. 
 // max_upload_size default is 5 million bytes, and sock default value is /var/lib/mysql/mysql.sock (which is correct often and does not need be changed).
 //
+// All values are allocated in request memory, so they are valid for the current request only. Use
+// cld_get_runtime_options() to get the values cached for the life of the process.
+//
 // Returns 0 if cannot open config file or cannot figure out home directory, 1 if okay.
 //
-int cld_get_runtime_options(const char **version, const char **log_directory, const char **html_directory, long *max_upload_size, cld_store_data *uparams, const char **web, const char **email, const char **file_directory, const char **tmp_directory, const char **db, const char **sock, const char **ignore_mismatch)
+int cld_read_runtime_options(const char **version, const char **log_directory, const char **html_directory, long *max_upload_size, long *max_body_size, int *upload_hash, int *doc_id_block, cld_store_data *uparams, const char **web, const char **email, const char **file_directory, const char **tmp_directory, const char **db, const char **sock, const char **ignore_mismatch)
 {
     FILE *f;
 
@@ -3653,6 +4205,12 @@ int cld_get_runtime_options(const char **version, const char **log_directory, co
 
     // max_upload_size not mandatory
     *max_upload_size = 5000000;
+    // max_body_size not mandatory, by default the same as the limit for URL
+    *max_body_size = CLD_MAX_SIZE_OF_URL;
+    // upload_hash not mandatory, by default no hash is computed for uploads
+    *upload_hash = 0;
+    // doc_id_block not mandatory, by default each document id is obtained from database
+    *doc_id_block = 1;
     // mariadb_socket not mandatory since not every app will use database
     *sock = "/var/lib/mysql/mysql.sock";
     // by default do NOT ignore mismatch
@@ -3691,6 +4249,32 @@ int cld_get_runtime_options(const char **version, const char **log_directory, co
                     cld_report_error( "Max_upload_size in 'config' configuration file must be a number between 1024 and %ld", upper_limit);
                 }
             }
+            else if (!strcasecmp (line, "MAX_BODY_SIZE"))
+            {
+                *max_body_size  = atol (eq + 1);
+                long upper_limit = 1024*1024*1024;
+                if (*max_body_size <1024 || *max_body_size > upper_limit)
+                {
+                    cld_report_error( "Max_body_size in 'config' configuration file must be a number between 1024 and %ld", upper_limit);
+                }
+            }
+            else if (!strcasecmp (line, "UPLOAD_HASH"))
+            {
+                if (!strcasecmp (eq + 1, "yes")) *upload_hash = 1;
+                else if (!strcasecmp (eq + 1, "no")) *upload_hash = 0;
+                else
+                {
+                    cld_report_error( "Upload_hash in 'config' configuration file must be 'yes' or 'no'");
+                }
+            }
+            else if (!strcasecmp (line, "DOC_ID_BLOCK"))
+            {
+                *doc_id_block = atoi (eq + 1);
+                if (*doc_id_block < 1 || *doc_id_block > CLD_MAX_DOC_ID_BLOCK)
+                {
+                    cld_report_error( "Doc_id_block in 'config' configuration file must be a number between 1 and %d", CLD_MAX_DOC_ID_BLOCK);
+                }
+            }
             else if (!strcasecmp (line, "EMAIL_ADDRESS"))
             {
                 *email = cld_strdup(eq + 1);
@@ -3729,6 +4313,162 @@ int cld_get_runtime_options(const char **version, const char **log_directory, co
     return 1;
 }
 
+// 
+// Process-wide cache of config file, one per application (since more than one application can run in
+// the same process, each with its own config file). It is allocated with malloc(), i.e. outside of
+// request memory, so it lives for as long as the process does.
+//
+typedef struct cld_conf_cache_s
+{
+    char *conf_name; // full path of config file
+    time_t mtime; // modification time of config file when it was read
+    off_t size; // size of config file when it was read
+    time_t checked; // last time we checked if config file changed
+    app_data app; // configuration read from config file
+    struct cld_conf_cache_s *next; // next application's config
+} cld_conf_cache;
+static cld_conf_cache *cld_conf = NULL;
+
+// 
+// Get run-time options from config file - see cld_read_runtime_options() for description of arguments.
+// Config file is read and parsed only the first time it's needed in the process, and then again only
+// if it changes. Whether it changed is checked (with stat()) at most once per CLD_CONFIG_CHECK_INTERVAL
+// seconds, so most requests do not touch the file at all. Values returned point to process memory and
+// must NOT be changed or freed, except user parameters in 'uparams', which are a copy in request memory.
+//
+// Returns 0 if cannot open config file or cannot figure out home directory, 1 if okay.
+//
+int cld_get_runtime_options(const char **version, const char **log_directory, const char **html_directory, long *max_upload_size, long *max_body_size, int *upload_hash, int *doc_id_block, cld_store_data *uparams, const char **web, const char **email, const char **file_directory, const char **tmp_directory, const char **db, const char **sock, const char **ignore_mismatch)
+{
+    char conf_name[512];
+
+    snprintf (conf_name, sizeof (conf_name) , "%s/config", cld_home_dir());
+
+    cld_conf_cache *c = cld_conf;
+    while (c != NULL && strcmp (c->conf_name, conf_name)) c = c->next;
+
+    time_t now = time (NULL);
+    if (c == NULL || now - c->checked >= CLD_CONFIG_CHECK_INTERVAL)
+    {
+        struct stat st;
+        if (stat (conf_name, &st) != 0) return 0;
+        if (c == NULL || st.st_mtime != c->mtime || st.st_size != c->size)
+        {
+            // config file is new or changed, read it in request memory and then copy to process memory
+            app_data app;
+            if (cld_read_runtime_options (&(app.version), &(app.log_directory), &(app.html_directory), &(app.max_upload_size), &(app.max_body_size), &(app.upload_hash), &(app.doc_id_block), &(app.user_params),
+                &(app.web), &(app.email), &(app.file_directory), &(app.tmp_directory), &(app.db), &(app.mariadb_socket), &(app.ignore_mismatch)) != 1) return 0;
+            if (c == NULL)
+            {
+                c = (cld_conf_cache*) calloc (1, sizeof (cld_conf_cache));
+                if (c == NULL || (c->conf_name = strdup (conf_name)) == NULL)
+                {
+                    CLD_FATAL_HANDLER ("Cannot allocate configuration cache");
+                }
+                c->next = cld_conf;
+                cld_conf = c;
+            }
+            else
+            {
+                cld_free_app_data (&(c->app));
+            }
+            cld_copy_app_data (&(c->app), &app);
+            c->mtime = st.st_mtime;
+            c->size = st.st_size;
+            CLD_TRACE ("Read configuration file [%s]", conf_name);
+        }
+        c->checked = now;
+    }
+
+    *version = c->app.version;
+    *log_directory = c->app.log_directory;
+    *html_directory = c->app.html_directory;
+    *max_upload_size = c->app.max_upload_size;
+    *max_body_size = c->app.max_body_size;
+    *upload_hash = c->app.upload_hash;
+    *doc_id_block = c->app.doc_id_block;
+    // user parameters are copied to request memory, since the application can retrieve, store or purge them
+    int i;
+    cld_store_init (uparams);
+    for (i = 0; i < c->app.user_params.store_ptr; i++)
+    {
+        cld_store (uparams, c->app.user_params.item[i].name, c->app.user_params.item[i].data);
+    }
+    *web = c->app.web;
+    *email = c->app.email;
+    *file_directory = c->app.file_directory;
+    *tmp_directory = c->app.tmp_directory;
+    *db = c->app.db;
+    *sock = c->app.mariadb_socket;
+    *ignore_mismatch = c->app.ignore_mismatch;
+    return 1;
+}
+
+// 
+// Copy configuration 'src' to 'dest', where all strings (and user parameters) in 'dest' are allocated
+// with malloc() so they survive the end of request. Release with cld_free_app_data().
+//
+void cld_copy_app_data (app_data *dest, const app_data *src)
+{
+    *dest = *src;
+    // all strings are duplicated, NULL stays NULL
+#define CLD_CONF_DUP(x) if (src->x != NULL && (dest->x = strdup (src->x)) == NULL) CLD_FATAL_HANDLER ("Cannot allocate configuration cache")
+    CLD_CONF_DUP (version);
+    CLD_CONF_DUP (db);
+    CLD_CONF_DUP (log_directory);
+    CLD_CONF_DUP (tmp_directory);
+    CLD_CONF_DUP (file_directory);
+    CLD_CONF_DUP (html_directory);
+    CLD_CONF_DUP (email);
+    CLD_CONF_DUP (web);
+    CLD_CONF_DUP (mariadb_socket);
+    CLD_CONF_DUP (ignore_mismatch);
+#undef CLD_CONF_DUP
+
+    // user parameters, only what's stored is copied
+    int i;
+    int num = src->user_params.store_ptr;
+    dest->user_params.item = (cld_store_data_item*) calloc (num + 1, sizeof (cld_store_data_item));
+    if (dest->user_params.item == NULL) CLD_FATAL_HANDLER ("Cannot allocate configuration cache");
+    for (i = 0; i < num; i++)
+    {
+        const cld_store_data_item *it = &(src->user_params.item[i]);
+        if ((it->name != NULL && (dest->user_params.item[i].name = strdup (it->name)) == NULL) ||
+            (it->data != NULL && (dest->user_params.item[i].data = strdup (it->data)) == NULL))
+        {
+            CLD_FATAL_HANDLER ("Cannot allocate configuration cache");
+        }
+    }
+    dest->user_params.num_of = num + 1;
+    dest->user_params.store_ptr = num;
+    dest->user_params.retrieve_ptr = 0;
+}
+
+// 
+// Release configuration 'app' created with cld_copy_app_data().
+//
+void cld_free_app_data (app_data *app)
+{
+    free ((char*)app->version);
+    free ((char*)app->db);
+    free ((char*)app->log_directory);
+    free ((char*)app->tmp_directory);
+    free ((char*)app->file_directory);
+    free ((char*)app->html_directory);
+    free ((char*)app->email);
+    free ((char*)app->web);
+    free ((char*)app->mariadb_socket);
+    free ((char*)app->ignore_mismatch);
+    int i;
+    for (i = 0; i < app->user_params.store_ptr; i++)
+    {
+        free (app->user_params.item[i].name);
+        free (app->user_params.item[i].data);
+    }
+    free (app->user_params.item);
+    memset (app, 0, sizeof (app_data));
+}
+
 
 
 
@@ -25,11 +25,11 @@ You may obtain a copy of the License at
 
 
 
-// these are used in crash-handler. We set these whenever we trace
-// and they are the last location we traced. Crash handler uses these
-// to provide more context about the crash.
-extern const char *func_name;
-extern int func_line;
+// 
+// Trace level for this process, checked by CLD_TRACE before calling trace_cld(). It is set from
+// debug file by cld_get_debug_options(), and it's CLD_TRACE_ALL if memory check is on.
+//
+int cld_trace_level = 0;
 
 
 
@@ -105,6 +105,19 @@ void trace_cld(int trace_level, const char *from_file, int from_line, const char
     if (pc->trace.in_trace == 1) return;
     pc->trace.in_trace = 1;
 
+    // binary trace mode, store raw record, no formatting
+    if (pc->trace.ring != NULL)
+    {
+        va_list args;
+        va_start (args, format);
+        cld_ring_trace (pc->trace.ring, from_file, from_line, from_fun, format, args);
+        va_end (args);
+        func_name = from_file;
+        func_line = from_line;
+        pc->trace.in_trace = 0;
+        return;
+    }
+
     if (pc->trace.f == NULL) 
     {
         pc->trace.in_trace = 0;
@@ -124,6 +137,9 @@ void trace_cld(int trace_level, const char *from_file, int from_line, const char
     char curr_time[200];
     cld_current_time (curr_time, sizeof(curr_time)-1);
     fprintf (pc->trace.f, "%s (%s:%d)| %s %s\n", curr_time, from_file, from_line, from_fun, trc);
+    // calls made from here (which are traced too) change the last location, so restore it
+    func_name = from_file;
+    func_line = from_line;
     //
     // We do not fflush() here - this is done either at the end of request (cld_shut()) or
     // when program crashes (cld_report_error())
@@ -274,7 +290,8 @@ void cld_fatal_error (const char *errtext, const char *fname, int lnum)
     // we just exit , otherwise we'll be stuck in recursive calls between cld_fatal_error and
     // cld_get_config
     cld_config *pc = cld_get_config();
-    if (pc != NULL)
+    // there is no web request in child_init hook (see cld_child_init()), so nothing to send
+    if (pc != NULL && pc->ctx.apa != NULL)
     {
         cld_ws_set_content_type(pc->ctx.apa, "text/html");
         cld_ws_printf (pc->ctx.apa, "Application has encountered an unexpected error, process id [%d].\n", 
@@ -297,19 +314,79 @@ void cld_init_config(cld_config *pc)
 
     // these are set once and do not need to be reset with each call to vmmain
     pc->trace.f = NULL;
+    pc->trace.ring = NULL;
     pc->trace.in_trace = 0;
     pc->trace.in_memory_check = 0;
     pc->debug.sleep = -1;
     pc->debug.lint = 0;
+    pc->debug.timing = 0;
+    pc->debug.query_stats = 0;
+    pc->debug.slow_query = 0;
     pc->debug.trace_level = 0;
     pc->debug.memory_check = 0;
+    pc->debug.max_trace_size = CLD_MAX_TRACE_SIZE;
+    pc->debug.trace_binary = 0;
+    pc->debug.trace_records = CLD_RING_RECORDS;
     pc->debug.tag = cld_strdup ("");
+    memset (&(pc->timing), 0, sizeof (pc->timing)); // not measuring until cld_timing_begin()
     pc->ctx.out.was_there_any_output_this_request =0; // must be set for each new request, otherwise
                 // we might htink something has been output when nothing was!
     
     reset_cld_config (pc);
 }
 
+// 
+// Microseconds elapsed from 'since' to 'now'
+//
+long long cld_timing_us (const struct timespec *since, const struct timespec *now)
+{
+    return (now->tv_sec - since->tv_sec) * 1000000LL + (now->tv_nsec - since->tv_nsec) / 1000;
+}
+
+// 
+// Start measuring time spent in phases of request. 'start' is when request started. Time from 'start' until now
+// is counted as bootstrap (reading config and debug options, opening trace).
+//
+void cld_timing_begin (const struct timespec *start)
+{
+    cld_config *pc = cld_get_config();
+    memset (&(pc->timing), 0, sizeof (pc->timing));
+    pc->timing.start = *start;
+    pc->timing.last = *start;
+    cld_timing_phase (CLD_PHASE_BOOT);
+}
+
+// 
+// Count time since the previous call (or since cld_timing_begin()) as spent in 'phase', except for time
+// already counted with cld_timing_add() (such as executing queries within request handler).
+//
+void cld_timing_phase (int phase)
+{
+    cld_config *pc = cld_get_config();
+    if (pc->timing.start.tv_sec == 0) return;
+    struct timespec now;
+    clock_gettime (CLOCK_MONOTONIC, &now);
+    pc->timing.phase[phase] += cld_timing_us (&(pc->timing.last), &now) - pc->timing.nested;
+    pc->timing.nested = 0;
+    pc->timing.last = now;
+}
+
+// 
+// Count time since 'since' as spent in 'phase'. This is for phases that happen within other phases, such as
+// executing a query or flushing output within request handler.
+// Returns the number of microseconds counted.
+//
+long long cld_timing_add (int phase, const struct timespec *since)
+{
+    cld_config *pc = cld_get_config();
+    struct timespec now;
+    clock_gettime (CLOCK_MONOTONIC, &now);
+    long long us = cld_timing_us (since, &now);
+    pc->timing.phase[phase] += us;
+    pc->timing.nested += us;
+    return us;
+}
+
 // 
 // Reset program context. This is called for each new web request, or at
 // the beginning of command line program.
@@ -322,6 +399,11 @@ void reset_cld_config(cld_config *pc)
     pc->out.len = 0;
     pc->out.buf_pos = 0;
     pc->ctx.req = NULL;
+    pc->ctx.qry_site = NULL;
+    pc->ctx.stream = NULL;
+    memset (pc->ctx.async, 0, sizeof (pc->ctx.async));
+    pc->ctx.bulk = NULL;
+    pc->ctx.is_written = 0;
     pc->ctx.trim_query_input = 0;
     pc->ctx.cld_report_error_is_in_report = 0;
 
@@ -0,0 +1,89 @@
+/*
+Copyright (c) 2017 DaSoftver LLC.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS,
+    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+    See the License for the specific language governing permissions and
+    limitations under the License.
+*/
+
+
+//
+// Decoder for binary trace ring (trace files named ring-<pid> in trace directory, written when
+// 'tracemode=binary' is in debug file). Prints records from the oldest to the newest in the same
+// form as text trace file.
+//
+// Usage: cldtrace <ring file> [<number of last records to print>]
+//
+
+#include "cld.h"
+#include <sys/mman.h>
+
+
+int main (int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        fprintf (stderr, "Usage: cldtrace <ring file> [<number of last records to print>]\n");
+        return 1;
+    }
+    long long last_n = (argc >= 3 ? atoll (argv[2]) : 0);
+
+    int fd = open (argv[1], O_RDONLY);
+    if (fd == -1)
+    {
+        fprintf (stderr, "Cannot open [%s], error [%s]\n", argv[1], strerror (errno));
+        return 1;
+    }
+    struct stat st;
+    if (fstat (fd, &st) != 0 || st.st_size < (off_t)sizeof (cld_ring))
+    {
+        fprintf (stderr, "File [%s] is not a trace ring\n", argv[1]);
+        return 1;
+    }
+    cld_ring *r = (cld_ring*) mmap (NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (r == MAP_FAILED)
+    {
+        fprintf (stderr, "Cannot map [%s], error [%s]\n", argv[1], strerror (errno));
+        return 1;
+    }
+    if (memcmp (r->magic, CLD_RING_MAGIC, sizeof (r->magic)) || r->rec_size != (int)sizeof (cld_ring_rec) || r->num_sites != CLD_RING_SITES
+        || st.st_size < (off_t)(sizeof (cld_ring) + (size_t)r->num_records * sizeof (cld_ring_rec)))
+    {
+        fprintf (stderr, "File [%s] is not a trace ring, or is from a different version of Cloudgizer\n", argv[1]);
+        return 1;
+    }
+
+    unsigned long long last = r->seq;
+    unsigned long long s = (last > (unsigned long long)r->num_records ? last - r->num_records : 1);
+    if (last_n > 0 && last - s > (unsigned long long)last_n) s = last - last_n;
+
+    char msg[CLD_TRACE_LEN + 1];
+    char curr_time[100];
+    for (; s < last; s++)
+    {
+        const cld_ring_rec *rec = &(r->rec[(s - 1) % r->num_records]);
+        if (rec->seq != s) continue; // overwritten while process was writing, or incomplete
+
+        // monotonic time of record relative to when ring was opened gives the wall clock time
+        long long nsec = (rec->sec - r->mono_sec) * 1000000000LL + (rec->nsec - r->mono_nsec);
+        time_t t = (time_t)(r->wall_sec + nsec / 1000000000LL);
+        struct tm *tm = localtime (&t);
+        if (tm == NULL || strftime (curr_time, sizeof (curr_time), "%F-%H-%M-%S", tm) == 0) curr_time[0] = 0;
+
+        cld_ring_render (r, rec, msg, sizeof (msg));
+        const cld_ring_site *site = (rec->site < r->num_sites ? &(r->site[rec->site]) : NULL);
+        printf ("%s.%03d %d (%s:%d)| %s %s\n", curr_time, (int)((nsec / 1000000) % 1000), r->pid,
+            site == NULL ? "?" : site->file, site == NULL ? 0 : site->line, site == NULL ? "?" : site->fun, msg);
+    }
+    munmap (r, st.st_size);
+    close (fd);
+    return 0;
+}
@@ -29,26 +29,65 @@ You may obtain a copy of the License at
 #include "util_script.h"
 #include "http_connection.h"
 #include "apr_strings.h"
+#include "apr_shm.h"
 #include <assert.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/types.h>
 
 
 //
 // Function prototypes
 //
 int cld_ws_util_read (void * rp, char *content, int len);
+int cld_ws_util_read_stream (void * rp, char *chunk, int chunk_len, int (*proc)(void *, const char *, int), void *arg);
 const char *cld_ws_get_env(void * vmr, const char *n);
 void cld_ws_set_content_type(void *rp, const char *v);
 void cld_ws_set_header (void *rp, const char *n, const char *v);
 void cld_ws_add_header (void *rp, const char *n, const char *v);
+void cld_ws_set_note (void *rp, const char *n, const char *v);
 int cld_ws_write (void *r, const char *s, int nbyte);
 int cld_ws_flush (void *r);
 void cld_ws_finish (void *rp);
 int cld_main (void *r);
+void cld_child_init ();
+void cld_ws_child_init (apr_pool_t *p, server_rec *s);
+void cld_ws_register_hooks (apr_pool_t *p);
+void __real_ap_hook_handler (int (*pf) (request_rec *), const char * const *pre, const char * const *succ, int order);
+void __wrap_ap_hook_handler (int (*pf) (request_rec *), const char * const *pre, const char * const *succ, int order);
+int cld_ws_post_config (apr_pool_t *pconf, apr_pool_t *plog, apr_pool_t *ptemp, server_rec *s);
+int cld_ws_metrics_handler (request_rec *r);
+void cld_ws_metrics (void *rp, long long total_us, int queries, size_t memory_peak);
 void cld_ws_set_status (void *rp, int st, const char *line);
 int cld_ws_printf (void *r, const char *fmt, ...) __attribute__ ((format (printf, 2, 3)));
 void cld_ws_set_content_length(void *rp, const char *v);
 const char *cld_ws_get_status (void *rp, int *status);
 
+// Application name, also used in the name of metrics handler
+extern char *cld_handler_name;
+
+//
+// Metrics kept in shared memory for all Apache child processes (see cld_ws_metrics_handler()). Each child process
+// has its own slot, so counting on the request path takes no locks, and slots are added up only when metrics are
+// requested. A slot of a process that exited is taken over by a new one along with its counters, so totals never go down.
+//
+#define CLD_WS_METRICS_SLOTS 1024 // maximum number of child processes tracked at the same time
+#define CLD_WS_BUCKETS 13 // number of request duration buckets, there is one more for requests longer than the last
+static const long long cld_ws_bucket_us[CLD_WS_BUCKETS] = {1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000, 1000000, 2500000, 5000000, 10000000};
+typedef struct cld_ws_slot_s
+{
+    pid_t pid; // process using this slot, 0 if never used
+    unsigned long long requests[5]; // requests by status class, 1xx to 5xx
+    unsigned long long duration[CLD_WS_BUCKETS + 1]; // requests by duration bucket (not cumulative)
+    unsigned long long duration_us; // total duration of requests, in microseconds
+    unsigned long long queries; // database queries executed
+    unsigned long long bytes; // bytes written to clients
+    unsigned long long memory_peak; // most memory used by a single request
+} __attribute__ ((aligned (64))) cld_ws_slot;
+static cld_ws_slot *cld_ws_slots = NULL; // all slots, in shared memory, NULL if not available
+static cld_ws_slot *cld_ws_my_slot = NULL; // slot of this process, NULL if not available
+
 // 
 // Get status of apache reply to the client (before it's sent)
 // rp is apache request, 'status' is the status number and
@@ -86,6 +125,16 @@ void cld_ws_add_header (void *rp, const char *n, const char *v)
   apr_table_add(r->headers_out, n, v);
 }
 
+// 
+// Set note name ('n') and value ('v') in apache request. rp is apache request. Notes can be logged
+// with %{name}n in LogFormat. Apache WILL make a copy of n/v
+//
+void cld_ws_set_note (void *rp, const char *n, const char *v)
+{
+  request_rec *r = (request_rec*)rp;
+  apr_table_set(r->notes, n, v);
+}
+
 // 
 // Set header name ('n') and value ('v"0 in apache reply. rp is apache request.
 // This is for setting parts of header where ONLY one should exist (say content-type)
@@ -144,7 +193,9 @@ void cld_ws_set_content_length(void *rp, const char *v)
 int cld_ws_write (void *r, const char *s, int nbyte)
 {
     // one large synchronous write to the web, so it's better to buffer as we do 
-    return ap_rwrite (s, nbyte, (request_rec*)r);
+    int res = ap_rwrite (s, nbyte, (request_rec*)r);
+    if (res > 0 && cld_ws_my_slot != NULL) __sync_fetch_and_add (&(cld_ws_my_slot->bytes), (unsigned long long)res);
+    return res;
 }
 
 // 
@@ -201,6 +252,7 @@ const char *cld_ws_get_env(void * vmr, const char *n)
     int ruser = 0;
     int root = 0;
     int ip = 0;
+    int script = 0;
 
     // 
     // here is the list of variables we obtain (plus REQUEST_METHOD and QUERY_STRING we get above)
@@ -221,7 +273,8 @@ const char *cld_ws_get_env(void * vmr, const char *n)
     (protocol = !strcmp (n, "SERVER_PROTOCOL")) ||
     (ruser = !strcmp (n, "REMOTE_USER")) ||
     (root = !strcmp (n, "DOCUMENT_ROOT")) ||
-    (ip = !strcmp (n, "SERVER_ADDR"))
+    (ip = !strcmp (n, "SERVER_ADDR")) ||
+    (script = !strcmp (n, "SCRIPT_NAME"))
     );
 
     // if not one of the above, it's empty
@@ -259,6 +312,12 @@ const char *cld_ws_get_env(void * vmr, const char *n)
       return FIXNULL(r->user);
     }
 
+    // SCRIPT_NAME, the path of request without query string
+    if (script == 1)
+    {
+      return FIXNULL(r->uri);
+    }
+
     // SERVER_ADDR
     if (ip == 1)
     {
@@ -386,7 +445,184 @@ int cld_ws_util_read (void * rp, char *content, int len)
   return 1;
 }
 
+// 
+// Read POSTed content from the client piece by piece. rp is apache request,
+// 'chunk' is a buffer of 'chunk_len' bytes into which each piece is read, after which
+// 'proc' is called with 'arg', the piece and its length. This way the body does not
+// have to be held in memory in its raw form before it's processed.
+// Returns 0 if error (or if 'proc' returned 0), 1 if successful.
+//
+int cld_ws_util_read_stream (void * rp, char *chunk, int chunk_len, int (*proc)(void *, const char *, int), void *arg)
+{
+  request_rec * r = (request_rec*)rp;
+  int rc;
+  if ((rc = ap_setup_client_block (r, REQUEST_CHUNKED_ERROR)) != OK)
+  {
+      return 0;
+  }
 
+  if (ap_should_client_block (r))
+  {
+      int len_read = 0;
+      while ((len_read = ap_get_client_block (r, chunk, chunk_len)) > 0)
+      {
+          if ((*proc) (arg, chunk, len_read) != 1) return 0;
+      }
+      if (len_read < 0) return 0;
 
+  } else return 0;
+  return 1;
+}
 
 
+// 
+// Apache post_config hook: creates shared memory for metrics in the parent process, before child processes
+// are started (they inherit it). 'pconf' is configuration pool, which is destroyed on restart along with shared memory.
+// 's' is server. Returns OK even if shared memory cannot be created, in which case metrics are not available.
+//
+int cld_ws_post_config (apr_pool_t *pconf, apr_pool_t *plog, apr_pool_t *ptemp, server_rec *s)
+{
+  (void)plog;
+  (void)ptemp;
+  apr_shm_t *shm;
+  apr_status_t rv = apr_shm_create (&shm, sizeof (cld_ws_slot) * CLD_WS_METRICS_SLOTS, NULL, pconf);
+  if (rv != APR_SUCCESS)
+  {
+      ap_log_error (APLOG_MARK, APLOG_ERR, rv, s, "Cannot create shared memory for metrics of [%s], metrics will not be available", cld_handler_name);
+      cld_ws_slots = NULL;
+      return OK;
+  }
+  cld_ws_slots = (cld_ws_slot*) apr_shm_baseaddr_get (shm);
+  memset (cld_ws_slots, 0, sizeof (cld_ws_slot) * CLD_WS_METRICS_SLOTS);
+  return OK;
+}
+
+// 
+// Apache child_init hook: performs process-level initialization (crash handler, curl, time zone etc.) once
+// when Apache child process starts, so that requests don't have to. 'p' is child's pool and 's' is server.
+// Also takes a metrics slot for this process: one never used, or one of a process that no longer exists.
+//
+void cld_ws_child_init (apr_pool_t *p, server_rec *s)
+{
+  (void)p;
+  (void)s;
+  cld_child_init ();
+
+  if (cld_ws_slots == NULL) return;
+  pid_t me = getpid ();
+  int i;
+  for (i = 0; i < CLD_WS_METRICS_SLOTS; i++)
+  {
+      pid_t used = cld_ws_slots[i].pid;
+      if ((used == 0 || (kill (used, 0) == -1 && errno == ESRCH)) && __sync_bool_compare_and_swap (&(cld_ws_slots[i].pid), used, me))
+      {
+          cld_ws_my_slot = &(cld_ws_slots[i]);
+          break;
+      }
+  }
+}
+
+// 
+// Count a finished request in metrics. rp is apache request, 'total_us' is the duration of request in
+// microseconds, 'queries' is the number of database queries executed and 'memory_peak' is the most memory
+// request used. Called at the end of request by Cloudgizer (see cld_timing_done()).
+//
+void cld_ws_metrics (void *rp, long long total_us, int queries, size_t memory_peak)
+{
+  cld_ws_slot *sl = cld_ws_my_slot;
+  if (sl == NULL) return;
+  request_rec *r = (request_rec*)rp;
+  int st = r->status / 100 - 1;
+  if (st < 0 || st > 4) st = 4;
+  __sync_fetch_and_add (&(sl->requests[st]), 1ULL);
+  int b = 0;
+  while (b < CLD_WS_BUCKETS && total_us > cld_ws_bucket_us[b]) b++;
+  __sync_fetch_and_add (&(sl->duration[b]), 1ULL);
+  __sync_fetch_and_add (&(sl->duration_us), (unsigned long long)total_us);
+  __sync_fetch_and_add (&(sl->queries), (unsigned long long)queries);
+  if (memory_peak > sl->memory_peak) sl->memory_peak = memory_peak;
+}
+
+// 
+// Apache handler for metrics in Prometheus text format. It handles requests for 'cld-metrics-<application name>'
+// handler, for instance with SetHandler in a Location. Metrics of all child processes are added up here, without
+// locking, since each process only ever increases the counters in its own slot. r is apache request.
+// Returns DECLINED if this is not a metrics request, OK otherwise.
+//
+int cld_ws_metrics_handler (request_rec *r)
+{
+  if (r->handler == NULL || strncmp (r->handler, "cld-metrics-", 12) || strcmp (r->handler + 12, cld_handler_name)) return DECLINED;
+  if (cld_ws_slots == NULL) return HTTP_SERVICE_UNAVAILABLE;
+
+  cld_ws_slot tot;
+  memset (&tot, 0, sizeof (tot));
+  int procs = 0;
+  int i;
+  int j;
+  for (i = 0; i < CLD_WS_METRICS_SLOTS; i++)
+  {
+      cld_ws_slot *sl = &(cld_ws_slots[i]);
+      if (sl->pid == 0) continue;
+      if (kill (sl->pid, 0) == 0 || errno != ESRCH) procs++;
+      for (j = 0; j < 5; j++) tot.requests[j] += sl->requests[j];
+      for (j = 0; j <= CLD_WS_BUCKETS; j++) tot.duration[j] += sl->duration[j];
+      tot.duration_us += sl->duration_us;
+      tot.queries += sl->queries;
+      tot.bytes += sl->bytes;
+      if (sl->memory_peak > tot.memory_peak) tot.memory_peak = sl->memory_peak;
+  }
+
+  const char *app = cld_handler_name;
+  ap_set_content_type (r, "text/plain; version=0.0.4");
+  ap_rprintf (r, "# HELP cld_requests_total Requests handled, by status class.\n# TYPE cld_requests_total counter\n");
+  unsigned long long count = 0;
+  for (j = 0; j < 5; j++)
+  {
+      ap_rprintf (r, "cld_requests_total{app=\"%s\",code=\"%dxx\"} %llu\n", app, j + 1, tot.requests[j]);
+      count += tot.requests[j];
+  }
+  ap_rprintf (r, "# HELP cld_request_duration_seconds Duration of requests.\n# TYPE cld_request_duration_seconds histogram\n");
+  unsigned long long cumul = 0;
+  for (j = 0; j < CLD_WS_BUCKETS; j++)
+  {
+      cumul += tot.duration[j];
+      ap_rprintf (r, "cld_request_duration_seconds_bucket{app=\"%s\",le=\"%g\"} %llu\n", app, cld_ws_bucket_us[j] / 1e6, cumul);
+  }
+  ap_rprintf (r, "cld_request_duration_seconds_bucket{app=\"%s\",le=\"+Inf\"} %llu\n", app, count);
+  ap_rprintf (r, "cld_request_duration_seconds_sum{app=\"%s\"} %.6f\n", app, tot.duration_us / 1e6);
+  ap_rprintf (r, "cld_request_duration_seconds_count{app=\"%s\"} %llu\n", app, count);
+  ap_rprintf (r, "# HELP cld_db_queries_total Database queries executed.\n# TYPE cld_db_queries_total counter\n");
+  ap_rprintf (r, "cld_db_queries_total{app=\"%s\"} %llu\n", app, tot.queries);
+  ap_rprintf (r, "# HELP cld_response_bytes_total Bytes written to clients.\n# TYPE cld_response_bytes_total counter\n");
+  ap_rprintf (r, "cld_response_bytes_total{app=\"%s\"} %llu\n", app, tot.bytes);
+  ap_rprintf (r, "# HELP cld_request_memory_peak_bytes Most memory used by a single request.\n# TYPE cld_request_memory_peak_bytes gauge\n");
+  ap_rprintf (r, "cld_request_memory_peak_bytes{app=\"%s\"} %llu\n", app, tot.memory_peak);
+  ap_rprintf (r, "# HELP cld_processes Child processes running the application.\n# TYPE cld_processes gauge\n");
+  ap_rprintf (r, "cld_processes{app=\"%s\"} %d\n", app, procs);
+  return OK;
+}
+
+// 
+// Register Apache hooks needed by Cloudgizer. Called when application's module (in mod.c) registers its 
+// handler (see __wrap_ap_hook_handler()). 'p' is Apache pool.
+//
+void cld_ws_register_hooks (apr_pool_t *p)
+{
+  (void)p;
+  ap_hook_post_config (cld_ws_post_config, NULL, NULL, APR_HOOK_MIDDLE);
+  ap_hook_child_init (cld_ws_child_init, NULL, NULL, APR_HOOK_MIDDLE);
+  // metrics handler declines any other request, and it goes first so a Location where application's handler is set can have it too
+  __real_ap_hook_handler (cld_ws_metrics_handler, NULL, NULL, APR_HOOK_FIRST);
+}
+
+// 
+// Application's module is linked with -Wl,--wrap=ap_hook_handler (see cldmakefile), so that registering its handler
+// from register_hooks in mod.c (which is never modified) comes here. The handler is registered as asked ('pf', 'pre',
+// 'succ' and 'order' are the same as for ap_hook_handler()), and so are the hooks Cloudgizer needs. This happens 
+// each time Apache loads the module, including on restart.
+//
+void __wrap_ap_hook_handler (int (*pf) (request_rec *), const char * const *pre, const char * const *succ, int order)
+{
+  __real_ap_hook_handler (pf, pre, succ, order);
+  cld_ws_register_hooks (NULL);
+}
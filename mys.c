@@ -34,19 +34,73 @@ You may obtain a copy of the License at
 //
 
 
-// 
-// set in a caller (CLD generates this) so that errors in SQL code have a caller contents
-// (function name and line number)
-//
-extern const char *func_name;
-extern int func_line;
 
 // max number of columns
 #define MYS_COL_LIMIT 4096
 
+// largest initial buffer for a column of streamed query result, longer values get a buffer of their own
+#define MYS_STREAM_COL_BUF 1024
+
+// smallest buffer for a column of prepared statement result
+#define MYS_MIN_COL_BUF 64
+
+// rows of a streamed query are read ahead this many at a time (see cld_stream_store())
+#define CLD_INITIAL_QUERY_BATCH 200
+
+// initial size of result data for each column of a prepared statement, unless the longest values need less 
+#define MYS_AVG_COL_LEN 32
+
+// longest text of a number obtained in binary form (define-query#...typed)
+#define MYS_NUM_LEN 32
+
+
+// 
+// Slow statement not yet written to slow query log, because the rows and bytes it returned (or affected) are known
+// only once its result is (see cld_stmt_time())
+//
+typedef struct cld_slow_stmt_s
+{
+    int is_pending; // 1 if there is a slow statement to write
+    cld_qry_site *site; // query site of statement, or NULL if none
+    const char *file; // source file and line of statement
+    int line;
+    char name[30]; // name of query, or the first word of statement if no query site
+    long long us; // time to execute statement
+    long long rows; // rows of site when statement executed, or affected rows if no query site
+    long long bytes; // bytes of site when statement executed
+} cld_slow_stmt;
+static cld_slow_stmt cld_slow = {0, NULL, NULL, 0, {0}, 0, 0, 0};
 
 // function prototypes
 int cld_handle_error (const char *s, MYSQL *con, unsigned int *er, const char **err_message, int retry);
+static void cld_qry_site_time (long long us, int is_fetch);
+static void cld_stmt_time (const char *s, long long us);
+static void cld_close_stmts ();
+static int cld_run_stmt (cld_qry_site *site, const char *s, int num_of_args, const char **args, MYSQL_STMT **stmt, unsigned int *er, const char **err_message);
+static int cld_stream_fetch (cld_stream *st, char **row);
+static void cld_stream_store (cld_stream *st);
+static void cld_free_result (void *res);
+static int cld_db_connect (MYSQL **con, const char *fname, unsigned long flags, int replica);
+static void cld_result_rows (MYSQL_RES *result, int *nrow, int *ncol, char ***col_names, char ***data, unsigned long **lengths);
+static int cld_async_poll (MYSQL *con, int status);
+static void cld_close_async ();
+static void cld_async_finish (cld_async *a);
+static void cld_async_send (cld_async *a, const char *sql);
+static int cld_add_sql_table (const char *w, int len, char *tables, int tables_len);
+static unsigned long cld_qry_cache_hash (const char *key);
+static void cld_qry_cache_remove (cld_qry_cache *qc, cld_qry_cache_entry *e);
+static int cld_is_read_only (const char *s);
+static MYSQL *cld_replica_con (const char *s);
+static void cld_replica_failed (MYSQL *con, unsigned int er);
+static void cld_close_replica ();
+static MYSQL *cld_replica_query (const char *s);
+static MYSQL_STMT *cld_replica_stmt (cld_qry_site *site, const char *s, int num_of_args, const char **args);
+static MYSQL_BIND *cld_stmt_bind (const char *s, int num_of_args, const char **args, unsigned long **lens);
+static char *cld_stmt_SQL (const char *s, int num_of_args, const char **args);
+static int cld_prefetch_cmp_key (const void *a, const void *b);
+static int cld_prefetch_cmp_row (const void *a, const void *b);
+static int cld_prefetch_cmp (const char *key, int len, const char *val);
+static int cld_prefetch_is_key (const char *val, int len);
 
 // 
 // Close database connection
@@ -55,9 +109,73 @@ int cld_handle_error (const char *s, MYSQL *con, unsigned int *er, const char **
 void cld_close_db_conn ()
 {
     CLD_TRACE("");
+    cld_close_async ();
+    cld_close_replica ();
     cld_get_db_connection (NULL);
 }
 
+// 
+// Connect '*con' (obtained with mysql_init()) to database with credentials in file 'fname', and set it up
+// the way all connections are. 'flags' are client flags for mysql_real_connect(). 'replica' is 0 for the 
+// database, or the number of read replica in credentials file (starting with 1). On failure, error is reported,
+// except for a replica, when 0 is returned. Returns 1 if connected.
+//
+static int cld_db_connect (MYSQL **con, const char *fname, unsigned long flags, int replica)
+{
+    // Obtain credentials from a secure store
+    // and wipe them from memory once connection is
+    // established
+    char host[CLD_SECURITY_FIELD_LEN + 1];
+    char name[CLD_SECURITY_FIELD_LEN + 1];
+    char passwd[CLD_SECURITY_FIELD_LEN + 1];
+    char db[CLD_SECURITY_FIELD_LEN + 1];
+    if (cld_get_credentials(host,name,passwd,db,fname,replica) != 0)
+    {
+        if (replica != 0) return 0;
+        *con = NULL;
+        struct passwd *pwd = getpwuid(geteuid()); 
+
+        cld_report_error ("Cannot get database credentials, make sure default credentials file has the correct server name, user name, password and existing database name. Credentials file is [%s]: it must have access permission of 600, it must be owned by this user (%s) and the directory leading to it must be accessible to this user", fname, pwd->pw_name);
+        return 0;
+    }
+
+    CLD_TRACE ("Logging in to database: Connecting to host [%s], user [%s], passwd [%s], db [%s]", host, name, passwd, db);
+    if (mysql_real_connect(*con, host, name, passwd, 
+                   db, 0, NULL, flags) == NULL) 
+    {
+        CLD_TRACE("Error is [%s]", mysql_error(*con));
+        memset(passwd, 0, CLD_SECURITY_FIELD_LEN);
+        if (replica != 0) return 0;
+        cld_report_error ("Error in logging in to database: Connecting to host [%s], user [%s], passwd [...], db [%s], error [%s]", host, name, db, mysql_error(*con));
+        return 0;
+    }    
+
+    memset(host, 0, CLD_SECURITY_FIELD_LEN);
+    memset(name, 0, CLD_SECURITY_FIELD_LEN);
+    memset(passwd, 0, CLD_SECURITY_FIELD_LEN);
+    memset(db, 0, CLD_SECURITY_FIELD_LEN);
+
+    //
+    // These are the most common settings. ANSI_QUOTES means that single quotes
+    // are used for string and defense agains SQL injection depends on this (could be done
+    // either way or for both, but the odds are ansi_quotes is used anyway). UTF8 is used for
+    // web communication.
+    // So in short, do NOT change either one of these settings!
+    //
+    if (mysql_query(*con, "set names utf8")) 
+    {
+        if (replica != 0) return 0;
+        cld_report_error ("Cannot set names to utf8");
+    }
+
+    if (mysql_query(*con, "set session sql_mode=ansi_quotes")) 
+    {
+        if (replica != 0) return 0;
+        cld_report_error ("Cannot set sql_mode to ansi_quotes");
+    }
+    return 1;
+}
+
 // 
 // Get database connection. 'fname' is the file name with database
 // credentials. Caches connection and connects ONE TIME only. We use
@@ -81,6 +199,7 @@ MYSQL *cld_get_db_connection (const char *fname)
             *(CTX.db.is_begin_transaction) = 0; // we are no longer in a transaction if
                         // connection closed
 
+            cld_close_stmts ();
             mysql_close (*(CTX.db.g_con));
             *(CTX.db.g_con) = NULL;
             return NULL;
@@ -130,6 +249,9 @@ MYSQL *cld_get_db_connection (const char *fname)
     *(CTX.db.is_begin_transaction) = 0; // we are no longer in a transaction if
                         // connection is being (re)opened, this is implicit rollback
 
+    // statements prepared on a lost connection cannot be used on a new one
+    cld_close_stmts ();
+
     *(CTX.db.g_con) = mysql_init(NULL);
    
     if (*(CTX.db.g_con) == NULL) 
@@ -137,53 +259,7 @@ MYSQL *cld_get_db_connection (const char *fname)
         cld_report_error ("Cannot initialize database connection");
         return NULL; // just for compiler, never gets here
     }  
-
-    // Obtain credentials from a secure store
-    // and wipe them from memory once connection is
-    // established
-    char host[CLD_SECURITY_FIELD_LEN + 1];
-    char name[CLD_SECURITY_FIELD_LEN + 1];
-    char passwd[CLD_SECURITY_FIELD_LEN + 1];
-    char db[CLD_SECURITY_FIELD_LEN + 1];
-    if (cld_get_credentials(host,name,passwd,db,fname) != 0)
-    {
-        *(CTX.db.g_con) = NULL;
-        struct passwd *pwd = getpwuid(geteuid()); 
-
-        cld_report_error ("Cannot get database credentials, make sure default credentials file has the correct server name, user name, password and existing database name. Credentials file is [%s]: it must have access permission of 600, it must be owned by this user (%s) and the directory leading to it must be accessible to this user", fname, pwd->pw_name);
-        return NULL;
-    }
-
-    CLD_TRACE ("Logging in to database: Connecting to host [%s], user [%s], passwd [%s], db [%s]", host, name, passwd, db);
-    if (mysql_real_connect(*(CTX.db.g_con), host, name, passwd, 
-                   db, 0, NULL, 0) == NULL) 
-    {
-        CLD_TRACE("Error is [%s]", mysql_error(*(CTX.db.g_con)));
-        cld_report_error ("Error in logging in to database: Connecting to host [%s], user [%s], passwd [...], db [%s], error [%s]", host, name, db, mysql_error(*(CTX.db.g_con)));
-        return NULL;
-    }    
-
-    memset(host, 0, CLD_SECURITY_FIELD_LEN);
-    memset(name, 0, CLD_SECURITY_FIELD_LEN);
-    memset(passwd, 0, CLD_SECURITY_FIELD_LEN);
-    memset(db, 0, CLD_SECURITY_FIELD_LEN);
-
-    //
-    // These are the most common settings. ANSI_QUOTES means that single quotes
-    // are used for string and defense agains SQL injection depends on this (could be done
-    // either way or for both, but the odds are ansi_quotes is used anyway). UTF8 is used for
-    // web communication.
-    // So in short, do NOT change either one of these settings!
-    //
-    if (mysql_query(*(CTX.db.g_con), "set names utf8")) 
-    {
-        cld_report_error ("Cannot set names to utf8");
-    }
-
-    if (mysql_query(*(CTX.db.g_con), "set session sql_mode=ansi_quotes")) 
-    {
-        cld_report_error ("Cannot set sql_mode to ansi_quotes");
-    }
+    cld_db_connect (CTX.db.g_con, fname, 0, 0);
     return *(CTX.db.g_con);
 }
              
@@ -236,11 +312,18 @@ int cld_check_transaction(int check_mode)
 int cld_commit()
 {
     CLD_TRACE("");
+    if (CTX.stream != NULL) cld_stream_store (CTX.stream);
+    if (CTX.bulk != NULL) cld_bulk_flush (NULL, NULL);
     const char *fname=cld_get_config ()->app.db;
 
     *(CTX.db.is_begin_transaction) = 0;
 
-    return mysql_commit (cld_get_db_connection (fname));
+    cld_get_config ()->timing.queries++;
+    struct timespec query_start;
+    clock_gettime (CLOCK_MONOTONIC, &query_start);
+    int res = mysql_commit (cld_get_db_connection (fname));
+    cld_stmt_time ("commit", cld_timing_add (CLD_PHASE_DB, &query_start));
+    return res;
 }
 
 // 
@@ -250,11 +333,19 @@ int cld_commit()
 int cld_rollback()
 {
     CLD_TRACE("");
+    if (CTX.stream != NULL) cld_stream_store (CTX.stream);
+    // rows not yet inserted were added in transaction, so they're discarded with it
+    CTX.bulk = NULL;
     const char *fname=cld_get_config ()->app.db;
 
     *(CTX.db.is_begin_transaction) = 0;
 
-    return mysql_rollback (cld_get_db_connection (fname));
+    cld_get_config ()->timing.queries++;
+    struct timespec query_start;
+    clock_gettime (CLOCK_MONOTONIC, &query_start);
+    int res = mysql_rollback (cld_get_db_connection (fname));
+    cld_stmt_time ("rollback", cld_timing_add (CLD_PHASE_DB, &query_start));
+    return res;
 }
 
 
@@ -297,8 +388,22 @@ int cld_execute_SQL (const char *s,  int *rows, unsigned int *er, const char **e
     
     CLD_TRACE ("Query executing: [%s]", s);
 
+    // rows of a query being read one at a time must all be read before another query can execute
+    if (CTX.stream != NULL) cld_stream_store (CTX.stream);
+    // and rows added to INSERT must be inserted, since query may use them
+    if (CTX.bulk != NULL) cld_bulk_flush (NULL, NULL);
+
+    // query results kept in process may no longer be valid
+    cld_invalidate_cache (s);
+    if (CTX.is_written == 0 && cld_is_read_only (s) == 0) CTX.is_written = 1;
+
     *er = 0;
 
+    // time spent executing queries is measured for each request (see cld_timing_done())
+    cld_get_config ()->timing.queries++;
+    struct timespec query_start;
+    clock_gettime (CLOCK_MONOTONIC, &query_start);
+
 
     if (mysql_query(cld_get_db_connection (fname), s)) 
     {
@@ -324,6 +429,7 @@ int cld_execute_SQL (const char *s,  int *rows, unsigned int *er, const char **e
                 // This means there was an error which is not 'lost connection'. Return to application
                 //
                 *rows = 0;
+                cld_stmt_time (s, cld_timing_add (CLD_PHASE_DB, &query_start));
                 return 0;
             }
             else
@@ -342,6 +448,7 @@ int cld_execute_SQL (const char *s,  int *rows, unsigned int *er, const char **e
                     //
                     cld_handle_error (s, cld_get_db_connection (fname), er, err_message, 0);
                     *rows = 0;
+                    cld_stmt_time (s, cld_timing_add (CLD_PHASE_DB, &query_start));
                     return 0;
                 }
                 else
@@ -362,6 +469,7 @@ int cld_execute_SQL (const char *s,  int *rows, unsigned int *er, const char **e
             //
             cld_handle_error (s, cld_get_db_connection (fname), er, err_message, 0);
             *rows = 0;
+            cld_stmt_time (s, cld_timing_add (CLD_PHASE_DB, &query_start));
             return 0;
         }
     }
@@ -373,173 +481,1606 @@ int cld_execute_SQL (const char *s,  int *rows, unsigned int *er, const char **e
     // for SELECT, this may be -1 - it's incorrect until mysql_store_result is called or all
     // date retrieved with mysql_use_result!!!
     CLD_TRACE("Query OK, affected rows [%d] - incorrect for SELECT, see further for that.", *rows);
+    cld_stmt_time (s, cld_timing_add (CLD_PHASE_DB, &query_start));
+    // statement that doesn't return a result set has the number of affected rows
+    if (CTX.qry_site != NULL && mysql_field_count (cld_get_db_connection (fname)) == 0) CTX.qry_site->rows += *rows;
+    // statement without query site has only affected rows for slow query log
+    if (CTX.qry_site == NULL && cld_slow.is_pending == 1 && cld_slow.site == NULL && mysql_field_count (cld_get_db_connection (fname)) == 0) cld_slow.rows = *rows;
 
     return 1;
 }
 
 
 //
-// Handle error of execution of SQL. 's' is the statement. 'con' is the db connection.
-// 'er' is the output error, and its text is in output variable err_message.
-// If 'retry' is 1 AND this is a lost connection, try to reconnect ONCE. If 'retry' is 1 AND this
-// is something other than lost connection, then handle it by returning 0. If 'retry' is 0, NEVER try to reconnect regardless.
-// If this is lost connection and reconnection failed (or was never tried because retry is 0), then stop program.
-// Returns 1 if reconnect was successful (meaning retry had to be 1 for this to happen), 0 in any other case.
+// Returns 1 if SQL 's' only reads data (SELECT, SHOW or EXPLAIN), 0 otherwise.
 //
-int cld_handle_error (const char *s, MYSQL *con, unsigned int *er, const char **err_message, int retry)
+static int cld_is_read_only (const char *s)
 {
-    CLD_TRACE("");
-    // This static is fine - it is used only within a single request, i.e. it doesnt span multiple request.
-    // Errm is set HERE and used right after it - it doesn't go beyond a request.
-    static char errm[8192];
-    assert (s != NULL);
-    assert (con != NULL);
-    assert (er != NULL);
+    while (isspace (*s) || *s == '(') s++;
+    return (strncasecmp (s, "select", 6) == 0 || strncasecmp (s, "show", 4) == 0 || strncasecmp (s, "explain", 7) == 0) ? 1 : 0;
+}
 
-    CLD_TRACE ("Error in %s: %s error %d state %s", s, mysql_error(con), mysql_errno(con), 
-        mysql_sqlstate(con));
+//
+// Get connection to read replica for SELECT 's', connecting if needed. Replicas are listed in .db file (see cld_get_credentials()),
+// and each process starts with a different one, so load is spread among them. A replica that can't be connected to isn't tried 
+// again for CLD_REPLICA_RETRY seconds, and the next one is used. 
+// Returns NULL if query must go to the database: there are no replicas (or none is available), we're in a transaction, 
+// request already changed data (and must see its own changes, which replica may not have yet), or query locks rows or asks 
+// about the last statement on the connection.
+//
+static MYSQL *cld_replica_con (const char *s)
+{
+    cld_replica *r = CTX.db.replica;
+    if (r == NULL || r->num == 0) return NULL;
+    if (*(CTX.db.is_begin_transaction) == 1 || CTX.is_written == 1) return NULL;
+    if (strcasestr (s, "for update") != NULL || strcasestr (s, "lock in share mode") != NULL 
+        || strcasestr (s, "last_insert_id") != NULL || strcasestr (s, "found_rows") != NULL) return NULL;
 
-    int local_error = mysql_errno (con);
+    const char *fname=cld_get_config ()->app.db;
+    if (r->num == -1)
+    {
+        // count replicas once per process
+        char host[CLD_SECURITY_FIELD_LEN + 1];
+        char name[CLD_SECURITY_FIELD_LEN + 1];
+        char passwd[CLD_SECURITY_FIELD_LEN + 1];
+        char db[CLD_SECURITY_FIELD_LEN + 1];
+        r->num = 0;
+        while (r->num < CLD_MAX_REPLICAS && cld_get_credentials (host, name, passwd, db, fname, r->num + 1) == 0) r->num++;
+        memset(passwd, 0, CLD_SECURITY_FIELD_LEN);
+        CLD_TRACE ("Found [%d] read replicas", r->num);
+        if (r->num == 0) return NULL;
+        r->curr = (int)(getpid () % r->num) + 1;
+    }
+    if (r->con != NULL) return r->con;
 
-    // get location in source code (if set, CLD automatically does this)
-    char *sname = "";
-    int lnum = 0;
-    cld_location (&sname, &lnum, 0);
+    time_t now = time (NULL);
+    int i;
+    for (i = 0; i < r->num; i++)
+    {
+        int k = (r->curr - 1 + i) % r->num + 1;
+        if (r->down_until[k] > now) continue;
+        MYSQL *con = mysql_init (NULL);
+        if (con == NULL) return NULL;
+        if (cld_db_connect (&con, fname, 0, k) == 1)
+        {
+            CLD_TRACE ("Connected to read replica [%d]", k);
+            r->con = con;
+            r->curr = k;
+            return con;
+        }
+        CLD_TRACE ("Cannot connect to read replica [%d], error [%s]", k, mysql_error (con));
+        mysql_close (con);
+        r->down_until[k] = now + CLD_REPLICA_RETRY;
+    }
+    return NULL;
+}
 
-    switch (local_error)
+//
+// Query on read replica connection 'con' failed with error 'er'. If replica is unreachable or connection is lost (an error from
+// client library), it's closed and not used for CLD_REPLICA_RETRY seconds. Either way, query executes on the database next.
+//
+static void cld_replica_failed (MYSQL *con, unsigned int er)
+{
+    cld_replica *r = CTX.db.replica;
+    CLD_TRACE ("Query failed on read replica [%d], error [%u], [%s]", r->curr, er, mysql_error (con));
+    if (er >= CR_MIN_ERROR && er <= CR_MAX_ERROR)
     {
-        case ER_DUP_ENTRY:
-        case ER_DUP_ENTRY_WITH_KEY_NAME:
-            /* this can happen in insert with duplicate key or update that leads to 
-             * duplicate key */
-            CLD_TRACE ("Duplicate key detected, no changes made");
-            *er = ER_DUP_ENTRY;
-            break;
-         case CR_SERVER_GONE_ERROR:
-         case CR_SERVER_LOST:
-            // Go away if db connection lost, or try to reconnect if retry is 1
+        r->down_until[r->curr] = time (NULL) + CLD_REPLICA_RETRY;
+        cld_close_replica ();
+    }
+}
 
-            //
-            // If we're instructed to retry, we will
-            //
-            if (retry == 1) 
-            {
-                //
-                // Retry connection
-                //
-                //
-                // First we must reset connection we have already. It's lost so we're not calling mysql_close().
-                // Without this, an attempt to retry connection would not work, and would just return the old cached bad
-                // connection
-                //
-                *(CTX.db.g_con) = NULL;
-                //
-                // Retry it
-                //
-                if (cld_get_db_connection (cld_get_config()->app.db) == NULL)
-                {
-                    //
-                    // Here we wanted to retry but it failed - stop program
-                    //
-                    cld_report_error ("Connection to database server is lost (after a retry), found [%s], line [%d], file [%s]", s, lnum,sname);
-                }
-                else
-                {
-                    //
-                    // Retry was instructed and successful
-                    //
-                    CLD_TRACE("Reconnecting to database OKAY");
-                    return 1;
-                }
-            }
-            else
+//
+// Close connection to read replica, and statements prepared on it.
+//
+static void cld_close_replica ()
+{
+    cld_replica *r = CTX.db.replica;
+    if (r == NULL || r->con == NULL) return;
+    if (CTX.db.qry_stats != NULL)
+    {
+        cld_qry_site *site;
+        for (site = CTX.db.qry_stats->sites; site != NULL; site = site->next)
+        {
+            if (site->replica_stmt != NULL)
             {
-                //
-                // we don't want to retry connection, fail it
-                //
-                cld_report_error ("Connection to database server is lost (without retry), found [%s], line [%d], file [%s]", s, lnum,sname);
+                mysql_stmt_close (site->replica_stmt);
+                site->replica_stmt = NULL;
             }
-         default:
-            // Probably a fatal error, application must handle
-            *er = local_error;
-            snprintf(errm,sizeof(errm)-1,"Error during query [%s], file [%s], line [%d] : [%d]%s", s, sname, lnum, *er ,*er == ER_PARSE_ERROR ?
-                "Problem with parsing SQL statement" : mysql_error(con));
-            CLD_TRACE("%s", errm);
-            if (err_message!=NULL) *err_message=errm;
-            break;
+        }
     }
-    return 0;
+    r->num_stmts = 0;
+    mysql_close (r->con);
+    r->con = NULL;
 }
 
 //
-// Set location of SQL statement. Before it's executed, we set file name (fname),
-// line number (lnum) and 'set' is 1. If there was an error, we can use this information
-// to point back to the exact line where problem happened.
+// Execute SELECT 's' on read replica (see cld_replica_con()). Returns replica connection to get results from, or NULL if 
+// query must execute on the database instead.
 //
-void cld_location (char **fname, int *lnum, int set)
+static MYSQL *cld_replica_query (const char *s)
 {
     CLD_TRACE("");
-    // this static variables are fine, they are used only within a single request. 
-    // Before SQL is executed, cld_location is called, and if there is an error, we would
-    // return that value - meaning these values are ALWAYS set in the process and THEN used
-    static char *fname_loc = "";
-    static int lnum_loc = 0;
-
-    if (set == 1)
-    {
-        fname_loc = *fname;
-        lnum_loc = *lnum;
-    }
-    else
+    // same as in cld_execute_SQL(), and rows added to INSERT are inserted first, which means SELECT can't go to replica
+    if (CTX.stream != NULL) cld_stream_store (CTX.stream);
+    if (CTX.bulk != NULL) cld_bulk_flush (NULL, NULL);
+
+    MYSQL *con = cld_replica_con (s);
+    if (con == NULL) return NULL;
+    CLD_TRACE ("Query executing on read replica [%d]: [%s]", CTX.db.replica->curr, s);
+
+    cld_get_config ()->timing.queries++;
+    struct timespec query_start;
+    clock_gettime (CLOCK_MONOTONIC, &query_start);
+    if (mysql_query (con, s) != 0)
     {
-        *fname = fname_loc;
-        *lnum = lnum_loc;
+        cld_replica_failed (con, mysql_errno (con));
+        cld_timing_add (CLD_PHASE_DB, &query_start);
+        return NULL;
     }
-} 
+    cld_stmt_time (s, cld_timing_add (CLD_PHASE_DB, &query_start));
+    return con;
+}
 
-// 
-// Select SQL. 's' is the text of the SQL and it must start with 'select'. 
-//
-// Outputs are 'nrow' (the number of rows in the result),
-// 'ncol' (the number of columns in the result), 'col_names' is a pointer to an array (allocated here) that contains all
-// column names with CLD_MAX_QUERY_OUTPUTS being the max size of the array, 'data' (if not NULL) is 
-// the buffer allocated by the function that contains all data from the select. 
 //
-// 'data' can be NULL, but col_name cannot be. 
-// Each column is present (NULL is the same as empty, or "", we do NOT make a distinction).
-// 'data' is an array of pointers, whereby each array entry points to a single column. For example, if a 
-// query SELECT X,Y FROM T; selects 3 rows, then data[0]={pointer to  X in 1st row}, data[1]={pointer to
-// Y in 1st row}, data[2]={pointer to X in 2nd row}, data[3]={pointer to Y in 2nd row}, data[4]={pointer to
-// X in 3rd row}, data[5]={pointer to Y in 3rd row}.
+// Close all statements prepared on current db connection (see cld_run_stmt()). Called when connection is closed
+// or lost, after which statements will be prepared again on a new connection.
 //
-void cld_select_table (const char *s,
-                  int *nrow, 
-                  int *ncol, 
-                  char ***col_names,
-                  char ***data)
-                  
+static void cld_close_stmts ()
 {
     CLD_TRACE("");
-    assert (nrow);
-    assert (ncol);
-    assert (s);
-    const char *fname=cld_get_config ()->app.db;
-
-
-    char *sname = "";
-    int lnum = 0;
-    // get location in end-user source code where this is called from, for error reporting purposes
-    cld_location (&sname, &lnum, 0);
-
-    if (col_names==NULL)
+    if (CTX.db.qry_stats == NULL) return;
+    cld_qry_site *site;
+    for (site = CTX.db.qry_stats->sites; site != NULL; site = site->next)
     {
-        cld_report_error ("col_names must be non-NULL (programming error), found [%s], line [%d], file [%s]", s, lnum,sname);
+        if (site->stmt != NULL)
+        {
+            mysql_stmt_close (site->stmt);
+            site->stmt = NULL;
+        }
     }
+    CTX.db.qry_stats->num_stmts = 0;
+}
 
-
-    // check this is SELECT and nothing else
-    if (strncasecmp (s, "select", 6))
-    {
+//
+// Bind 'num_of_args' input parameters 'args' of prepared statement 's' as strings, trimmed if trim-query-input is in effect,
+// which is the same as what cld_make_SQL() does when it substitutes them in SQL text, only there's nothing to escape. 
+// Output 'lens' is allocated array of their lengths, which the binding points to.
+// Returns allocated binding, or NULL if there are no input parameters.
+//
+static MYSQL_BIND *cld_stmt_bind (const char *s, int num_of_args, const char **args, unsigned long **lens)
+{
+    MYSQL_BIND *bind = NULL;
+    *lens = NULL;
+    if (num_of_args > 0)
+    {
+        bind = (MYSQL_BIND*)cld_calloc (num_of_args, sizeof (MYSQL_BIND));
+        *lens = (unsigned long*)cld_calloc (num_of_args, sizeof (unsigned long));
+    }
+    int to_trim = cld_get_config()->ctx.trim_query_input;
+    int i;
+    for (i = 0; i < num_of_args; i++)
+    {
+        const char *val = args[i];
+        if (val == NULL)
+        {
+            cld_report_error ("Input parameter #%d is NULL for SQL statement [%s]", i + 1, s);
+        }
+        unsigned long len = strlen (val);
+        if (to_trim == 1)
+        {
+            while (len != 0 && isspace (*val)) { val++; len--; }
+            while (len != 0 && isspace (val[len - 1])) len--;
+        }
+        (*lens)[i] = len;
+        bind[i].buffer_type = MYSQL_TYPE_STRING;
+        bind[i].buffer = (void*)val;
+        bind[i].buffer_length = len;
+        bind[i].length = &((*lens)[i]);
+    }
+    return bind;
+}
+
+//
+// Make SQL text from prepared statement 's' (see cld_run_stmt()) by putting each of 'num_of_args' input parameters 'args'
+// in place of its '?', quoted and escaped the same as cld_make_SQL() does, and trimmed if trim-query-input is in effect.
+// A '?' in a string, quoted name or comment isn't a parameter. Used when statement can't be prepared.
+// Returns allocated SQL text.
+//
+static char *cld_stmt_SQL (const char *s, int num_of_args, const char **args)
+{
+    CLD_TRACE("");
+    int to_trim = cld_get_config()->ctx.trim_query_input;
+    // each byte of a parameter may be doubled when escaped, and it's quoted
+    size_t size = strlen (s) + 1;
+    int i;
+    for (i = 0; i < num_of_args; i++)
+    {
+        // same as with prepared statement (see cld_stmt_bind())
+        if (args[i] == NULL)
+        {
+            cld_report_error ("Input parameter #%d is NULL for SQL statement [%s]", i + 1, s);
+        }
+        size += 2 * strlen (args[i]) + 2;
+    }
+    char *sql = (char*)cld_malloc (size);
+
+    char *d = sql;
+    int arg = 0;
+    const char *p = s;
+    while (*p != 0)
+    {
+        if (*p == '\'' || *p == '"' || *p == '`')
+        {
+            // copy string or quoted name as it is, up to its closing quote
+            char q = *p;
+            *d++ = *p++;
+            while (*p != 0)
+            {
+                if (*p == '\\' && q != '`' && *(p + 1) != 0) *d++ = *p++;
+                else if (*p == q && *(p + 1) != q) { *d++ = *p++; break; }
+                else if (*p == q) *d++ = *p++;
+                *d++ = *p++;
+            }
+            continue;
+        }
+        if ((*p == '-' && *(p + 1) == '-') || *p == '#' || (*p == '/' && *(p + 1) == '*'))
+        {
+            // copy comment as it is
+            const char *end = (*p == '/' ? strstr (p + 2, "*/") : strchr (p, '\n'));
+            size_t len = (end == NULL ? strlen (p) : (size_t)(end - p) + (*p == '/' ? 2 : 0));
+            memcpy (d, p, len);
+            d += len;
+            p += len;
+            continue;
+        }
+        if (*p != '?')
+        {
+            *d++ = *p++;
+            continue;
+        }
+        p++;
+        if (arg >= num_of_args)
+        {
+            cld_report_error ("Too many input parameters in SQL statement [%s], expected [%d]", s, num_of_args);
+        }
+        const char *val = args[arg++];
+        size_t len = strlen (val);
+        if (to_trim == 1)
+        {
+            while (len != 0 && isspace (*val)) { val++; len--; }
+            while (len != 0 && isspace (val[len - 1])) len--;
+        }
+        *d++ = '\'';
+        size_t k;
+        for (k = 0; k < len; k++)
+        {
+            if (val[k] == '\\') *d++ = '\\';
+            else if (val[k] == '\'') *d++ = '\'';
+            *d++ = val[k];
+        }
+        *d++ = '\'';
+    }
+    *d = 0;
+    if (arg != num_of_args)
+    {
+        cld_report_error ("Expected [%d] input parameters for SQL statement [%s], found [%d]", arg, s, num_of_args);
+    }
+    CLD_TRACE ("Prepared statement as SQL text: [%s]", sql);
+    return sql;
+}
+
+//
+// Execute prepared statement for query site 'site'. 's' is the SQL with a '?' in place of each input parameter, and 'args'
+// are 'num_of_args' input parameters. Each is bound as a string and trimmed if trim-query-input is in effect, which is
+// the same as what cld_make_SQL() does when it substitutes them in SQL text, only there's nothing to escape.
+// Statement is prepared the first time site is executed on a db connection, and reused afterwards. If it can't be prepared
+// (such as when server has too many prepared statements), or there are already CLD_MAX_STMTS statements prepared on the 
+// connection, it executes as SQL text instead (see cld_stmt_SQL()) with cld_execute_SQL(), and its result, if any, is 
+// then obtained from db connection.
+// Output 'stmt' is the executed statement, or NULL if it executed as SQL text, 'er' and 'err_message' are the same as 
+// for cld_execute_SQL().
+// Returns  0 if there is an error, 1 if it is okay.
+//
+static int cld_run_stmt (cld_qry_site *site, const char *s, int num_of_args, const char **args, MYSQL_STMT **stmt, unsigned int *er, const char **err_message)
+{
+    CLD_TRACE("");
+    const char *fname=cld_get_config ()->app.db;
+    assert (site);
+    assert (s);
+    assert (er);
+
+    CLD_TRACE ("Prepared statement executing: [%s]", s);
+
+    // rows of a query being read one at a time must all be read before another query can execute
+    if (CTX.stream != NULL) cld_stream_store (CTX.stream);
+    // and rows added to INSERT must be inserted, since query may use them
+    if (CTX.bulk != NULL) cld_bulk_flush (NULL, NULL);
+    if (CTX.is_written == 0 && cld_is_read_only (s) == 0) CTX.is_written = 1;
+
+    // statements are closed on reconnect through the list of sites, so a site must be in it
+    if (site->is_listed == 0)
+    {
+        cld_report_error ("Query site is not registered for prepared statement [%s] (programming error)", s);
+    }
+
+    *er = 0;
+    *stmt = NULL;
+
+    // time spent executing queries is measured for each request (see cld_timing_done())
+    struct timespec query_start;
+    clock_gettime (CLOCK_MONOTONIC, &query_start);
+
+    unsigned long *lens;
+    MYSQL_BIND *bind = cld_stmt_bind (s, num_of_args, args, &lens);
+    int as_text = 0;
+
+    //
+    // If we're not in a transaction, try to reconnect ONCE if connection was lost, same as cld_execute_SQL().
+    //
+    int retried = 0;
+    while (1)
+    {
+        MYSQL *con = cld_get_db_connection (fname);
+        MYSQL_STMT *st = site->stmt;
+        if (st == NULL && CTX.db.qry_stats->num_stmts >= CLD_MAX_STMTS)
+        {
+            CLD_TRACE ("Too many statements prepared on db connection, executing as SQL text");
+            as_text = 1;
+            break;
+        }
+        if (st == NULL)
+        {
+            st = mysql_stmt_init (con);
+            if (st == NULL)
+            {
+                cld_report_error ("Cannot allocate prepared statement [%s]", s);
+            }
+            // get the length of the longest value for each column, so result buffers can be sized (see cld_select_stmt())
+            my_bool max_len = 1;
+            mysql_stmt_attr_set (st, STMT_ATTR_UPDATE_MAX_LENGTH, &max_len);
+            if (mysql_stmt_prepare (st, s, strlen (s)) != 0) 
+            {
+                // if it's an error in SQL, or connection is lost, it's handled when executing SQL text
+                CLD_TRACE ("Cannot prepare statement, error [%u], [%s], executing as SQL text", mysql_stmt_errno (st), mysql_stmt_error (st));
+                mysql_stmt_close (st);
+                as_text = 1;
+                break;
+            }
+            if (mysql_stmt_param_count (st) != (unsigned long)num_of_args)
+            {
+                cld_report_error ("Expected [%lu] input parameters for SQL statement [%s], found [%d]", mysql_stmt_param_count (st), s, num_of_args);
+            }
+            site->stmt = st;
+            CTX.db.qry_stats->num_stmts++;
+        }
+        if (mysql_stmt_bind_param (st, bind) == 0 && mysql_stmt_execute (st) == 0)
+        {
+            *stmt = st;
+            break;
+        }
+
+        // errors from the server are on the connection, but those from the client library may only be on the statement
+        if (mysql_errno (con) == 0)
+        {
+            cld_report_error ("Error in prepared statement [%s], error [%s]", s, mysql_stmt_error (st));
+        }
+        // statement is closed if connection was reestablished
+        if (cld_handle_error (s, con, er, err_message, (retried == 0 && *(CTX.db.is_begin_transaction) == 0) ? 1 : 0) == 1)
+        {
+            // try again on a new connection
+            retried = 1;
+            continue;
+        }
+        cld_get_config ()->timing.queries++;
+        cld_stmt_time (s, cld_timing_add (CLD_PHASE_DB, &query_start));
+        return 0;
+    }
+    if (as_text == 1)
+    {
+        // time spent trying to prepare is database time, and the query itself is counted by cld_execute_SQL()
+        cld_timing_add (CLD_PHASE_DB, &query_start);
+        char *sql = cld_stmt_SQL (s, num_of_args, args);
+        int rows;
+        int res = cld_execute_SQL (sql, &rows, er, err_message);
+        cld_free (sql);
+        return res;
+    }
+    if (retried == 1) CLD_TRACE("SQL statement executed OKAY after reconnecting to database.");
+    cld_get_config ()->timing.queries++;
+    cld_stmt_time (s, cld_timing_add (CLD_PHASE_DB, &query_start));
+    return 1;
+}
+
+//
+// Execute prepared statement for query site 'site' on read replica (see cld_replica_con()). 's', 'num_of_args' and 'args' are
+// the same as for cld_run_stmt(). Statement is prepared on replica once, same as on the database.
+// Returns executed statement, or NULL if it must execute on the database instead.
+//
+static MYSQL_STMT *cld_replica_stmt (cld_qry_site *site, const char *s, int num_of_args, const char **args)
+{
+    CLD_TRACE("");
+    if (CTX.stream != NULL) cld_stream_store (CTX.stream);
+    if (CTX.bulk != NULL) cld_bulk_flush (NULL, NULL);
+    // site not in the list is reported by cld_run_stmt()
+    if (site->is_listed == 0) return NULL;
+
+    MYSQL *con = cld_replica_con (s);
+    if (con == NULL) return NULL;
+    // no more statements are prepared on replica once there are too many, and query executes on the database instead
+    if (site->replica_stmt == NULL && CTX.db.replica->num_stmts >= CLD_MAX_STMTS) return NULL;
+    CLD_TRACE ("Prepared statement executing on read replica [%d]: [%s]", CTX.db.replica->curr, s);
+
+    cld_get_config ()->timing.queries++;
+    struct timespec query_start;
+    clock_gettime (CLOCK_MONOTONIC, &query_start);
+
+    unsigned long *lens;
+    MYSQL_BIND *bind = cld_stmt_bind (s, num_of_args, args, &lens);
+    MYSQL_STMT *st = site->replica_stmt;
+    if (st == NULL)
+    {
+        st = mysql_stmt_init (con);
+        if (st == NULL)
+        {
+            cld_timing_add (CLD_PHASE_DB, &query_start);
+            return NULL;
+        }
+        my_bool max_len = 1;
+        mysql_stmt_attr_set (st, STMT_ATTR_UPDATE_MAX_LENGTH, &max_len);
+        if (mysql_stmt_prepare (st, s, strlen (s)) != 0 || mysql_stmt_param_count (st) != (unsigned long)num_of_args)
+        {
+            // wrong number of parameters is reported by cld_run_stmt()
+            unsigned int er = mysql_stmt_errno (st);
+            mysql_stmt_close (st);
+            cld_replica_failed (con, er);
+            cld_timing_add (CLD_PHASE_DB, &query_start);
+            return NULL;
+        }
+        site->replica_stmt = st;
+        CTX.db.replica->num_stmts++;
+    }
+    if (mysql_stmt_bind_param (st, bind) != 0 || mysql_stmt_execute (st) != 0)
+    {
+        cld_replica_failed (con, mysql_stmt_errno (st));
+        cld_timing_add (CLD_PHASE_DB, &query_start);
+        return NULL;
+    }
+    cld_stmt_time (s, cld_timing_add (CLD_PHASE_DB, &query_start));
+    return st;
+}
+
+//
+// Execute prepared statement that doesn't return a result set (such as INSERT, UPDATE or DELETE), for query site 'site'.
+// 's', 'num_of_args' and 'args' are the same as for cld_run_stmt(), the rest is the same as for cld_execute_SQL().
+// Returns  0 if there is an error, 1 if it is okay.
+//
+int cld_execute_stmt (cld_qry_site *site, const char *s, int num_of_args, const char **args, int *rows, unsigned int *er, const char **err_message)
+{
+    CLD_TRACE("");
+    assert (rows);
+
+    // query results kept in process may no longer be valid
+    cld_invalidate_cache (s);
+
+    MYSQL_STMT *st;
+    if (cld_run_stmt (site, s, num_of_args, args, &st, er, err_message) == 0)
+    {
+        *rows = 0;
+        return 0;
+    }
+    if (st == NULL)
+    {
+        // executed as SQL text, and affected rows are counted toward site by cld_execute_SQL()
+        *rows = (int) mysql_affected_rows (cld_get_db_connection (cld_get_config ()->app.db));
+        return 1;
+    }
+    *rows = (int) mysql_stmt_affected_rows (st);
+    CLD_TRACE("Query OK, affected rows [%d]", *rows);
+    site->rows += *rows;
+    return 1;
+}
+
+// 
+// Add a row to INSERT for query site 'site', so that rows are inserted with a single statement. 's' is the INSERT
+// with input parameters in it, where the first 'prefix_len' bytes come before its VALUES list (such as 
+// 'insert into t (a,b) values ') and the last 'suffix_len' bytes come after it (such as 'on duplicate key update...').
+// Once there are 'chunk' rows, INSERT executes, and 'rows' and 'er' are the number of affected rows and error 
+// (as in cld_execute_SQL()), otherwise they are 0. Rows not yet inserted are inserted before any other query executes,
+// before commit, or at the end of request (see cld_bulk_flush()).
+//
+void cld_bulk_insert (cld_qry_site *site, const char *s, int prefix_len, int suffix_len, int chunk, int *rows, unsigned int *er)
+{
+    CLD_TRACE("");
+    assert (s);
+    assert (rows);
+    assert (er);
+
+    *rows = 0;
+    *er = 0;
+    // rows of a different INSERT are inserted first, so rows are inserted in the order they're added
+    if (CTX.bulk != NULL && CTX.bulk->site != site) cld_bulk_flush (NULL, NULL);
+
+    int len = strlen (s);
+    if (prefix_len + suffix_len > len)
+    {
+        cld_report_error ("Query [%s] is not an INSERT with VALUES", s);
+    }
+    int values_len = len - prefix_len - suffix_len;
+
+    cld_bulk *b = CTX.bulk;
+    if (b == NULL)
+    {
+        b = (cld_bulk*)cld_calloc (1, sizeof (cld_bulk));
+        b->site = site;
+        b->size = len + 1;
+        b->sql = (char*)cld_malloc (b->size);
+        memcpy (b->sql, s, prefix_len + values_len);
+        b->len = prefix_len + values_len;
+        b->suffix = cld_strdup (s + prefix_len + values_len);
+        CTX.bulk = b;
+    }
+    else
+    {
+        // room for comma, this row, suffix and null
+        if (b->len + values_len + suffix_len + 2 > b->size)
+        {
+            int new_size = 2 * b->size + values_len + suffix_len + 2;
+            b->sql = (char*)cld_realloc (b->sql, new_size);
+            b->size = new_size;
+        }
+        b->sql[b->len++] = ',';
+        memcpy (b->sql + b->len, s + prefix_len, values_len);
+        b->len += values_len;
+    }
+    b->rows++;
+
+    if (b->rows >= chunk) cld_bulk_flush (rows, er);
+}
+
+// 
+// Execute INSERT with rows added by cld_bulk_insert(), if any. 'rows' and 'er' are the number of affected rows 
+// and error (as in cld_execute_SQL()). If they are NULL, there is no one to handle the error, and it is reported.
+//
+void cld_bulk_flush (int *rows, unsigned int *er)
+{
+    CLD_TRACE("");
+    int r = 0;
+    unsigned int e = 0;
+    cld_bulk *b = CTX.bulk;
+    if (b != NULL)
+    {
+        // cleared first, since executing it would otherwise execute it again
+        CTX.bulk = NULL;
+        int suffix_len = strlen (b->suffix);
+        if (b->len + suffix_len + 1 > b->size) b->sql = (char*)cld_realloc (b->sql, b->len + suffix_len + 1);
+        memcpy (b->sql + b->len, b->suffix, suffix_len + 1);
+
+        const char *errm = "";
+        cld_qry_site *curr_site = CTX.qry_site;
+        CTX.qry_site = b->site;
+        cld_execute_SQL (b->sql, &r, &e, &errm);
+        CTX.qry_site = curr_site;
+        CLD_TRACE ("Inserted [%d] rows with one statement, affected rows [%d], error [%u]", b->rows, r, e);
+        if (e != 0 && er == NULL)
+        {
+            cld_report_error ("Cannot insert [%d] rows from query [%s] at line [%d] of file [%s], error number [%u], error [%s]", 
+                b->rows, b->site == NULL ? "" : b->site->name, b->site == NULL ? 0 : b->site->line, b->site == NULL ? "" : b->site->file, e, errm);
+        }
+        cld_free (b->sql);
+        cld_free (b->suffix);
+        cld_free (b);
+    }
+    if (rows != NULL) *rows = r;
+    if (er != NULL) *er = e;
+}
+
+// 
+// Execute INSERT with rows added by cld_bulk_insert() for query 'name' in source file 'file' (flush-query), so the result of 
+// the last of them is known. If 'is_report' is 1, an error is reported (see cld_bulk_flush()). Rows of any other INSERT were 
+// already inserted, since another query executed after them.
+// Returns allocated text of error number, "0" if there is no error or no rows to insert.
+//
+char *cld_bulk_flush_query (const char *file, const char *name, int is_report)
+{
+    CLD_TRACE("");
+    unsigned int er = 0;
+    int rows;
+    cld_bulk *b = CTX.bulk;
+    if (b != NULL && b->site != NULL && !strcmp (b->site->name, name) && !strcmp (b->site->file, file))
+    {
+        cld_bulk_flush (&rows, is_report == 1 ? NULL : &er);
+    }
+    char *err = (char*)cld_malloc (20);
+    snprintf (err, 20, "%u", er);
+    return err;
+}
+
+//
+// Compare values 'a' and 'b' (each a pointer to string) for sorting. Values are compared byte for byte, since only those
+// that database compares the same way are used (see cld_prefetch_is_key()).
+//
+static int cld_prefetch_cmp_key (const void *a, const void *b)
+{
+    return strcmp (*(char* const*)a, *(char* const*)b);
+}
+
+//
+// Returns 1 if 'len' bytes of 'val' is an integer written the way database writes it (no sign other than minus, no leading
+// zeros), 0 otherwise. Only such values are used to prefetch rows, because a row found by comparing its column to a value in 
+// SQL has then the same value byte for byte (unless column isn't an integer, which is checked in cld_prefetch_rows()). Other 
+// values could match differently in SQL, depending on type and collation of column (such as with letter case, accents, 
+// trailing spaces, or numbers like 1.5 and 1.50).
+//
+static int cld_prefetch_is_key (const char *val, int len)
+{
+    if (len != 0 && *val == '-') { val++; len--; }
+    if (len == 0 || len > MYS_NUM_LEN || (*val == '0' && len > 1)) return 0;
+    int i;
+    for (i = 0; i < len; i++) if (!isdigit (val[i])) return 0;
+    return 1;
+}
+
+//
+// Compare rows 'a' and 'b' for sorting, each a pointer to the address of its key column in data. Rows with the same key 
+// stay in the order they were selected in, so ORDER BY of query still holds for the rows of each key.
+//
+static int cld_prefetch_cmp_row (const void *a, const void *b)
+{
+    char **ra = *(char** const*)a;
+    char **rb = *(char** const*)b;
+    int c = strcmp (*ra, *rb);
+    if (c != 0) return c;
+    return ra < rb ? -1 : (ra > rb ? 1 : 0);
+}
+
+//
+// Compare 'len' bytes of 'key' to 'val', the same as cld_prefetch_cmp_key() would if 'key' ended after 'len' bytes.
+//
+static int cld_prefetch_cmp (const char *key, int len, const char *val)
+{
+    int c = strncmp (key, val, len);
+    if (c == 0 && val[len] != 0) c = -1;
+    return c;
+}
+
+//
+// Select rows of a query executed in the loop of another query's rows, for all of those rows at once (define-query#...prefetch).
+// 'prefix' and 'suffix' are the text of nested query before and after the list of values in '<column> IN (...)', which takes
+// the place of '<column>='<input parameter>''. Values are those of column 'outer_col' in 'outer_nrow' rows 'outer' of the outer 
+// query, escaped and trimmed the same as input parameters in cld_make_SQL(), and there are at most CLD_PREFETCH_KEYS of them 
+// in one query. Rows are sorted by column 'key_col' of nested query, so cld_prefetch_get() can find those for a value. 
+// 'site' is the query site of nested query. 'list' is the list of rows selected for queries nested in outer query's loop, and 
+// rows are selected only the first time for each site and rows of outer query.
+// Returns rows selected.
+//
+cld_prefetch *cld_prefetch_rows (cld_prefetch **list, cld_qry_site *site, const char *prefix, const char *suffix, char ***outer, int outer_nrow, 
+    int outer_col, int key_col)
+{
+    CLD_TRACE("");
+    assert (list);
+    assert (prefix);
+    assert (suffix);
+
+    cld_prefetch *p;
+    for (p = *list; p != NULL; p = p->next)
+    {
+        if (p->site == site && p->outer == outer) return p;
+    }
+    p = (cld_prefetch*)cld_calloc (1, sizeof (cld_prefetch));
+    p->site = site;
+    p->outer = outer;
+    p->key_col = key_col;
+    p->next = *list;
+    *list = p;
+
+    // distinct values of outer column, trimmed the same as input parameter would be; those that aren't integers
+    // aren't used, and query executes by itself for them
+    int to_trim = cld_get_config()->ctx.trim_query_input;
+    p->keys = (char**)cld_calloc (outer_nrow + 1, sizeof (char*));
+    int num_keys = 0;
+    int i;
+    for (i = 0; i < outer_nrow; i++)
+    {
+        const char *val = outer[i][outer_col];
+        int len = strlen (val);
+        if (to_trim == 1)
+        {
+            while (len != 0 && isspace (*val)) { val++; len--; }
+            while (len != 0 && isspace (val[len - 1])) len--;
+        }
+        if (cld_prefetch_is_key (val, len) == 0) continue;
+        p->keys[num_keys] = (char*)cld_malloc (len + 1);
+        memcpy (p->keys[num_keys], val, len);
+        p->keys[num_keys][len] = 0;
+        num_keys++;
+    }
+    qsort (p->keys, num_keys, sizeof (char*), cld_prefetch_cmp_key);
+    for (i = 0; i < num_keys; i++)
+    {
+        if (p->nkey == 0 || strcmp (p->keys[p->nkey - 1], p->keys[i])) p->keys[p->nkey++] = p->keys[i];
+    }
+
+    int prefix_len = strlen (prefix);
+    int suffix_len = strlen (suffix);
+    int start;
+    for (start = 0; start < p->nkey; start += CLD_PREFETCH_KEYS)
+    {
+        int end = (p->nkey - start > CLD_PREFETCH_KEYS ? start + CLD_PREFETCH_KEYS : p->nkey);
+
+        // each value is quoted and followed by a comma, and can be twice as long once escaped
+        size_t size = prefix_len + suffix_len + 1;
+        for (i = start; i < end; i++) size += 2 * strlen (p->keys[i]) + 3;
+        char *sql = (char*)cld_malloc (size);
+        memcpy (sql, prefix, prefix_len);
+        char *curr = sql + prefix_len;
+        for (i = start; i < end; i++)
+        {
+            if (i != start) *(curr++) = ',';
+            *(curr++) = '\'';
+            const char *v;
+            for (v = p->keys[i]; *v != 0; v++)
+            {
+                if (*v == '\\' || *v == '\'') *(curr++) = *v;
+                *(curr++) = *v;
+            }
+            *(curr++) = '\'';
+        }
+        memcpy (curr, suffix, suffix_len + 1);
+
+        int nrow;
+        int ncol;
+        char **col_names;
+        char **data;
+        unsigned long *lengths = NULL;
+        cld_select_table (sql, &nrow, &ncol, &col_names, &data, &lengths);
+        cld_free (sql);
+        if (key_col >= ncol)
+        {
+            cld_report_error ("Query [%s] prefetching rows doesn't select key column #%d", site == NULL ? "" : site->name, key_col + 1);
+        }
+        p->ncol = ncol;
+        p->col_names = col_names;
+        // each row must have one of the values in key column, or else column isn't compared to them the same way 
+        // as here (it's not an integer), and rows can't be found for a value, so query executes by itself for all of them
+        for (i = 0; i < nrow; i++)
+        {
+            char *key = data[i * ncol + key_col];
+            if (bsearch (&key, p->keys + start, end - start, sizeof (char*), cld_prefetch_cmp_key) == NULL)
+            {
+                CLD_TRACE ("Query [%s] prefetched row with key [%s] that isn't one of the values, rows aren't used", 
+                    site == NULL ? "" : site->name, key);
+                p->nkey = 0;
+                p->nrow = 0;
+                cld_free (data);
+                cld_free (lengths);
+                return p;
+            }
+        }
+        if (nrow > 0)
+        {
+            p->data = (char**)cld_realloc (p->data, (p->nrow + nrow) * ncol * sizeof (char*));
+            memcpy (p->data + p->nrow * ncol, data, nrow * ncol * sizeof (char*));
+            p->lengths = (unsigned long*)cld_realloc (p->lengths, (p->nrow + nrow) * ncol * sizeof (unsigned long));
+            memcpy (p->lengths + p->nrow * ncol, lengths, nrow * ncol * sizeof (unsigned long));
+            p->nrow += nrow;
+            cld_free (lengths);
+        }
+        cld_free (data);
+    }
+
+    // rows for the same key are put one after the other
+    if (p->nrow > 1)
+    {
+        char ***rows = (char***)cld_malloc (p->nrow * sizeof (char**));
+        for (i = 0; i < p->nrow; i++) rows[i] = p->data + i * p->ncol + key_col;
+        qsort (rows, p->nrow, sizeof (char**), cld_prefetch_cmp_row);
+        char **data = (char**)cld_malloc (p->nrow * p->ncol * sizeof (char*));
+        unsigned long *lengths = (unsigned long*)cld_malloc (p->nrow * p->ncol * sizeof (unsigned long));
+        for (i = 0; i < p->nrow; i++)
+        {
+            int r = (rows[i] - key_col - p->data) / p->ncol;
+            memcpy (data + i * p->ncol, p->data + r * p->ncol, p->ncol * sizeof (char*));
+            memcpy (lengths + i * p->ncol, p->lengths + r * p->ncol, p->ncol * sizeof (unsigned long));
+        }
+        cld_free (rows);
+        cld_free (p->data);
+        cld_free (p->lengths);
+        p->data = data;
+        p->lengths = lengths;
+    }
+    CLD_TRACE ("Prefetched [%d] rows for [%d] values of query [%s]", p->nrow, p->nkey, site == NULL ? "" : site->name);
+    return p;
+}
+
+//
+// Get rows selected with cld_prefetch_rows() 'p' for value 'key' of the input parameter of nested query, trimmed the same as 
+// input parameter would be. Outputs are the same as for cld_select_table(), and they point to rows in 'p'.
+// Returns 1 if rows are found (even if there are none), or 0 if 'key' isn't one of the values rows were selected for, in 
+// which case query must execute by itself.
+//
+int cld_prefetch_get (cld_prefetch *p, const char *key, int *nrow, int *ncol, char ***col_names, char ***data, unsigned long **lengths)
+{
+    CLD_TRACE("");
+    assert (p);
+    assert (nrow);
+    assert (ncol);
+    assert (col_names);
+    assert (data);
+    assert (lengths);
+
+    if (key == NULL) return 0;
+    int len = strlen (key);
+    if (cld_get_config()->ctx.trim_query_input == 1)
+    {
+        while (len != 0 && isspace (*key)) { key++; len--; }
+        while (len != 0 && isspace (key[len - 1])) len--;
+    }
+
+    // key must be one of the values
+    int lo = 0;
+    int hi = p->nkey;
+    while (lo < hi)
+    {
+        int mid = (lo + hi) / 2;
+        if (cld_prefetch_cmp (key, len, p->keys[mid]) > 0) lo = mid + 1; else hi = mid;
+    }
+    if (lo == p->nkey || cld_prefetch_cmp (key, len, p->keys[lo]) != 0) return 0;
+
+    // first row for key, then the one after the last
+    lo = 0;
+    hi = p->nrow;
+    while (lo < hi)
+    {
+        int mid = (lo + hi) / 2;
+        if (cld_prefetch_cmp (key, len, p->data[mid * p->ncol + p->key_col]) > 0) lo = mid + 1; else hi = mid;
+    }
+    int first = lo;
+    hi = p->nrow;
+    while (lo < hi)
+    {
+        int mid = (lo + hi) / 2;
+        if (cld_prefetch_cmp (key, len, p->data[mid * p->ncol + p->key_col]) >= 0) lo = mid + 1; else hi = mid;
+    }
+
+    *nrow = lo - first;
+    *ncol = p->ncol;
+    *col_names = p->col_names;
+    *data = (*nrow == 0 ? NULL : p->data + first * p->ncol);
+    *lengths = (*nrow == 0 ? NULL : p->lengths + first * p->ncol);
+    CLD_TRACE ("Prefetched [%d] rows for query [%s]", *nrow, p->site == NULL ? "" : p->site->name);
+    return 1;
+}
+
+//
+// Handle error of execution of SQL. 's' is the statement. 'con' is the db connection.
+// 'er' is the output error, and its text is in output variable err_message.
+// If 'retry' is 1 AND this is a lost connection, try to reconnect ONCE. If 'retry' is 1 AND this
+// is something other than lost connection, then handle it by returning 0. If 'retry' is 0, NEVER try to reconnect regardless.
+// If this is lost connection and reconnection failed (or was never tried because retry is 0), then stop program.
+// Returns 1 if reconnect was successful (meaning retry had to be 1 for this to happen), 0 in any other case.
+//
+int cld_handle_error (const char *s, MYSQL *con, unsigned int *er, const char **err_message, int retry)
+{
+    CLD_TRACE("");
+    // This static is fine - it is used only within a single request, i.e. it doesnt span multiple request.
+    // Errm is set HERE and used right after it - it doesn't go beyond a request.
+    static char errm[8192];
+    assert (s != NULL);
+    assert (con != NULL);
+    assert (er != NULL);
+
+    CLD_TRACE ("Error in %s: %s error %d state %s", s, mysql_error(con), mysql_errno(con), 
+        mysql_sqlstate(con));
+
+    int local_error = mysql_errno (con);
+
+    // get location in source code (if set, CLD automatically does this)
+    char *sname = "";
+    int lnum = 0;
+    cld_location (&sname, &lnum, 0);
+
+    switch (local_error)
+    {
+        case ER_DUP_ENTRY:
+        case ER_DUP_ENTRY_WITH_KEY_NAME:
+            /* this can happen in insert with duplicate key or update that leads to 
+             * duplicate key */
+            CLD_TRACE ("Duplicate key detected, no changes made");
+            *er = ER_DUP_ENTRY;
+            break;
+         case CR_SERVER_GONE_ERROR:
+         case CR_SERVER_LOST:
+            // Go away if db connection lost, or try to reconnect if retry is 1
+
+            //
+            // If we're instructed to retry, we will
+            //
+            if (retry == 1) 
+            {
+                //
+                // Retry connection
+                //
+                //
+                // First we must reset connection we have already. It's lost so we're not calling mysql_close().
+                // Without this, an attempt to retry connection would not work, and would just return the old cached bad
+                // connection
+                //
+                *(CTX.db.g_con) = NULL;
+                //
+                // Retry it
+                //
+                if (cld_get_db_connection (cld_get_config()->app.db) == NULL)
+                {
+                    //
+                    // Here we wanted to retry but it failed - stop program
+                    //
+                    cld_report_error ("Connection to database server is lost (after a retry), found [%s], line [%d], file [%s]", s, lnum,sname);
+                }
+                else
+                {
+                    //
+                    // Retry was instructed and successful
+                    //
+                    CLD_TRACE("Reconnecting to database OKAY");
+                    return 1;
+                }
+            }
+            else
+            {
+                //
+                // we don't want to retry connection, fail it
+                //
+                cld_report_error ("Connection to database server is lost (without retry), found [%s], line [%d], file [%s]", s, lnum,sname);
+            }
+         default:
+            // Probably a fatal error, application must handle
+            *er = local_error;
+            snprintf(errm,sizeof(errm)-1,"Error during query [%s], file [%s], line [%d] : [%d]%s", s, sname, lnum, *er ,*er == ER_PARSE_ERROR ?
+                "Problem with parsing SQL statement" : mysql_error(con));
+            CLD_TRACE("%s", errm);
+            if (err_message!=NULL) *err_message=errm;
+            break;
+    }
+    return 0;
+}
+
+//
+// Set location of SQL statement. Before it's executed, we set file name (fname),
+// line number (lnum) and 'set' is 1. If there was an error, we can use this information
+// to point back to the exact line where problem happened.
+//
+void cld_location (char **fname, int *lnum, int set)
+{
+    CLD_TRACE("");
+    // this static variables are fine, they are used only within a single request. 
+    // Before SQL is executed, cld_location is called, and if there is an error, we would
+    // return that value - meaning these values are ALWAYS set in the process and THEN used
+    static char *fname_loc = "";
+    static int lnum_loc = 0;
+
+    if (set == 1)
+    {
+        fname_loc = *fname;
+        lnum_loc = *lnum;
+    }
+    else
+    {
+        *fname = fname_loc;
+        *lnum = lnum_loc;
+    }
+} 
+
+// 
+// Set query site being executed to 'site' (or NULL when its execution is done), so that time spent, rows and bytes
+// are counted toward it. A site is added to application's list of sites the first time it's executed.
+//
+void cld_query_site (cld_qry_site *site)
+{
+    if (site != NULL && site->is_listed == 0 && CTX.db.qry_stats != NULL)
+    {
+        site->next = CTX.db.qry_stats->sites;
+        CTX.db.qry_stats->sites = site;
+        site->is_listed = 1;
+    }
+    CTX.qry_site = site;
+}
+
+// 
+// Count 'us' microseconds toward the query site being executed, if any. 'is_fetch' is 0 for executing 
+// a query (which starts a new execution), and 1 for getting its results.
+//
+static void cld_qry_site_time (long long us, int is_fetch)
+{
+    cld_qry_site *site = CTX.qry_site;
+    if (site == NULL) return;
+    if (is_fetch == 0)
+    {
+        site->execs++;
+        site->curr_us = 0;
+    }
+    site->curr_us += us;
+    site->total_us += us;
+    if (site->curr_us > site->max_us) site->max_us = site->curr_us;
+}
+
+// 
+// Statement 's' was executed in 'us' microseconds. Time counts toward the query site being executed, if any. If it's at least 
+// 'slowquery' milliseconds (from debug file), statement is written to slow query log (see cld_write_slow_query()), whether
+// it's executed for a query site or not (such as commit or reserving document ids). Statement without a query site is named
+// by the first word of 's', and its location in source code is the last one set before a query (see cld_location()).
+//
+static void cld_stmt_time (const char *s, long long us)
+{
+    // result of previous statement is complete once the next one executes
+    cld_slow_stmt_done ();
+    cld_qry_site_time (us, 0);
+    int slow_ms = cld_get_config ()->debug.slow_query;
+    if (slow_ms == 0 || us < slow_ms * 1000LL) return;
+    cld_qry_site *site = CTX.qry_site;
+    cld_slow.is_pending = 1;
+    cld_slow.site = site;
+    cld_slow.us = us;
+    cld_slow.rows = 0;
+    cld_slow.bytes = 0;
+    if (site != NULL)
+    {
+        cld_slow.file = site->file;
+        cld_slow.line = site->line;
+        snprintf (cld_slow.name, sizeof (cld_slow.name), "%s", site->name);
+        cld_slow.rows = site->rows;
+        cld_slow.bytes = site->bytes;
+        return;
+    }
+    char *fname = "";
+    int lnum = 0;
+    cld_location (&fname, &lnum, 0);
+    cld_slow.file = fname;
+    cld_slow.line = lnum;
+    while (isspace (*s)) s++;
+    int len = 0;
+    while (len < (int)sizeof (cld_slow.name) - 1 && isalpha (s[len])) { cld_slow.name[len] = tolower (s[len]); len++; }
+    cld_slow.name[len] = 0;
+}
+
+// 
+// Write slow statement to slow query log (see cld_write_slow_query()), if there is one not written yet. Rows and bytes
+// are those the query site counted since statement executed, i.e. rows it returned (or affected rows) and their bytes. This is 
+// called when the next statement executes and at the end of request, when its result is complete.
+//
+void cld_slow_stmt_done ()
+{
+    if (cld_slow.is_pending == 0) return;
+    cld_slow.is_pending = 0;
+    long long rows = cld_slow.rows;
+    long long bytes = 0;
+    if (cld_slow.site != NULL)
+    {
+        rows = cld_slow.site->rows - cld_slow.rows;
+        bytes = cld_slow.site->bytes - cld_slow.bytes;
+    }
+    cld_write_slow_query (cld_slow.file, cld_slow.line, cld_slow.name, cld_slow.us, rows, bytes);
+}
+
+// 
+// Write statistics for query sites executed in this process to qstat-<pid> file in trace directory, if 'querystats'
+// is 1 in debug file. Statistics are totals since process started. Unless 'force' is 1, they are written at most once
+// per CLD_QRY_STATS_INTERVAL seconds. The file is written under a temporary name and then renamed, so it's never read
+// half-written. Use cldqstat to merge files from all processes.
+//
+void cld_write_qry_stats (int force)
+{
+    cld_config *pc = cld_get_config();
+    cld_qry_stats *qs = pc->ctx.db.qry_stats;
+    if (pc->debug.query_stats != 1 || qs == NULL || qs->sites == NULL) return;
+
+    time_t now = time (NULL);
+    if (force == 0 && now - qs->written < CLD_QRY_STATS_INTERVAL) return;
+    qs->written = now;
+
+    char fname[300];
+    char tmp_fname[310];
+    snprintf (fname, sizeof (fname), "%s/qstat-%d", pc->app.log_directory, cld_getpid());
+    snprintf (tmp_fname, sizeof (tmp_fname), "%s.tmp", fname);
+    FILE *f = fopen (tmp_fname, "w");
+    if (f == NULL)
+    {
+        CLD_TRACE ("Cannot open query statistics file [%s], error [%s]", tmp_fname, strerror (errno));
+        return;
+    }
+    fprintf (f, "#file\tline\tquery\texecutions\ttotal_us\tmax_us\trows\tbytes\n");
+    cld_qry_site *site;
+    for (site = qs->sites; site != NULL; site = site->next)
+    {
+        fprintf (f, "%s\t%d\t%s\t%lld\t%lld\t%lld\t%lld\t%lld\n", site->file, site->line, site->name, site->execs, site->total_us,
+            site->max_us, site->rows, site->bytes);
+    }
+    if (fclose (f) != 0 || rename (tmp_fname, fname) != 0)
+    {
+        CLD_TRACE ("Cannot write query statistics file [%s], error [%s]", fname, strerror (errno));
+    }
+}
+
+// 
+// Add name of table found at 'w' (of length 'len') to list of tables 'tables' (see cld_sql_tables()), whose 
+// size is 'tables_len'. Returns 0 if there's no room for it, 1 otherwise.
+//
+static int cld_add_sql_table (const char *w, int len, char *tables, int tables_len)
+{
+    // only table name is used, not the database it's in
+    const char *dot;
+    while ((dot = memchr (w, '.', len)) != NULL)
+    {
+        len -= dot + 1 - w;
+        w = dot + 1;
+    }
+    if (len == 0) return 1;
+
+    int curr = strlen (tables);
+    if (curr + len + 1 >= tables_len) return 0;
+    int i;
+    for (i = 0; i < len; i++) 
+    {
+        // remove quoting of identifier
+        if (w[i] != '`') tables[curr++] = tolower (w[i]);
+    }
+    tables[curr] = ',';
+    tables[curr + 1] = 0;
+    return 1;
+}
+
+// 
+// Find tables used by SQL statement 's', which are the names following FROM, JOIN, INTO, UPDATE and TABLE, 
+// and comma-separated lists after them. 'tables' (of size 'tables_len') gets list of tables in lower case 
+// as ",table1,table2,". This may include names that aren't tables (for example in EXTRACT(YEAR FROM..)), 
+// which only means more is invalidated than needed (see cld_invalidate_cache()). If list doesn't fit, 
+// 'tables' is empty, the same as when no tables are found, which means 'any table'.
+//
+void cld_sql_tables (const char *s, char *tables, int tables_len)
+{
+    assert (tables_len > 2);
+    strcpy (tables, ",");
+    // 0 if not in list of tables, 1 if table name is next, 2 if alias or comma may be next, 3 if comma may be next
+    int state = 0; 
+    const char *p = s;
+    while (*p != 0)
+    {
+        if (*p == '\'' || *p == '"')
+        {
+            // skip string literal
+            char q = *p++;
+            while (*p != 0 && *p != q) 
+            {
+                if (*p == '\\' && *(p + 1) != 0) p++;
+                p++;
+            }
+            if (*p != 0) p++;
+            state = 0;
+            continue;
+        }
+        if (isalnum (*p) || *p == '_' || *p == '$' || *p == '`' || *p == '.')
+        {
+            const char *w = p;
+            while (isalnum (*p) || *p == '_' || *p == '$' || *p == '`' || *p == '.') p++;
+            int len = p - w;
+            if ((len == 4 && !strncasecmp (w, "from", 4)) || (len == 4 && !strncasecmp (w, "join", 4)) 
+                || (len == 4 && !strncasecmp (w, "into", 4)) || (len == 6 && !strncasecmp (w, "update", 6))
+                || (len == 5 && !strncasecmp (w, "table", 5)))
+            {
+                state = 1;
+            }
+            else if (state == 1)
+            {
+                // skip modifiers in INSERT, UPDATE and DELETE
+                if ((len == 12 && !strncasecmp (w, "low_priority", 12)) || (len == 13 && !strncasecmp (w, "high_priority", 13))
+                    || (len == 7 && !strncasecmp (w, "delayed", 7)) || (len == 6 && !strncasecmp (w, "ignore", 6))
+                    || (len == 5 && !strncasecmp (w, "quick", 5))) continue;
+                if (cld_add_sql_table (w, len, tables, tables_len) == 0)
+                {
+                    tables[0] = 0;
+                    return;
+                }
+                state = 2;
+            }
+            else if (state == 2)
+            {
+                // alias, possibly after AS
+                if (!(len == 2 && !strncasecmp (w, "as", 2))) state = 3;
+            }
+            else state = 0;
+            continue;
+        }
+        if (*p == ',' && state >= 2) state = 1;
+        else if (!isspace (*p)) state = 0;
+        p++;
+    }
+    if (tables[1] == 0) tables[0] = 0;
+}
+
+// 
+// Hash of 'key' for query cache.
+//
+static unsigned long cld_qry_cache_hash (const char *key)
+{
+    unsigned long h = 5381;
+    while (*key != 0) h = h * 33 + (unsigned char)*key++;
+    return h;
+}
+
+// 
+// Remove entry 'e' from query cache 'qc' and free it.
+//
+static void cld_qry_cache_remove (cld_qry_cache *qc, cld_qry_cache_entry *e)
+{
+    if (e->prev != NULL) e->prev->next = e->next; else qc->first = e->next;
+    if (e->next != NULL) e->next->prev = e->prev; else qc->last = e->prev;
+    qc->count--;
+    qc->size -= e->size;
+    int i;
+    for (i = 0; i < e->ncol; i++) free (e->col_names[i]);
+    free (e->col_names);
+    free (e->data);
+    free (e->lengths);
+    free (e->tables);
+    free (e->key);
+    free (e);
+}
+
+// 
+// Invalidate query results kept in process (see cld_select_cached()) that may be changed by SQL statement 's'. These
+// are results using any of the tables that INSERT, UPDATE, DELETE or REPLACE statement uses, and all results
+// for other statements that change data or if tables aren't known. Statements that don't change data don't
+// invalidate anything.
+//
+void cld_invalidate_cache (const char *s)
+{
+    cld_qry_cache *qc = CTX.db.qry_cache;
+    if (qc == NULL || qc->first == NULL) return;
+
+    while (isspace (*s) || *s == '(') s++;
+    int len = 0;
+    while (isalpha (s[len])) len++;
+    char tables[CLD_QRY_CACHE_TABLES];
+    tables[0] = 0;
+    if ((len == 6 && (!strncasecmp (s, "select", 6) || !strncasecmp (s, "commit", 6))) || (len == 5 && !strncasecmp (s, "start", 5))
+        || (len == 5 && !strncasecmp (s, "begin", 5)) || (len == 8 && !strncasecmp (s, "rollback", 8)) || (len == 3 && !strncasecmp (s, "set", 3))
+        || (len == 4 && !strncasecmp (s, "show", 4)) || (len == 9 && !strncasecmp (s, "savepoint", 9)) 
+        || (len == 7 && !strncasecmp (s, "release", 7)) || (len == 7 && !strncasecmp (s, "explain", 7))) return;
+    if ((len == 6 && (!strncasecmp (s, "insert", 6) || !strncasecmp (s, "update", 6) || !strncasecmp (s, "delete", 6))) 
+        || (len == 7 && !strncasecmp (s, "replace", 7)))
+    {
+        cld_sql_tables (s, tables, sizeof (tables));
+    }
+
+    cld_qry_cache_entry *e = qc->first;
+    while (e != NULL)
+    {
+        cld_qry_cache_entry *next = e->next;
+        int invalid = (tables[0] == 0 || e->tables[0] == 0);
+        if (invalid == 0)
+        {
+            // see if any table in the statement is used by the entry
+            const char *t = tables;
+            while (t[1] != 0)
+            {
+                const char *end = strchr (t + 1, ',');
+                char one[CLD_QRY_CACHE_TABLES];
+                int one_len = end - t + 1;
+                memcpy (one, t, one_len);
+                one[one_len] = 0;
+                if (strstr (e->tables, one) != NULL) 
+                {
+                    invalid = 1;
+                    break;
+                }
+                t = end;
+            }
+        }
+        if (invalid == 1)
+        {
+            CLD_TRACE ("Query result invalidated [%s]", e->key);
+            cld_qry_cache_remove (qc, e);
+        }
+        e = next;
+    }
+}
+
+// 
+// Select with results kept in process for 'ttl' seconds. 'tables' is the list of tables query uses (see cld_sql_tables()), 
+// and when this process executes a statement that changes any of them, results are discarded (see cld_invalidate_cache()).
+// If 'args' is NULL, 's' is the final SQL text selected with cld_select_table(), otherwise it's the prepared statement 
+// selected with cld_select_stmt() for query site 'site' and 'num_of_args' input parameters 'args'. The rest is the same 
+// as for cld_select_stmt(). Results are copied to request memory either way, and at most CLD_QRY_CACHE_ENTRIES results
+// using at most CLD_QRY_CACHE_SIZE bytes are kept, the least recently used ones discarded first. Results obtained in 
+// a transaction are not kept, since the transaction may not commit. 
+//
+void cld_select_cached (cld_qry_site *site, int ttl, const char *tables, const char *s, int num_of_args, const char **args, int *nrow, int *ncol, 
+    char ***col_names, char ***data, unsigned long **lengths)
+{
+    CLD_TRACE("");
+    assert (data);
+    assert (lengths);
+
+    // kept results don't have rows not yet inserted, and inserting them discards the results
+    if (CTX.bulk != NULL) cld_bulk_flush (NULL, NULL);
+
+    cld_qry_cache *qc = CTX.db.qry_cache;
+    if (qc == NULL)
+    {
+        if (args == NULL) cld_select_table (s, nrow, ncol, col_names, data, lengths);
+        else cld_select_stmt (site, s, num_of_args, args, nrow, ncol, col_names, data, lengths, NULL, NULL);
+        return;
+    }
+
+    // key is SQL text, and input parameters if any, each preceded by its length
+    int i;
+    int key_len = strlen (s) + 1;
+    for (i = 0; i < num_of_args; i++)
+    {
+        // same as with prepared statement (see cld_stmt_bind())
+        if (args[i] == NULL)
+        {
+            cld_report_error ("Input parameter #%d is NULL for SQL statement [%s]", i + 1, s);
+        }
+        key_len += strlen (args[i]) + 20;
+    }
+    char *key = cld_malloc (key_len);
+    int pos = snprintf (key, key_len, "%s", s);
+    for (i = 0; i < num_of_args; i++) pos += snprintf (key + pos, key_len - pos, "\n%d:%s", (int)strlen (args[i]), args[i]);
+    unsigned long hash = cld_qry_cache_hash (key);
+
+    time_t now = time (NULL);
+    cld_qry_cache_entry *e;
+    for (e = qc->first; e != NULL; e = e->next)
+    {
+        if (e->hash == hash && !strcmp (e->key, key)) break;
+    }
+    if (e != NULL && e->expires <= now)
+    {
+        cld_qry_cache_remove (qc, e);
+        e = NULL;
+    }
+
+    if (e != NULL)
+    {
+        CLD_TRACE ("Query result found in cache [%s]", key);
+        // make it the most recently used
+        if (e->prev != NULL)
+        {
+            e->prev->next = e->next;
+            if (e->next != NULL) e->next->prev = e->prev; else qc->last = e->prev;
+            e->prev = NULL;
+            e->next = qc->first;
+            qc->first->prev = e;
+            qc->first = e;
+        }
+
+        // copy result to request memory, since entry may be invalidated while it's used
+        *nrow = e->nrow;
+        *ncol = e->ncol;
+        *col_names = (char**)cld_calloc (e->ncol, sizeof (char*));
+        for (i = 0; i < e->ncol; i++) (*col_names)[i] = cld_strdup (e->col_names[i]);
+        int ncells = e->nrow * e->ncol;
+        *data = (char**)cld_calloc (ncells + 1, sizeof (char*));
+        *lengths = NULL;
+        if (ncells > 0)
+        {
+            size_t data_size = 0;
+            for (i = 0; i < ncells; i++) data_size += e->lengths[i] + 1;
+            char *block = cld_malloc (data_size);
+            memcpy (block, e->data, data_size);
+            *lengths = (unsigned long*)cld_malloc (ncells * sizeof (unsigned long));
+            memcpy (*lengths, e->lengths, ncells * sizeof (unsigned long));
+            for (i = 0; i < ncells; i++)
+            {
+                (*data)[i] = block;
+                block += e->lengths[i] + 1;
+            }
+        }
+        cld_free (key);
+        if (site != NULL) site->rows += *nrow;
+        return;
+    }
+
+    if (args == NULL) cld_select_table (s, nrow, ncol, col_names, data, lengths);
+    else cld_select_stmt (site, s, num_of_args, args, nrow, ncol, col_names, data, lengths, NULL, NULL);
+
+    if (*(CTX.db.is_begin_transaction) == 1)
+    {
+        cld_free (key);
+        return;
+    }
+
+    // keep a copy of the result 
+    int ncells = *nrow * *ncol;
+    size_t data_size = 0;
+    for (i = 0; i < ncells; i++) data_size += (*lengths)[i] + 1;
+    size_t size = sizeof (cld_qry_cache_entry) + strlen (key) + 1 + data_size + ncells * sizeof (unsigned long);
+    if (size > CLD_QRY_CACHE_SIZE / 4)
+    {
+        CLD_TRACE ("Query result too large to keep in cache, size [%ld]", (long)size);
+        cld_free (key);
+        return;
+    }
+    e = (cld_qry_cache_entry*)calloc (1, sizeof (cld_qry_cache_entry));
+    if (e == NULL)
+    {
+        cld_free (key);
+        return;
+    }
+    e->key = strdup (key);
+    e->hash = hash;
+    e->tables = strdup (tables);
+    e->expires = now + ttl;
+    e->nrow = *nrow;
+    e->ncol = *ncol;
+    e->col_names = (char**)calloc (*ncol + 1, sizeof (char*));
+    e->data = (char*)malloc (data_size + 1);
+    e->lengths = (unsigned long*)malloc (ncells * sizeof (unsigned long) + 1);
+    int failed = (e->key == NULL || e->tables == NULL || e->col_names == NULL || e->data == NULL || e->lengths == NULL);
+    for (i = 0; failed == 0 && i < *ncol; i++) 
+    {
+        if ((e->col_names[i] = strdup ((*col_names)[i])) == NULL) failed = 1;
+    }
+    if (failed == 1)
+    {
+        if (e->col_names != NULL) for (i = 0; i < *ncol; i++) free (e->col_names[i]);
+        free (e->col_names);
+        free (e->data);
+        free (e->lengths);
+        free (e->tables);
+        free (e->key);
+        free (e);
+        cld_free (key);
+        return;
+    }
+    char *curr = e->data;
+    for (i = 0; i < ncells; i++)
+    {
+        memcpy (curr, (*data)[i], (*lengths)[i] + 1);
+        curr += (*lengths)[i] + 1;
+    }
+    if (ncells > 0) memcpy (e->lengths, *lengths, ncells * sizeof (unsigned long));
+    e->size = size;
+
+    // add as the most recently used, and discard the least recently used ones if over the limit
+    e->next = qc->first;
+    if (qc->first != NULL) qc->first->prev = e; else qc->last = e;
+    qc->first = e;
+    qc->count++;
+    qc->size += size;
+    while (qc->count > CLD_QRY_CACHE_ENTRIES || qc->size > CLD_QRY_CACHE_SIZE) cld_qry_cache_remove (qc, qc->last);
+    CLD_TRACE ("Query result kept in cache [%s], entries [%d], size [%ld]", key, qc->count, (long)qc->size);
+    cld_free (key);
+}
+
+// 
+// Get column names and rows from 'result' of SELECT. The rest is the same as for cld_select_table().
+//
+static void cld_result_rows (MYSQL_RES *result, int *nrow, int *ncol, char ***col_names, char ***data, unsigned long **lengths)
+{
+    // get number of columns
+    int num_fields = mysql_num_fields(result);
+
+    MYSQL_ROW row;
+
+    // number of columns is needed whether we get column names only or result data
+    *ncol = num_fields;
+
+    // output columns
+    MYSQL_FIELD *field;
+
+    // 
+    // allocate column names too
+    //
+    *col_names = (char**)cld_calloc (num_fields, sizeof(char*));
+
+    //
+    // Get column names to be either used when requested
+    //
+    int field_index = 0;
+    while ((field = mysql_fetch_field(result)))
+    {
+        (*col_names)[field_index] = cld_strdup(field->name);
+        field_index++;
+    }
+    if (data == NULL)
+    {
+        // clean the result and return in case we want column names ONLY
+        mysql_free_result(result);
+        return;
+    }
+                                     
+    // 
+    // this is getting actual data
+    //
+    *nrow = 0;
+
+    // all rows are already in memory, so arrays for them are allocated once
+    int num_rows = (int) mysql_num_rows (result);
+    *data = cld_calloc(num_rows*num_fields + 1, sizeof(char*));
+    if (lengths != NULL) *lengths = (num_rows == 0 ? NULL : (unsigned long*)cld_malloc (num_rows*num_fields*sizeof(unsigned long)));
+
+    int i;
+    long long bytes = 0; // bytes of result data
+
+    // fetch all rows, one by one (result is already here in memory)
+    while ((row = mysql_fetch_row(result))) 
+    { 
+
+        // get lengths of each column
+        unsigned long *lens = mysql_fetch_lengths (result);
+
+        for(i = 0; i < num_fields; i++) 
+        { 
+            // calculate position in data
+            int cpos = *nrow * num_fields + i;
+
+            // use column directly from the result, which is kept until request memory is freed (see below), and
+            // where each column ends with zero
+            (*data)[cpos] = (row[i] != NULL ? row[i] : CLD_EMPTY_STRING);
+            if (lengths != NULL) (*lengths)[cpos] = lens[i];
+            bytes += lens[i];
+        } 
+        (*nrow)++;
+    }
+    CLD_TRACE("SELECT retrieved [%d] rows", *nrow);
+    // data points to result, so it's freed together with request memory
+    cld_add_resource (result, cld_free_result);
+    if (CTX.qry_site != NULL)
+    {
+        CTX.qry_site->rows += *nrow;
+        CTX.qry_site->bytes += bytes;
+    }
+}
+
+// 
+// Select SQL. 's' is the text of the SQL and it must start with 'select' (or 'explain'). 
+//
+// Outputs are 'nrow' (the number of rows in the result),
+// 'ncol' (the number of columns in the result), 'col_names' is a pointer to an array (allocated here) that contains all
+// column names with CLD_MAX_QUERY_OUTPUTS being the max size of the array, 'data' (if not NULL) is 
+// the buffer allocated by the function that contains all data from the select. 
+//
+// 'data' can be NULL, but col_name cannot be. 
+// Each column is present (NULL is the same as empty, or "", we do NOT make a distinction).
+// 'data' is an array of pointers, whereby each array entry points to a single column. For example, if a 
+// query SELECT X,Y FROM T; selects 3 rows, then data[0]={pointer to  X in 1st row}, data[1]={pointer to
+// Y in 1st row}, data[2]={pointer to X in 2nd row}, data[3]={pointer to Y in 2nd row}, data[4]={pointer to
+// X in 3rd row}, data[5]={pointer to Y in 3rd row}.
+// Columns point directly into database result, which is freed together with request memory, so they must not be
+// freed with cld_free().
+// 'lengths' (if not NULL) is allocated array of lengths of columns, in the same order as 'data', or NULL if there are no rows.
+//
+void cld_select_table (const char *s,
+                  int *nrow, 
+                  int *ncol, 
+                  char ***col_names,
+                  char ***data,
+                  unsigned long **lengths)
+                  
+{
+    CLD_TRACE("");
+    assert (nrow);
+    assert (ncol);
+    assert (s);
+    const char *fname=cld_get_config ()->app.db;
+
+
+    char *sname = "";
+    int lnum = 0;
+    // get location in end-user source code where this is called from, for error reporting purposes
+    cld_location (&sname, &lnum, 0);
+
+    if (col_names==NULL)
+    {
+        cld_report_error ("col_names must be non-NULL (programming error), found [%s], line [%d], file [%s]", s, lnum,sname);
+    }
+
+
+    // check this is SELECT (or EXPLAIN of a query) and nothing else
+    if (strncasecmp (s, "select", 6) && strncasecmp (s, "explain", 7))
+    {
         cld_report_error ("Invalid query (unrecognized operation), found [%s], line [%d], file [%s]", s, lnum,sname);
     }
 
@@ -547,122 +2088,803 @@ void cld_select_table (const char *s,
 
     const char *errm="";
     unsigned int er = 0;
-
-    // execute SELECT, reconnect if necessary
-    int rows;
-    if (!cld_execute_SQL (s, &rows, &er, &errm))
+
+    // execute SELECT on read replica if there is one, otherwise on the database, reconnect if necessary
+    MYSQL *replica = cld_replica_query (s);
+    int rows;
+    if (replica == NULL && !cld_execute_SQL (s, &rows, &er, &errm))
+    {
+        cld_report_error ("Cannot perform select, error [%d], error summary: [%s], line [%d], file [%s]", er, errm, lnum,sname);
+    }
+                
+    MYSQL_RES *result = NULL;
+
+    // time getting results counts toward database time too
+    struct timespec fetch_start;
+    clock_gettime (CLOCK_MONOTONIC, &fetch_start);
+
+    if (data != NULL)
+    {
+        // get all result data
+        result = mysql_store_result(replica != NULL ? replica : cld_get_db_connection (fname));
+    }
+    else
+    {
+        // no need to fetch the result yet, since we're getting column names only
+        result = mysql_use_result(replica != NULL ? replica : cld_get_db_connection (fname));
+    }
+                    
+    if (result == NULL) 
+    {
+        cld_report_error ("Error storing obtained data, error %s, line [%d], file [%s]", mysql_error(replica != NULL ? replica : cld_get_db_connection (fname)), lnum, sname);
+    }
+
+    cld_result_rows (result, nrow, ncol, col_names, data, lengths);
+    cld_qry_site_time (cld_timing_add (CLD_PHASE_DB, &fetch_start), 1);
+
+}
+
+
+
+
+// 
+// Wait until connection 'con' is ready for what non-blocking call waits for ('status' is a combination of MYSQL_WAIT_...). 
+// Returns what happened, to be passed to the non-blocking call to continue.
+//
+static int cld_async_poll (MYSQL *con, int status)
+{
+    struct pollfd pfd;
+    pfd.fd = mysql_get_socket (con);
+    pfd.events = ((status & MYSQL_WAIT_READ) ? POLLIN : 0) | ((status & MYSQL_WAIT_WRITE) ? POLLOUT : 0) | ((status & MYSQL_WAIT_EXCEPT) ? POLLPRI : 0);
+    pfd.revents = 0;
+    int timeout = ((status & MYSQL_WAIT_TIMEOUT) ? 1000 * (int)mysql_get_timeout_value (con) : -1);
+    int res;
+    while ((res = poll (&pfd, 1, timeout)) == -1 && errno == EINTR);
+    if (res <= 0) return MYSQL_WAIT_TIMEOUT;
+    return ((pfd.revents & POLLIN) ? MYSQL_WAIT_READ : 0) | ((pfd.revents & POLLOUT) ? MYSQL_WAIT_WRITE : 0) 
+        | ((pfd.revents & POLLPRI) ? MYSQL_WAIT_EXCEPT : 0);
+}
+
+// 
+// Close connections used for queries that run while request goes on.
+//
+static void cld_close_async ()
+{
+    if (CTX.db.async_con == NULL) return;
+    int i;
+    for (i = 0; i < CLD_MAX_ASYNC_CONN; i++)
+    {
+        if (CTX.db.async_con[i] != NULL) mysql_close (CTX.db.async_con[i]);
+        CTX.db.async_con[i] = NULL;
+        CTX.async[i] = NULL;
+    }
+}
+
+// 
+// Wait for query 'a' sent with cld_select_async() to execute and get its results. If 'a' is one of the queries sent
+// together with cld_run_batch(), results of all of them are obtained. If 'a' is still waiting for cld_run_batch(), it's 
+// sent by itself first. If a query failed, it's executed again on the main db connection, which handles errors 
+// the same way as for any other query (and so are the queries that come after it in a batch).
+//
+static void cld_async_finish (cld_async *a)
+{
+    if (a->is_done == 1) return;
+    if (a->is_queued == 1)
+    {
+        a->is_queued = 0;
+        cld_async_send (a, a->sql);
+        if (a->is_done == 1) return;
+    }
+    // results of a batch are read in the order queries were sent
+    if (a->first != NULL) a = a->first;
+    CLD_TRACE ("Waiting for query [%s]", a->sql);
+
+    struct timespec wait_start;
+    clock_gettime (CLOCK_MONOTONIC, &wait_start);
+
+    MYSQL *con = a->con;
+    CTX.async[a->conn_id] = NULL;
+    while (a->status != 0) a->status = mysql_real_query_cont (&(a->err), con, cld_async_poll (con, a->status));
+    unsigned int er = (a->err != 0 ? mysql_errno (con) : 0);
+
+    // results count toward the site of each query
+    cld_qry_site *curr_site = CTX.qry_site;
+    int is_counted = 0;
+    cld_async *q;
+    for (q = a; q != NULL; q = q->next)
+    {
+        MYSQL_RES *result = NULL;
+        if (er == 0)
+        {
+            int status = mysql_store_result_start (&result, con);
+            while (status != 0) status = mysql_store_result_cont (&result, con, cld_async_poll (con, status));
+            if (result == NULL) er = mysql_errno (con);
+            if (er == 0 && result == NULL) er = CR_UNKNOWN_ERROR;
+        }
+        // only time waiting counts toward request's database time, while query site gets the time it took to execute
+        if (is_counted == 0 && (er != 0 || q->next == NULL))
+        {
+            cld_timing_add (CLD_PHASE_DB, &wait_start);
+            is_counted = 1;
+        }
+        CTX.qry_site = q->site;
+        if (er != 0)
+        {
+            CLD_TRACE ("Query failed on its own connection, error [%d], [%s], executing it again", er, mysql_error (con));
+            cld_select_table (q->sql, &(q->nrow), &(q->ncol), &(q->col_names), &(q->data), &(q->lengths));
+        }
+        else
+        {
+            cld_get_config ()->timing.queries++;
+            struct timespec now;
+            clock_gettime (CLOCK_MONOTONIC, &now);
+            cld_stmt_time (q->sql, cld_timing_us (&(a->start), &now));
+            cld_result_rows (result, &(q->nrow), &(q->ncol), &(q->col_names), &(q->data), &(q->lengths));
+            // get to the result of the next query in batch, which must be there
+            int next = (q->next == NULL ? 0 : mysql_next_result (con));
+            if (next == -1)
+            {
+                cld_report_error ("Batch of queries returned fewer results than the number of queries, query [%s]", a->sql);
+            }
+            if (next != 0 && (er = mysql_errno (con)) == 0) er = CR_UNKNOWN_ERROR;
+        }
+        q->con = NULL;
+        q->is_done = 1;
+    }
+    CTX.qry_site = curr_site;
+
+    if (er == CR_SERVER_GONE_ERROR || er == CR_SERVER_LOST)
+    {
+        mysql_close (con);
+        CTX.db.async_con[a->conn_id] = NULL;
+    }
+    else if (er == 0 && mysql_more_results (con))
+    {
+        // there must be a result for each query; extra ones are read so connection can be used again, and that's an error
+        while (mysql_more_results (con) && mysql_next_result (con) == 0)
+        {
+            MYSQL_RES *result = mysql_store_result (con);
+            if (result != NULL) mysql_free_result (result);
+        }
+        cld_report_error ("Batch of queries returned more results than the number of queries, query [%s]", a->sql);
+    }
+}
+
+// 
+// Send query 'a' to the database, with 'sql' being its SQL text (which for a batch is the SQL text of all queries in it), 
+// without waiting for it to execute. It's sent on a connection not in use, or if all connections are used, on the one 
+// used by the query sent the earliest, once its results are obtained. A batch of more than one query is always sent on
+// connection CLD_BATCH_CONN, which is the only one that can execute multiple statements, and other queries are never 
+// sent on it. In a transaction, query executes right away on the main db connection instead, since other connections 
+// can't see changes made in it, and 'a' is done.
+//
+static void cld_async_send (cld_async *a, const char *sql)
+{
+    // query on another connection can't see rows not yet inserted
+    if (CTX.bulk != NULL) cld_bulk_flush (NULL, NULL);
+    if (CTX.db.async_con == NULL || *(CTX.db.is_begin_transaction) == 1 || strncasecmp (a->sql, "select", 6))
+    {
+        // each query in a batch executes by itself
+        cld_async *q;
+        for (q = a; q != NULL; q = q->next)
+        {
+            cld_select_table (q->sql, &(q->nrow), &(q->ncol), &(q->col_names), &(q->data), &(q->lengths));
+            q->is_done = 1;
+        }
+        return;
+    }
+
+    // find a connection not in use, or free the one used the longest
+    int is_batch = (a->next != NULL);
+    int i;
+    int conn_id = (is_batch ? CLD_BATCH_CONN : -1);
+    for (i = 0; i < CLD_BATCH_CONN && is_batch == 0; i++)
+    {
+        if (CTX.async[i] == NULL) 
+        {
+            conn_id = i;
+            break;
+        }
+        if (conn_id == -1 || cld_timing_us (&(CTX.async[i]->start), &(CTX.async[conn_id]->start)) > 0) conn_id = i;
+    }
+    if (CTX.async[conn_id] != NULL) cld_async_finish (CTX.async[conn_id]);
+
+    if (CTX.db.async_con[conn_id] == NULL)
+    {
+        CTX.db.async_con[conn_id] = mysql_init (NULL);
+        if (CTX.db.async_con[conn_id] == NULL) 
+        {
+            cld_report_error ("Cannot initialize database connection");
+        }  
+        mysql_options (CTX.db.async_con[conn_id], MYSQL_OPT_NONBLOCK, 0);
+        // batch connection only executes static queries generated from source code, put together as multiple statements
+        cld_db_connect (&(CTX.db.async_con[conn_id]), cld_get_config ()->app.db, conn_id == CLD_BATCH_CONN ? CLIENT_MULTI_STATEMENTS : 0, 0);
+    }
+
+    CLD_TRACE ("Sending query [%s] on connection [%d]", sql, conn_id);
+    a->con = CTX.db.async_con[conn_id];
+    a->conn_id = conn_id;
+    clock_gettime (CLOCK_MONOTONIC, &(a->start));
+    a->status = mysql_real_query_start (&(a->err), a->con, sql, strlen (sql));
+    CTX.async[conn_id] = a;
+}
+
+// 
+// Send SELECT 's' for query site 's' to the database, without waiting for it to execute. Results are obtained 
+// later with cld_async_wait(), so the request goes on while the query executes. Each query is sent on its own db
+// connection (see cld_async_send()), so that other queries can execute in the meantime, including other ones 
+// sent with this function. 
+// Returns query to be passed to cld_async_wait().
+//
+cld_async *cld_select_async (cld_qry_site *site, const char *s)
+{
+    CLD_TRACE("");
+    assert (s);
+
+    cld_async *a = (cld_async*)cld_calloc (1, sizeof (cld_async));
+    a->site = site;
+    a->sql = cld_strdup (s);
+    cld_async_send (a, a->sql);
+    return a;
+}
+
+// 
+// Set up SELECT 's' for query site 'site' to be sent to the database together with other queries by cld_run_batch().
+// If its results are needed before that, it's sent by itself. 
+// Returns query to be passed to cld_run_batch() and cld_async_wait().
+//
+cld_async *cld_select_batch (cld_qry_site *site, const char *s)
+{
+    CLD_TRACE("");
+    assert (s);
+
+    cld_async *a = (cld_async*)cld_calloc (1, sizeof (cld_async));
+    a->site = site;
+    a->sql = cld_strdup (s);
+    a->is_queued = 1;
+    return a;
+}
+
+// 
+// Send 'num' queries set up with cld_select_batch() (the arguments that follow, any of them can be NULL) to the 
+// database as a single statement made of all of them, i.e. in a single round-trip. Queries already sent are skipped. 
+// Results are obtained with cld_async_wait() for each query, and the first such call gets results for all of them.
+//
+void cld_run_batch (int num, ...)
+{
+    CLD_TRACE("");
+
+    va_list args;
+    va_start (args, num);
+    cld_async *first = NULL;
+    cld_async *last = NULL;
+    size_t sql_len = 0;
+    int i;
+    for (i = 0; i < num; i++)
+    {
+        cld_async *a = va_arg (args, cld_async *);
+        if (a == NULL || a->is_queued == 0) continue;
+        a->is_queued = 0;
+        if (first == NULL) first = a; else last->next = a;
+        last = a;
+        a->first = first;
+        sql_len += strlen (a->sql) + 2;
+    }
+    va_end (args);
+    if (first == NULL) return;
+    if (first->next == NULL) first->first = NULL;
+
+    char *sql = cld_malloc (sql_len + 1);
+    size_t pos = 0;
+    cld_async *a;
+    for (a = first; a != NULL; a = a->next)
+    {
+        if (pos != 0) sql[pos++] = ';';
+        strcpy (sql + pos, a->sql);
+        pos += strlen (a->sql);
+    }
+    cld_async_send (first, sql);
+    cld_free (sql);
+}
+
+// 
+// Get results of query 'a' sent with cld_select_async(), waiting for it to execute if it hasn't yet. The rest is the same as 
+// for cld_select_table(). 
+//
+void cld_async_wait (cld_async *a, int *nrow, int *ncol, char ***col_names, char ***data, unsigned long **lengths)
+{
+    CLD_TRACE("");
+    cld_async_finish (a);
+    *nrow = a->nrow;
+    *ncol = a->ncol;
+    *col_names = a->col_names;
+    *data = a->data;
+    *lengths = a->lengths;
+}
+
+// 
+// Get results of queries sent with cld_select_async() that weren't used (such as when request ended before), so that
+// connections they were sent on can be used again.
+//
+void cld_async_done ()
+{
+    int i;
+    for (i = 0; i < CLD_MAX_ASYNC_CONN; i++)
+    {
+        if (CTX.async[i] != NULL) cld_async_finish (CTX.async[i]);
+    }
+}
+
+
+//
+// Select with prepared statement for query site 'site'. 's', 'num_of_args' and 'args' are the same as for cld_run_stmt(), 
+// and the rest is the same as for cld_select_table(), except that 'data' cannot be NULL.
+// All columns of all rows are copied into a single block of memory, one after the other, each ending with zero.
+// 'types' (for define-query#...typed) has a letter for each column: 'i' if it's obtained as long long, 'd' if as double, 
+// and 't' if as text only, and 'nums' is then allocated array of values of columns, in the same order as 'data' (and 0 
+// for text columns and NULL). Numeric values are obtained in binary form, and their text is made from them (except for 
+// DECIMAL, which is sent as text, and which is converted to double). If 'types' is NULL, all columns are text, and 'nums'
+// isn't used.
+//
+void cld_select_stmt (cld_qry_site *site, const char *s, int num_of_args, const char **args, int *nrow, int *ncol, char ***col_names, char ***data, 
+    unsigned long **lengths, const char *types, cld_num **nums)
+{
+    CLD_TRACE("");
+    assert (nrow);
+    assert (ncol);
+    assert (col_names);
+    assert (data);
+
+    char *sname = "";
+    int lnum = 0;
+    // get location in end-user source code where this is called from, for error reporting purposes
+    cld_location (&sname, &lnum, 0);
+
+    const char *errm="";
+    unsigned int er = 0;
+    // execute on read replica if there is one, otherwise on the database
+    MYSQL_STMT *st = cld_replica_stmt (site, s, num_of_args, args);
+    if (st == NULL && cld_run_stmt (site, s, num_of_args, args, &st, &er, &errm) == 0)
     {
         cld_report_error ("Cannot perform select, error [%d], error summary: [%s], line [%d], file [%s]", er, errm, lnum,sname);
     }
-                
-    MYSQL_RES *result = NULL;
 
+    // time getting results counts toward database time too
+    struct timespec fetch_start;
+    clock_gettime (CLOCK_MONOTONIC, &fetch_start);
 
-    if (data != NULL)
+    int i;
+    if (st == NULL)
     {
-        // get all result data
-        result = mysql_store_result(cld_get_db_connection (fname));
+        // executed as SQL text (see cld_run_stmt()), so result is on db connection, and numbers are made from text
+        MYSQL *con = cld_get_db_connection (cld_get_config ()->app.db);
+        MYSQL_RES *result = mysql_store_result (con);
+        if (result == NULL) 
+        {
+            cld_report_error ("Error storing obtained data, error %s, line [%d], file [%s]", mysql_error (con), lnum, sname);
+        }
+        cld_result_rows (result, nrow, ncol, col_names, data, lengths);
+        if (types != NULL)
+        {
+            int num_types = strlen (types);
+            *nums = (cld_num*)cld_calloc (*nrow * *ncol + 1, sizeof (cld_num));
+            for (i = 0; i < *nrow * *ncol; i++)
+            {
+                int col = i % *ncol;
+                if (col >= num_types) continue;
+                if (types[col] == 'i') (*nums)[i].i = strtoll ((*data)[i], NULL, 10);
+                else if (types[col] == 'd') (*nums)[i].d = strtod ((*data)[i], NULL);
+            }
+        }
+        cld_qry_site_time (cld_timing_add (CLD_PHASE_DB, &fetch_start), 1);
+        return;
     }
-    else
+
+    if (mysql_stmt_store_result (st) != 0)
     {
-        // no need to fetch the result yet, since we're getting column names only
-        result = mysql_use_result(cld_get_db_connection (fname));
+        cld_report_error ("Error storing obtained data, error %s, line [%d], file [%s]", mysql_stmt_error (st), lnum, sname);
     }
-                    
-    if (result == NULL) 
+    MYSQL_RES *meta = mysql_stmt_result_metadata (st);
+    if (meta == NULL)
     {
-        cld_report_error ("Error storing obtained data, error %s, line [%d], file [%s]", mysql_error(cld_get_db_connection (fname)), lnum, sname);
+        cld_report_error ("Query does not return a result set, found [%s], line [%d], file [%s]", s, lnum, sname);
     }
 
-    // get number of columns
-    int num_fields = mysql_num_fields(result);
-
-    MYSQL_ROW row;
-
-    // number of columns is needed whether we get column names only or result data
+    int num_fields = mysql_num_fields (meta);
+    MYSQL_FIELD *fields = mysql_fetch_fields (meta);
     *ncol = num_fields;
 
-    // output columns
-    MYSQL_FIELD *field;
-
-    // 
-    // allocate column names too
-    //
     *col_names = (char**)cld_calloc (num_fields, sizeof(char*));
-
-    //
-    // Get column names to be either used when requested
-    //
-    int field_index = 0;
-    while ((field = mysql_fetch_field(result)))
+    MYSQL_BIND *res = (MYSQL_BIND*)cld_calloc (num_fields, sizeof (MYSQL_BIND));
+    unsigned long *lens = (unsigned long*)cld_calloc (num_fields, sizeof (unsigned long));
+    my_bool *is_null = (my_bool*)cld_calloc (num_fields, sizeof (my_bool));
+    my_bool *is_trunc = (my_bool*)cld_calloc (num_fields, sizeof (my_bool));
+    int num_types = (types == NULL ? 0 : strlen (types));
+
+    size_t row_size = 0; // size of the longest row
+    for (i = 0; i < num_fields; i++)
     {
-        (*col_names)[field_index] = cld_strdup(field->name);
-        field_index++;
+        (*col_names)[i] = cld_strdup (fields[i].name);
+        res[i].length = &(lens[i]);
+        res[i].is_null = &(is_null[i]);
+        res[i].error = &(is_trunc[i]);
+        // numeric columns of typed query are obtained as numbers, converted by the client library if column type differs
+        if (i < num_types && (types[i] == 'i' || (types[i] == 'd' && fields[i].type != MYSQL_TYPE_DECIMAL && fields[i].type != MYSQL_TYPE_NEWDECIMAL)))
+        {
+            row_size += MYS_NUM_LEN + 1;
+            res[i].buffer_type = (types[i] == 'i' ? MYSQL_TYPE_LONGLONG : MYSQL_TYPE_DOUBLE);
+            res[i].buffer = cld_calloc (1, sizeof (cld_num));
+            res[i].buffer_length = sizeof (cld_num);
+            res[i].is_unsigned = ((fields[i].flags & UNSIGNED_FLAG) != 0);
+            continue;
+        }
+        // all other columns are obtained as strings; buffer is sized for the longest value in the result, but if that's 
+        // not enough (max_length for numbers and dates is an estimate), the column is fetched again below
+        unsigned long size = fields[i].max_length + 1;
+        if (size < MYS_MIN_COL_BUF) size = MYS_MIN_COL_BUF;
+        row_size += fields[i].max_length + 1;
+        res[i].buffer_type = MYSQL_TYPE_STRING;
+        res[i].buffer = cld_malloc (size);
+        res[i].buffer_length = size;
     }
-    if (data == NULL)
+    if (mysql_stmt_bind_result (st, res) != 0)
     {
-        // clean the result and return in case we want column names ONLY
-        mysql_free_result(result);
-        return;
+        cld_report_error ("Error binding result data, error %s, line [%d], file [%s]", mysql_stmt_error (st), lnum, sname);
     }
-                                     
-    // 
-    // this is getting actual data
-    //
+
     *nrow = 0;
+    // all rows are already in memory, so arrays for them are allocated once
+    int num_rows = (int) mysql_stmt_num_rows (st);
+    *data = cld_calloc(num_rows*num_fields + 1, sizeof(char*));
+    unsigned long *col_lens = (num_rows == 0 ? NULL : (unsigned long*)cld_malloc (num_rows*num_fields*sizeof(unsigned long)));
+    if (types != NULL) *nums = (cld_num*)cld_calloc (num_rows*num_fields + 1, sizeof (cld_num));
+
+    // block for all data is sized for longest rows, unless that's much more than what's typical. Data is placed in it
+    // one column after another, and it's expanded if it turns out to be too small.
+    size_t data_size = (size_t)num_rows * row_size;
+    if (data_size > (size_t)num_rows * num_fields * MYS_AVG_COL_LEN) data_size = (size_t)num_rows * num_fields * MYS_AVG_COL_LEN;
+    char *block = (char*)cld_malloc (data_size + 1);
+    size_t used = 0;
+    long long bytes = 0; // bytes of result data copied
+
+    int fetched;
+    while ((fetched = mysql_stmt_fetch (st)) != MYSQL_NO_DATA)
+    {
+        if (fetched != 0 && fetched != MYSQL_DATA_TRUNCATED)
+        {
+            cld_report_error ("Error fetching data, error %s, line [%d], file [%s]", mysql_stmt_error (st), lnum, sname);
+        }
+        for (i = 0; i < num_fields; i++)
+        {
+            int cpos = *nrow * num_fields + i;
+            // NULL is the same as empty
+            unsigned long len = (is_null[i] ? 0 : lens[i]);
+            char num_text[MYS_NUM_LEN + 1];
+            const char *val = res[i].buffer;
+            if (res[i].buffer_type != MYSQL_TYPE_STRING)
+            {
+                // text is made from the number, and it's empty for NULL (whose number is 0)
+                cld_num *num = (cld_num*)res[i].buffer;
+                len = 0;
+                if (!is_null[i] && res[i].buffer_type == MYSQL_TYPE_LONGLONG)
+                {
+                    (*nums)[cpos].i = num->i;
+                    if (res[i].is_unsigned) len = snprintf (num_text, sizeof (num_text), "%llu", (unsigned long long)num->i);
+                    else len = snprintf (num_text, sizeof (num_text), "%lld", num->i);
+                }
+                else if (!is_null[i])
+                {
+                    // with as many significant digits as FLOAT and DOUBLE are precise to
+                    (*nums)[cpos].d = num->d;
+                    len = snprintf (num_text, sizeof (num_text), "%.*g", fields[i].type == MYSQL_TYPE_FLOAT ? 6 : 15, num->d);
+                }
+                val = num_text;
+                is_trunc[i] = 0;
+            }
+            if (used + len + 1 > data_size)
+            {
+                while (used + len + 1 > data_size) data_size = 2 * data_size + 1;
+                block = (char*)cld_realloc (block, data_size + 1);
+            }
+            if (is_trunc[i])
+            {
+                // value didn't fit in buffer, get all of it
+                MYSQL_BIND col;
+                memset (&col, 0, sizeof (col));
+                col.buffer_type = MYSQL_TYPE_STRING;
+                col.buffer = block + used;
+                col.buffer_length = len + 1;
+                col.length = &len;
+                if (mysql_stmt_fetch_column (st, &col, i, 0) != 0)
+                {
+                    cld_report_error ("Error fetching column, error %s, line [%d], file [%s]", mysql_stmt_error (st), lnum, sname);
+                }
+            }
+            else if (len != 0) memcpy (block + used, val, len);
+            block[used + len] = 0;
+            if (types != NULL && i < num_types && types[i] == 'd' && res[i].buffer_type == MYSQL_TYPE_STRING) 
+            {
+                (*nums)[cpos].d = strtod (block + used, NULL);
+            }
+            col_lens[cpos] = len;
+            used += len + 1;
+            bytes += len;
+        }
+        (*nrow)++;
+    }
+    CLD_TRACE("SELECT retrieved [%d] rows", *nrow);
 
-// get this many rows to start with, increment by this afterwards
-#define CLD_INITIAL_QUERY_BATCH 200
+    // block doesn't move anymore, so columns can point into it
+    char *curr = block;
+    for (i = 0; i < *nrow * num_fields; i++)
+    {
+        (*data)[i] = curr;
+        curr += col_lens[i] + 1;
+    }
+    if (lengths != NULL) *lengths = col_lens;
+
+    mysql_free_result (meta);
+    mysql_stmt_free_result (st);
+    for (i = 0; i < num_fields; i++) cld_free (res[i].buffer);
+    cld_qry_site_time (cld_timing_add (CLD_PHASE_DB, &fetch_start), 1);
+    site->rows += *nrow;
+    site->bytes += bytes;
+}
 
-    int query_batch = CLD_INITIAL_QUERY_BATCH;
 
-    // allocate the array where data is
-    *data = cld_calloc(query_batch*num_fields, sizeof(char**));
 
-    int i;
+//
+// Select with prepared statement for query site 'site', where rows are read from the database one at a time as they are used, 
+// with cld_stream_next(), instead of all at once. Memory used is that of a single row. 's', 'num_of_args' and 'args' are the
+// same as for cld_run_stmt(), 'ncol' and 'col_names' the same as for cld_select_table().
+// Returns query to use with cld_stream_next() and cld_stream_done().
+// Until all rows are read, no other query can execute on db connection, so if one does, the rest of rows are read ahead
+// first (see cld_stream_store()).
+//
+cld_stream *cld_select_stream (cld_qry_site *site, const char *s, int num_of_args, const char **args, int *ncol, char ***col_names)
+{
+    CLD_TRACE("");
+    assert (ncol);
+    assert (col_names);
 
-    // fetch all rows, one by one (result is already here in memory)
-    while ((row = mysql_fetch_row(result))) 
-    { 
+    char *sname = "";
+    int lnum = 0;
+    // get location in end-user source code where this is called from, for error reporting purposes
+    cld_location (&sname, &lnum, 0);
 
-        // get lengths of each column
-        unsigned long *lens = mysql_fetch_lengths (result);
+    const char *errm="";
+    unsigned int er = 0;
+    MYSQL_STMT *stmt;
+    if (cld_run_stmt (site, s, num_of_args, args, &stmt, &er, &errm) == 0)
+    {
+        cld_report_error ("Cannot perform select, error [%d], error summary: [%s], line [%d], file [%s]", er, errm, lnum,sname);
+    }
+    if (stmt == NULL)
+    {
+        // executed as SQL text (see cld_run_stmt()), so all rows are read at once, and used from memory as if read ahead
+        struct timespec fetch_start;
+        clock_gettime (CLOCK_MONOTONIC, &fetch_start);
+        MYSQL *con = cld_get_db_connection (cld_get_config ()->app.db);
+        MYSQL_RES *result = mysql_store_result (con);
+        if (result == NULL) 
+        {
+            cld_report_error ("Error storing obtained data, error %s, line [%d], file [%s]", mysql_error (con), lnum, sname);
+        }
+        cld_stream *st = (cld_stream*)cld_calloc (1, sizeof (cld_stream));
+        st->site = site;
+        cld_result_rows (result, &(st->nrow), ncol, col_names, &(st->data), NULL);
+        st->ncol = *ncol;
+        cld_qry_site_time (cld_timing_add (CLD_PHASE_DB, &fetch_start), 1);
+        return st;
+    }
 
-        // check if buffer is full, if so, allocate another chunk for as long as we need it
-        if (*nrow>=query_batch)
+    MYSQL_RES *meta = mysql_stmt_result_metadata (stmt);
+    if (meta == NULL)
+    {
+        cld_report_error ("Query does not return a result set, found [%s], line [%d], file [%s]", s, lnum, sname);
+    }
+    int num_fields = mysql_num_fields (meta);
+    MYSQL_FIELD *fields = mysql_fetch_fields (meta);
+
+    cld_stream *st = (cld_stream*)cld_calloc (1, sizeof (cld_stream));
+    st->site = site;
+    st->stmt = stmt;
+    st->ncol = num_fields;
+    st->res = (MYSQL_BIND*)cld_calloc (num_fields, sizeof (MYSQL_BIND));
+    st->lens = (unsigned long*)cld_calloc (num_fields, sizeof (unsigned long));
+    st->is_null = (my_bool*)cld_calloc (num_fields, sizeof (my_bool));
+    st->is_trunc = (my_bool*)cld_calloc (num_fields, sizeof (my_bool));
+    st->big = (char**)cld_calloc (num_fields, sizeof (char*));
+    st->big_size = (unsigned long*)cld_calloc (num_fields, sizeof (unsigned long));
+    st->row = (char**)cld_calloc (num_fields, sizeof (char*));
+
+    *ncol = num_fields;
+    *col_names = (char**)cld_calloc (num_fields, sizeof(char*));
+    int i;
+    for (i = 0; i < num_fields; i++)
+    {
+        (*col_names)[i] = cld_strdup (fields[i].name);
+        // longest value isn't known until rows are read, so buffer is sized for column width, up to a limit
+        unsigned long size = fields[i].length;
+        if (size < MYS_MIN_COL_BUF) size = MYS_MIN_COL_BUF;
+        if (size > MYS_STREAM_COL_BUF) size = MYS_STREAM_COL_BUF;
+        st->res[i].buffer_type = MYSQL_TYPE_STRING;
+        st->res[i].buffer = cld_malloc (size + 1); // one more byte for zero at the end
+        st->res[i].buffer_length = size;
+        st->res[i].length = &(st->lens[i]);
+        st->res[i].is_null = &(st->is_null[i]);
+        st->res[i].error = &(st->is_trunc[i]);
+    }
+    mysql_free_result (meta);
+    if (mysql_stmt_bind_result (stmt, st->res) != 0)
+    {
+        cld_report_error ("Error binding result data, error %s, line [%d], file [%s]", mysql_stmt_error (stmt), lnum, sname);
+    }
+    CTX.stream = st;
+    return st;
+}
+
+//
+// Read the next row of streamed query 'st' from the database. Columns are in 'row' (NULL is the same as empty), and they
+// are valid until the next row is read. Lengths of columns are in st->lens.
+// Returns 1 if row is read, 0 if there are no more rows.
+//
+static int cld_stream_fetch (cld_stream *st, char **row)
+{
+    CLD_TRACE("");
+    int fetched = mysql_stmt_fetch (st->stmt);
+    if (fetched == MYSQL_NO_DATA) return 0;
+    if (fetched != 0 && fetched != MYSQL_DATA_TRUNCATED)
+    {
+        cld_report_error ("Error fetching data, error %s, line [%d], file [%s]", mysql_stmt_error (st->stmt), st->site->line, st->site->file);
+    }
+    int i;
+    for (i = 0; i < st->ncol; i++)
+    {
+        unsigned long len = (st->is_null[i] ? 0 : st->lens[i]);
+        char *val = (char*)(st->res[i].buffer);
+        if (st->is_trunc[i])
         {
-            query_batch+=CLD_INITIAL_QUERY_BATCH;
-            *data = cld_realloc(*data, query_batch*num_fields*sizeof(char**));
+            // value didn't fit in result buffer, get all of it in a buffer kept for such values of this column
+            if (len + 1 > st->big_size[i])
+            {
+                if (st->big[i] != NULL) cld_free (st->big[i]);
+                st->big_size[i] = len + 1;
+                st->big[i] = cld_malloc (st->big_size[i]);
+            }
+            MYSQL_BIND col;
+            memset (&col, 0, sizeof (col));
+            col.buffer_type = MYSQL_TYPE_STRING;
+            col.buffer = st->big[i];
+            col.buffer_length = len + 1;
+            col.length = &len;
+            if (mysql_stmt_fetch_column (st->stmt, &col, i, 0) != 0)
+            {
+                cld_report_error ("Error fetching column, error %s, line [%d], file [%s]", mysql_stmt_error (st->stmt), st->site->line, st->site->file);
+            }
+            val = st->big[i];
         }
+        val[len] = 0;
+        row[i] = val;
+        st->lens[i] = len;
+        st->site->bytes += len;
+    }
+    st->site->rows++;
+    return 1;
+}
 
-        for(i = 0; i < num_fields; i++) 
-        { 
-            // calculate position in data
-            int cpos = *nrow * num_fields + i;
+//
+// Read all rows of streamed query 'st' not used yet, so that another query can execute on db connection. They are then
+// used from memory. Current row is copied, since its columns are in buffers used to read rows.
+//
+static void cld_stream_store (cld_stream *st)
+{
+    CLD_TRACE("");
+    struct timespec fetch_start;
+    clock_gettime (CLOCK_MONOTONIC, &fetch_start);
 
-            // allocate memory for each column. We don't use row directly even though it'd be a bit 
-            // faster because memory allocation isn't cld_* - 
-            // we would have to free the result (mysql_free_result()) at the end, which would be more complex
-            // than automatically cleaning up cld_* allocated memory. mysql_free_result() implementation could change
-            // and we don't know exactly what's in it. However, we could 'register' result variable as mysql and
-            // free it at the end. This is TODO for a speedup in obtaining results.
-            //
-            (*data)[cpos] = cld_malloc (lens[i]+1);
+    int i;
+    for (i = 0; i < st->ncol; i++)
+    {
+        if (st->row[i] == NULL) continue;
+        // column can be binary, so copy its length and not up to the first null
+        char *val = cld_malloc (st->lens[i] + 1);
+        memcpy (val, st->row[i], st->lens[i]);
+        val[st->lens[i]] = 0;
+        st->row[i] = val;
+    }
 
-            // copy data
-            memcpy ((*data)[cpos], row[i] ? row[i] : "", lens[i]);
-            (*data)[cpos][lens[i]] = 0; // end with zero in any case, even if binary
-                                        // wont' hurt
-        } 
-        (*nrow)++;
+    char **row = (char**)cld_calloc (st->ncol, sizeof (char*));
+    int query_batch = 0;
+    while (cld_stream_fetch (st, row) == 1)
+    {
+        if (st->nrow >= query_batch)
+        {
+            query_batch += CLD_INITIAL_QUERY_BATCH;
+            st->data = (st->data == NULL ? cld_calloc (query_batch * st->ncol, sizeof (char*)) : 
+                cld_realloc (st->data, query_batch * st->ncol * sizeof (char*)));
+        }
+        for (i = 0; i < st->ncol; i++)
+        {
+            char *val = cld_malloc (st->lens[i] + 1);
+            memcpy (val, row[i], st->lens[i] + 1);
+            st->data[st->nrow * st->ncol + i] = val;
+        }
+        st->nrow++;
     }
-    CLD_TRACE("SELECT retrieved [%d] rows", *nrow);
-    mysql_free_result(result);
+    cld_free (row);
+    CLD_TRACE("Query read ahead [%d] rows", st->nrow);
+
+    cld_qry_site *site = CTX.qry_site;
+    CTX.qry_site = st->site;
+    cld_qry_site_time (cld_timing_add (CLD_PHASE_DB, &fetch_start), 1);
+    CTX.qry_site = site;
+    cld_stream_done (st);
+}
 
+//
+// Get the next row of streamed query 'st' (see cld_select_stream()) in 'row'. Columns of row are valid until the next row.
+// 'st' can be NULL, in which case there are no rows.
+// Returns 1 if there is a row, 0 if there are no more rows.
+//
+int cld_stream_next (cld_stream *st, char ***row)
+{
+    CLD_TRACE("");
+    if (st == NULL) return 0;
+    if (st->stmt == NULL)
+    {
+        // rows were read ahead
+        if (st->curr >= st->nrow) return 0;
+        *row = st->data + st->curr * st->ncol;
+        st->curr++;
+        return 1;
+    }
+
+    // time getting results counts toward database time and toward this query
+    struct timespec fetch_start;
+    clock_gettime (CLOCK_MONOTONIC, &fetch_start);
+    int is_row = cld_stream_fetch (st, st->row);
+    cld_qry_site *site = CTX.qry_site;
+    CTX.qry_site = st->site;
+    cld_qry_site_time (cld_timing_add (CLD_PHASE_DB, &fetch_start), 1);
+    CTX.qry_site = site;
+    if (is_row == 0) cld_stream_done (st);
+
+    *row = st->row;
+    return is_row;
+}
+
+//
+// Done reading rows of streamed query 'st'. If not all rows were read (such as with exit-query), the rest are discarded.
+// 'st' can be NULL, in which case nothing is done.
+//
+void cld_stream_done (cld_stream *st)
+{
+    CLD_TRACE("");
+    if (st == NULL) return;
+    if (st->stmt != NULL)
+    {
+        mysql_stmt_free_result (st->stmt);
+        st->stmt = NULL;
+        int i;
+        for (i = 0; i < st->ncol; i++)
+        {
+            cld_free (st->res[i].buffer);
+            if (st->big[i] != NULL) cld_free (st->big[i]);
+        }
+    }
+    if (CTX.stream == st) CTX.stream = NULL;
 }
 
 
 
+//
+// Free database result 'res', used to release it with request memory (see cld_add_resource()).
+//
+static void cld_free_result (void *res)
+{
+    mysql_free_result ((MYSQL_RES*)res);
+}
 
 //
 // Initialize iterator for mysql result buffer obtained from cld_select_table()
@@ -750,10 +2972,6 @@ void cld_data_iterator_fill_array (char **data, int nrow, int ncol, char ****arr
     assert (nrow);
     assert (ncol);
 
-    cld_iter it;
-    char *d;
-    int br;
-
     // allocate output result.
     *arr = (char***)cld_calloc (nrow, sizeof (char***));
     if (*arr == NULL)
@@ -762,33 +2980,12 @@ void cld_data_iterator_fill_array (char **data, int nrow, int ncol, char ****arr
             nrow * (int)sizeof(char***));
     }
 
-    // allocate each row (meaning a set of columns)
+    // data is already laid out row after row, so each row (meaning a set of columns) just points to where it 
+    // starts in data
     int i;
     for (i = 0; i < nrow; i++)
     {
-        (*arr)[i] = (char**)cld_malloc (sizeof (char**) * ncol);
-        if ((*arr)[i] == NULL)
-        {
-            cld_report_error ("Out of memory in result set array of size [%d]",
-                ncol * (int)sizeof(char**));
-        }
-    }
-
-    int crow = 0;
-    int ccol = 0;
-
-    // use data iterator to go through all the data and to store pointers to results
-    // to 'arr'
-    cld_data_iterator_init (&it, data, nrow, ncol);
-    while ((d = cld_data_iterator_next(&it, &br)))
-    {
-        (*arr)[crow][ccol] = d;
-        ccol++;
-        if (br) 
-        {
-            crow++;
-            ccol = 0;
-        }
+        (*arr)[i] = data + i * ncol;
     }
 }
 
@@ -881,14 +3078,17 @@ void cld_get_empty_row (char ****arr, int ncol)
 // 'name' is the name of db user, 'passwd' is the password of this user,
 // 'db' is the name of the database.
 // 'fname' is the name of the file (named ".db").
+// 'replica' is 0 for the database, or the number of read replica (starting with 1), in which case
+// 'host' is the host of that replica, listed one per line after database name, and the rest is the same.
 // Returns -1 if cannot open file, -2 if permissions aren't correct (must be 600),
-// 0 if okay.
+// -3 if there is no such replica, 0 if okay.
 //
 int cld_get_credentials(char* host, 
                     char* name, 
                     char* passwd, 
                     char* db,
-                    const char *fname)
+                    const char *fname,
+                    int replica)
 {
   CLD_TRACE ("");
   struct stat sb;
@@ -920,6 +3120,16 @@ int cld_get_credentials(char* host,
      if (res == NULL) return 0;
      res = fgets(db, CLD_SECURITY_FIELD_LEN - 1, login_file);
      if (res == NULL) return 0;
+     int k;
+     for (k = 1; k <= replica; k++)
+     {
+         res = fgets(host, CLD_SECURITY_FIELD_LEN - 1, login_file);
+         if (res == NULL || host[strspn (host, " \t\r\n")] == '\0')
+         {
+             fclose(login_file);
+             return -3;
+         }
+     }
      host[strcspn (host, "\n")] = '\0';
      name[strcspn (name, "\n")] = '\0';
      passwd[strcspn (passwd, "\n")] = '\0';
@@ -53,6 +53,39 @@ char *cld_sha( const char *val )
     return out;
 }
 
+// 
+// Write 'len' bytes of 'data' to file 'f' in chunks, computing SHA256 hash of data as it is written.
+// 'hash' must be at least 65 bytes long and gets 64 bytes of hex representation + zero byte.
+// This way the hash of uploaded file is available without reading the file back from disk.
+// Returns 1 if okay, 0 if cannot write.
+//
+int cld_write_sha (FILE *f, const char *data, size_t len, char *hash)
+{
+    unsigned char digest[SHA256_DIGEST_LENGTH];
+    SHA256_CTX sha256;
+
+    SHA256_Init(&sha256);
+
+    size_t done = 0;
+    while (done < len)
+    {
+        size_t chunk = len - done;
+        if (chunk > CLD_POST_CHUNK) chunk = CLD_POST_CHUNK;
+        SHA256_Update(&sha256, data + done, chunk);
+        if (fwrite (data + done, chunk, 1, f) != 1) return 0;
+        done += chunk;
+    }
+    SHA256_Final(digest, &sha256);
+
+    int i;
+    char *p = hash;
+    for ( i = 0; i < SHA256_DIGEST_LENGTH; i++, p += 2 ) 
+    {
+        snprintf ( p, 3, "%02x", digest[i] );
+    }
+    return 1;
+}
+
 // 
 // Produce a key out of password, and fill cipher context with the key
 // Then use this context to actually encrypt or decrypt.